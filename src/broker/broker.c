@@ -4,11 +4,13 @@
 
 #include <c-list.h>
 #include <c-macro.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
 #include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include "broker/broker.h"
 #include "broker/controller.h"
@@ -18,8 +20,53 @@
 #include "dbus/message.h"
 #include "util/dispatch.h"
 #include "util/error.h"
+#include "util/recorder.h"
+#include "util/timer.h"
 #include "util/user.h"
 
+static void broker_dump_recorder(Broker *broker) {
+        struct stat st;
+        int r, fd;
+
+        if (!main_arg_flight_recorder) {
+                if (main_arg_verbose)
+                        fprintf(stderr, "Caught SIGUSR1, but no flight recorder file configured\n");
+                return;
+        }
+
+        fd = open(main_arg_flight_recorder, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW | O_NOCTTY | O_NONBLOCK, 0600);
+        if (fd < 0) {
+                fprintf(stderr, "Cannot open flight recorder file '%s': %m\n", main_arg_flight_recorder);
+                return;
+        }
+
+        /* never write to pipes or devices, which could stall the broker */
+        if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+                fprintf(stderr, "Flight recorder file '%s' is not a regular file\n", main_arg_flight_recorder);
+                c_close(fd);
+                return;
+        }
+
+        r = recorder_dump(&broker->bus.recorder, fd);
+        c_close(fd);
+        if (r)
+                fprintf(stderr, "Cannot write flight recorder file '%s'\n", main_arg_flight_recorder);
+        else if (main_arg_verbose)
+                fprintf(stderr, "Dumped flight recorder to '%s'\n", main_arg_flight_recorder);
+}
+
+static int broker_drain_timeout(Timeout *timeout) {
+        if (main_arg_verbose)
+                fprintf(stderr, "Drain timeout expired, exiting\n");
+
+        return DISPATCH_E_EXIT;
+}
+
+static bool broker_is_drained(Broker *broker) {
+        return !connection_has_output(&broker->controller.connection) &&
+               peer_registry_is_drained(&broker->bus.peers);
+}
+
 static int broker_dispatch_signals(DispatchFile *file) {
         Broker *broker = c_container_of(file, Broker, signals_file);
         struct signalfd_siginfo si;
@@ -28,11 +75,34 @@ static int broker_dispatch_signals(DispatchFile *file) {
         assert(dispatch_file_events(file) == EPOLLIN);
 
         l = read(broker->signals_fd, &si, sizeof(si));
-        if (l < 0)
+        if (l < 0) {
+                if (errno == EAGAIN) {
+                        dispatch_file_clear(file, EPOLLIN);
+                        return 0;
+                }
+
                 return error_origin(-errno);
+        }
 
         assert(l == sizeof(si));
 
+        if (si.ssi_signo == SIGUSR1) {
+                broker_dump_recorder(broker);
+                return 0;
+        }
+
+        /*
+         * On the first SIGTERM, deliver what is queued before exiting, unless
+         * draining was disabled. Any further SIGTERM, as well as SIGINT,
+         * makes us exit right away.
+         */
+        if (si.ssi_signo == SIGTERM && broker->drain_timeout && !broker->bus.draining) {
+                if (main_arg_verbose)
+                        fprintf(stderr, "Caught SIGTERM, draining\n");
+
+                return error_trace(broker_drain(broker));
+        }
+
         if (main_arg_verbose)
                 fprintf(stderr,
                         "Caught %s, exiting\n",
@@ -61,6 +131,10 @@ int broker_new(Broker **brokerp, int controller_fd, uint64_t max_bytes, uint64_t
         broker->bus = (Bus)BUS_NULL(broker->bus);
         broker->dispatcher = (DispatchContext)DISPATCH_CONTEXT_NULL(broker->dispatcher);
         broker->signals_fd = -1;
+        broker->timer = (Timer)TIMER_NULL(broker->timer);
+        broker->activation_timeout = main_arg_activation_timeout * 1000;
+        broker->drain_timeout = main_arg_drain_timeout * 1000;
+        broker->drain_deadline = (Timeout)TIMEOUT_NULL(broker->drain_deadline);
         broker->signals_file = (DispatchFile)DISPATCH_FILE_NULL(broker->signals_file);
         broker->controller = (Controller)CONTROLLER_NULL(broker->controller);
 
@@ -69,6 +143,7 @@ int broker_new(Broker **brokerp, int controller_fd, uint64_t max_bytes, uint64_t
                 return error_fold(r);
 
         broker->bus.pid = ucred.pid;
+        broker->bus.reply_reserve = main_arg_reply_reserve;
         r = user_registry_ref_user(&broker->bus.users, &broker->bus.user, ucred.uid);
         if (r)
                 return error_fold(r);
@@ -77,9 +152,17 @@ int broker_new(Broker **brokerp, int controller_fd, uint64_t max_bytes, uint64_t
         if (r)
                 return error_fold(r);
 
+        broker->dispatcher.recorder = &broker->bus.recorder;
+        broker->dispatcher.stats.threshold = main_arg_stall_threshold * 1000;
+
+        r = timer_init(&broker->timer, &broker->dispatcher);
+        if (r)
+                return error_fold(r);
+
         sigemptyset(&sigmask);
         sigaddset(&sigmask, SIGTERM);
         sigaddset(&sigmask, SIGINT);
+        sigaddset(&sigmask, SIGUSR1);
 
         broker->signals_fd = signalfd(-1, &sigmask, SFD_CLOEXEC | SFD_NONBLOCK);
         if (broker->signals_fd < 0)
@@ -94,6 +177,7 @@ int broker_new(Broker **brokerp, int controller_fd, uint64_t max_bytes, uint64_t
         if (r)
                 return error_fold(r);
 
+        dispatch_file_set_name(&broker->signals_file, "signals", 0);
         dispatch_file_select(&broker->signals_file, EPOLLIN);
 
         r = controller_init(&broker->controller, broker, controller_fd);
@@ -112,6 +196,8 @@ Broker *broker_free(Broker *broker) {
         controller_deinit(&broker->controller);
         dispatch_file_deinit(&broker->signals_file);
         c_close(broker->signals_fd);
+        timeout_cancel(&broker->drain_deadline);
+        timer_deinit(&broker->timer);
         dispatch_context_deinit(&broker->dispatcher);
         bus_deinit(&broker->bus);
         free(broker);
@@ -126,6 +212,7 @@ int broker_run(Broker *broker) {
         sigemptyset(&signew);
         sigaddset(&signew, SIGTERM);
         sigaddset(&signew, SIGINT);
+        sigaddset(&signew, SIGUSR1);
 
         sigprocmask(SIG_BLOCK, &signew, &sigold);
 
@@ -143,6 +230,13 @@ int broker_run(Broker *broker) {
                         r = MAIN_FAILED;
                 else
                         r = error_fold(r);
+
+                if (!r && _c_unlikely_(broker->bus.draining) && broker_is_drained(broker)) {
+                        if (main_arg_verbose)
+                                fprintf(stderr, "Drained all queues, exiting\n");
+
+                        r = MAIN_EXIT;
+                }
         } while (!r);
 
         peer_registry_flush(&broker->bus.peers);
@@ -152,6 +246,46 @@ int broker_run(Broker *broker) {
         return r;
 }
 
+/**
+ * broker_drain() - shut down gracefully
+ * @broker:             broker to operate on
+ *
+ * This puts @broker into drain mode: listeners stop accepting connections,
+ * pending activations are failed, and new method calls are refused with a
+ * retryable error. Output that is already queued, as well as replies to calls
+ * still pending, is delivered as usual. Once nothing is left, or the drain
+ * timeout expired, broker_run() returns.
+ *
+ * Calling this on a broker that is already draining is a no-op.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int broker_drain(Broker *broker) {
+        int r;
+
+        if (broker->bus.draining)
+                return 0;
+
+        broker->bus.draining = true;
+
+        r = controller_drain(&broker->controller);
+        if (r)
+                return error_fold(r);
+
+        r = timeout_schedule(&broker->drain_deadline,
+                             &broker->timer,
+                             broker_drain_timeout,
+                             timer_now() + broker->drain_timeout);
+        if (r)
+                return error_fold(r);
+
+        return 0;
+}
+
 int broker_update_environment(Broker *broker, const char * const *env, size_t n_env) {
         return controller_dbus_send_environment(&broker->controller, env, n_env);
 }
+
+int broker_report_activation_failure(Broker *broker, const char *unit, const char *error_name, const char *error_message) {
+        return controller_dbus_send_activation_failure(&broker->controller, unit, error_name, error_message);
+}
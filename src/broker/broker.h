@@ -9,12 +9,17 @@
 #include "broker/controller.h"
 #include "bus/bus.h"
 #include "util/dispatch.h"
+#include "util/timer.h"
 
 typedef struct Broker Broker;
 
 struct Broker {
         Bus bus;
         DispatchContext dispatcher;
+        Timer timer;
+        uint64_t activation_timeout;
+        uint64_t drain_timeout;
+        Timeout drain_deadline;
 
         int signals_fd;
         DispatchFile signals_file;
@@ -28,7 +33,9 @@ int broker_new(Broker **brokerp, int controller_fd, uint64_t max_bytes, uint64_t
 Broker *broker_free(Broker *broker);
 
 int broker_run(Broker *broker);
+int broker_drain(Broker *broker);
 int broker_update_environment(Broker *broker, const char * const *env, size_t n_env);
+int broker_report_activation_failure(Broker *broker, const char *unit, const char *error_name, const char *error_message);
 
 C_DEFINE_CLEANUP(Broker *, broker_free);
 
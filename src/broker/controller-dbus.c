@@ -7,14 +7,19 @@
 #include <c-macro.h>
 #include <stdlib.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include "broker/broker.h"
 #include "broker/controller.h"
 #include "bus/policy.h"
 #include "dbus/connection.h"
 #include "dbus/message.h"
 #include "dbus/protocol.h"
+#include "util/dispatch.h"
 #include "util/error.h"
 #include "util/fdlist.h"
+#include "util/recorder.h"
+#include "util/user.h"
 
 typedef struct ControllerMethod ControllerMethod;
 typedef int (*ControllerMethodFn) (Controller *controller, const char *path, CDVar *var_in, FDList *fds_in, CDVar *var_out);
@@ -63,12 +68,45 @@ static const CDVarType controller_type_in_ohsv[] = {
                 )
         )
 };
-static const CDVarType controller_type_in_osu[] = {
+static const CDVarType controller_type_in_h[] = {
         C_DVAR_T_INIT(
-                C_DVAR_T_TUPLE3(
+                C_DVAR_T_TUPLE1(
+                        C_DVAR_T_h
+                )
+        )
+};
+static const CDVarType controller_type_in_s[] = {
+        C_DVAR_T_INIT(
+                C_DVAR_T_TUPLE1(
+                        C_DVAR_T_s
+                )
+        )
+};
+static const CDVarType controller_type_in_osuasu[] = {
+        C_DVAR_T_INIT(
+                C_DVAR_T_TUPLE4(
                         C_DVAR_T_o,
                         C_DVAR_T_s,
-                        C_DVAR_T_u
+                        C_DVAR_T_u,
+                        C_DVAR_T_ARRAY(
+                                C_DVAR_T_PAIR(
+                                        C_DVAR_T_s,
+                                        C_DVAR_T_u
+                                )
+                        )
+                )
+        )
+};
+static const CDVarType controller_type_in_uasu[] = {
+        C_DVAR_T_INIT(
+                C_DVAR_T_TUPLE2(
+                        C_DVAR_T_u,
+                        C_DVAR_T_ARRAY(
+                                C_DVAR_T_PAIR(
+                                        C_DVAR_T_s,
+                                        C_DVAR_T_u
+                                )
+                        )
                 )
         )
 };
@@ -79,6 +117,40 @@ static const CDVarType controller_type_out_unit[] = {
                 )
         )
 };
+static const CDVarType controller_type_out_apsv[] = {
+        C_DVAR_T_INIT(
+                CONTROLLER_T_MESSAGE(
+                        C_DVAR_T_TUPLE1(
+                                C_DVAR_T_ARRAY(
+                                        C_DVAR_T_PAIR(
+                                                C_DVAR_T_s,
+                                                C_DVAR_T_v
+                                        )
+                                )
+                        )
+                )
+        )
+};
+static const CDVarType controller_type_at[] = {
+        C_DVAR_T_INIT(
+                C_DVAR_T_ARRAY(
+                        C_DVAR_T_t
+                )
+        )
+};
+static const CDVarType controller_type_stalls[] = {
+        C_DVAR_T_INIT(
+                C_DVAR_T_ARRAY(
+                        C_DVAR_T_TUPLE5(
+                                C_DVAR_T_t,
+                                C_DVAR_T_t,
+                                C_DVAR_T_s,
+                                C_DVAR_T_t,
+                                C_DVAR_T_u
+                        )
+                )
+        )
+};
 
 static void controller_dvar_write_signature_out(CDVar *var, const CDVarType *type) {
         char signature[C_DVAR_TYPE_LENGTH_MAX + 1];
@@ -183,12 +255,30 @@ static int controller_end_read(CDVar *var) {
 }
 
 static int controller_method_add_name(Controller *controller, const char *_path, CDVar *in_v, FDList *fds, CDVar *out_v) {
-        const char *path, *name_str;
+        ActivationLimits limits = ACTIVATION_LIMITS_UNLIMITED;
+        const char *path, *name_str, *key;
         ControllerName *name;
+        bool invalid = false;
+        uint32_t value;
         uid_t uid;
         int r;
 
-        c_dvar_read(in_v, "(osu)", &path, &name_str, &uid);
+        c_dvar_read(in_v, "(osu[", &path, &name_str, &uid);
+
+        while (c_dvar_more(in_v)) {
+                c_dvar_read(in_v, "{su}", &key, &value);
+
+                if (!strcmp(key, "Bytes"))
+                        limits.n_bytes = value;
+                else if (!strcmp(key, "FDs"))
+                        limits.n_fds = value;
+                else if (!strcmp(key, "Messages"))
+                        limits.n_messages = value;
+                else
+                        invalid = true;
+        }
+
+        c_dvar_read(in_v, "])");
 
         r = controller_end_read(in_v);
         if (r)
@@ -198,8 +288,10 @@ static int controller_method_add_name(Controller *controller, const char *_path,
                 return CONTROLLER_E_UNEXPECTED_PATH;
         if (!dbus_validate_name(name_str, strlen(name_str)))
                 return CONTROLLER_E_NAME_INVALID;
+        if (invalid)
+                return CONTROLLER_E_NAME_LIMITS_INVALID;
 
-        r = controller_add_name(controller, &name, path, name_str, uid);
+        r = controller_add_name(controller, &name, path, name_str, uid, &limits);
         if (r)
                 return error_trace(r);
 
@@ -261,6 +353,160 @@ static int controller_method_add_listener(Controller *controller, const char *_p
         return 0;
 }
 
+static int controller_method_dump_recorder(Controller *controller, const char *_path, CDVar *in_v, FDList *fds, CDVar *out_v) {
+        uint32_t fd_index;
+        struct stat st;
+        int r, fd;
+
+        c_dvar_read(in_v, "(h)", &fd_index);
+
+        r = controller_end_read(in_v);
+        if (r)
+                return error_trace(r);
+
+        fd = fdlist_get(fds, fd_index);
+        if (fd < 0)
+                return CONTROLLER_E_RECORDER_INVALID_FD;
+
+        /* only accept regular files, so a slow reader cannot stall the broker */
+        r = fstat(fd, &st);
+        if (r < 0)
+                return (errno == EBADF) ? CONTROLLER_E_RECORDER_INVALID_FD : error_origin(-errno);
+        if (!S_ISREG(st.st_mode))
+                return CONTROLLER_E_RECORDER_INVALID_FD;
+
+        r = recorder_dump(&controller->broker->bus.recorder, fd);
+        if (r)
+                return (r == RECORDER_E_IO) ? CONTROLLER_E_RECORDER_FAILED : error_fold(r);
+
+        c_dvar_write(out_v, "()");
+
+        return 0;
+}
+
+static int controller_method_set_user_limits(Controller *controller, const char *_path, CDVar *in_v, FDList *fds, CDVar *out_v) {
+        static const char * const keys[_USER_SLOT_N] = {
+                [USER_SLOT_BYTES] = "Bytes",
+                [USER_SLOT_FDS] = "FDs",
+                [USER_SLOT_MATCHES] = "Matches",
+                [USER_SLOT_OBJECTS] = "Objects",
+        };
+        UserRegistry *registry = &controller->broker->bus.users;
+        unsigned int maxima[_USER_SLOT_N];
+        bool invalid = false, empty = true;
+        const char *key;
+        uint32_t value;
+        uid_t uid;
+        size_t i;
+        int r;
+
+        for (i = 0; i < _USER_SLOT_N; ++i)
+                maxima[i] = registry->maxima[i];
+
+        c_dvar_read(in_v, "(u[", &uid);
+
+        while (c_dvar_more(in_v)) {
+                c_dvar_read(in_v, "{su}", &key, &value);
+                empty = false;
+
+                for (i = 0; i < _USER_SLOT_N; ++i) {
+                        if (!strcmp(key, keys[i])) {
+                                maxima[i] = value;
+                                break;
+                        }
+                }
+
+                if (i >= _USER_SLOT_N)
+                        invalid = true;
+        }
+
+        c_dvar_read(in_v, "])");
+
+        r = controller_end_read(in_v);
+        if (r)
+                return error_trace(r);
+
+        if (invalid)
+                return CONTROLLER_E_USER_LIMITS_INVALID;
+
+        r = user_registry_set_maxima(registry, uid, empty ? NULL : maxima);
+        if (r)
+                return error_fold(r);
+
+        c_dvar_write(out_v, "()");
+
+        return 0;
+}
+
+static void controller_write_histogram(CDVar *var, const char *key, const uint64_t *histogram) {
+        c_dvar_write(var, "{s<", key, controller_type_at);
+        c_dvar_write(var, "[");
+        for (size_t i = 0; i < DISPATCH_HISTOGRAM_N; ++i)
+                c_dvar_write(var, "t", histogram[i]);
+        c_dvar_write(var, "]");
+        c_dvar_write(var, ">}");
+}
+
+static int controller_method_get_stats(Controller *controller, const char *_path, CDVar *in_v, FDList *fds, CDVar *out_v) {
+        DispatchStats *stats = &controller->broker->dispatcher.stats;
+        DispatchStall *stall;
+        int r;
+
+        c_dvar_read(in_v, "()");
+
+        r = controller_end_read(in_v);
+        if (r)
+                return error_trace(r);
+
+        c_dvar_write(out_v, "([{s<t>}{s<t>}",
+                     "DispatchRounds", c_dvar_type_t, stats->n_rounds,
+                     "DispatchRoundMaxNSec", c_dvar_type_t, stats->round_max);
+        controller_write_histogram(out_v, "DispatchRoundHistogram", stats->round_histogram);
+
+        c_dvar_write(out_v, "{s<t>}{s<t>}",
+                     "DispatchCallbacks", c_dvar_type_t, stats->n_callbacks,
+                     "DispatchCallbackMaxNSec", c_dvar_type_t, stats->callback_max);
+        controller_write_histogram(out_v, "DispatchCallbackHistogram", stats->callback_histogram);
+
+        c_dvar_write(out_v, "{s<t>}{s<t>}",
+                     "StallThresholdNSec", c_dvar_type_t, stats->threshold,
+                     "Stalls", c_dvar_type_t, stats->n_stalls);
+
+        c_dvar_write(out_v, "{s<", "RecentStalls", controller_type_stalls);
+        c_dvar_write(out_v, "[");
+        for (size_t i = 0; (stall = dispatch_stats_get_stall(stats, i)); ++i)
+                c_dvar_write(out_v, "(ttstu)",
+                             stall->timestamp,
+                             stall->duration,
+                             stall->name ?: "unknown",
+                             stall->id,
+                             stall->events);
+        c_dvar_write(out_v, "]");
+        c_dvar_write(out_v, ">}");
+
+        c_dvar_write(out_v, "])");
+
+        return 0;
+}
+
+static int controller_method_drain(Controller *controller, const char *_path, CDVar *in_v, FDList *fds, CDVar *out_v) {
+        int r;
+
+        c_dvar_read(in_v, "()");
+
+        r = controller_end_read(in_v);
+        if (r)
+                return error_trace(r);
+
+        r = broker_drain(controller->broker);
+        if (r)
+                return error_fold(r);
+
+        c_dvar_write(out_v, "()");
+
+        return 0;
+}
+
 static int controller_method_listener_release(Controller *controller, const char *path, CDVar *in_v, FDList *fds, CDVar *out_v) {
         ControllerListener *listener;
         int r;
@@ -317,7 +563,33 @@ static int controller_method_name_reset(Controller *controller, const char *path
         if (!name)
                 return CONTROLLER_E_NAME_NOT_FOUND;
 
-        controller_name_reset(name);
+        r = controller_name_reset(name);
+        if (r)
+                return error_trace(r);
+
+        c_dvar_write(out_v, "()");
+
+        return 0;
+}
+
+static int controller_method_name_fail_activation(Controller *controller, const char *path, CDVar *in_v, FDList *fds, CDVar *out_v) {
+        ControllerName *name;
+        const char *result;
+        int r;
+
+        c_dvar_read(in_v, "(s)", &result);
+
+        r = controller_end_read(in_v);
+        if (r)
+                return error_trace(r);
+
+        name = controller_find_name(controller, path);
+        if (!name)
+                return CONTROLLER_E_NAME_NOT_FOUND;
+
+        r = controller_name_fail_activation(name, result);
+        if (r)
+                return error_trace(r);
 
         c_dvar_write(out_v, "()");
 
@@ -391,8 +663,12 @@ static int controller_handle_method(const ControllerMethod *method, Controller *
 
 static int controller_dispatch_controller(Controller *controller, uint32_t serial, const char *method, const char *path, const char *signature, Message *message) {
         static const ControllerMethod methods[] = {
-                { "AddName",            controller_method_add_name,     controller_type_in_osu,         controller_type_out_unit },
-                { "AddListener",        controller_method_add_listener, controller_type_in_ohsv,        controller_type_out_unit },
+                { "AddName",            controller_method_add_name,             controller_type_in_osuasu,      controller_type_out_unit },
+                { "AddListener",        controller_method_add_listener,         controller_type_in_ohsv,        controller_type_out_unit },
+                { "Drain",              controller_method_drain,                c_dvar_type_unit,               controller_type_out_unit },
+                { "DumpRecorder",       controller_method_dump_recorder,        controller_type_in_h,           controller_type_out_unit },
+                { "GetStats",           controller_method_get_stats,            c_dvar_type_unit,               controller_type_out_apsv },
+                { "SetUserLimits",      controller_method_set_user_limits,      controller_type_in_uasu,        controller_type_out_unit },
         };
 
         for (size_t i = 0; i < C_ARRAY_SIZE(methods); i++) {
@@ -409,6 +685,7 @@ static int controller_dispatch_name(Controller *controller, uint32_t serial, con
         static const ControllerMethod methods[] = {
                 { "Reset",      controller_method_name_reset,   c_dvar_type_unit,       controller_type_out_unit },
                 { "Release",    controller_method_name_release, c_dvar_type_unit,       controller_type_out_unit },
+                { "FailActivation",     controller_method_name_fail_activation, controller_type_in_s,   controller_type_out_unit },
         };
 
         for (size_t i = 0; i < C_ARRAY_SIZE(methods); i++) {
@@ -465,7 +742,7 @@ int controller_dbus_dispatch(Controller *controller, Message *message) {
         if (message->header->type != DBUS_MESSAGE_TYPE_METHOD_CALL)
                 return CONTROLLER_E_PROTOCOL_VIOLATION;
 
-        r = message_parse_metadata(message);
+        r = message_parse_metadata(message, NULL);
         if (r > 0)
                 return CONTROLLER_E_PROTOCOL_VIOLATION;
         else if (r < 0)
@@ -512,6 +789,18 @@ int controller_dbus_dispatch(Controller *controller, Message *message) {
         case CONTROLLER_E_NAME_INVALID:
                 r = controller_send_error(connection, message_read_serial(message), "org.bus1.DBus.Name.Invalid");
                 break;
+        case CONTROLLER_E_NAME_LIMITS_INVALID:
+                r = controller_send_error(connection, message_read_serial(message), "org.bus1.DBus.Name.InvalidLimits");
+                break;
+        case CONTROLLER_E_RECORDER_INVALID_FD:
+                r = controller_send_error(connection, message_read_serial(message), "org.bus1.DBus.Broker.InvalidFD");
+                break;
+        case CONTROLLER_E_RECORDER_FAILED:
+                r = controller_send_error(connection, message_read_serial(message), "org.bus1.DBus.Broker.RecorderFailed");
+                break;
+        case CONTROLLER_E_USER_LIMITS_INVALID:
+                r = controller_send_error(connection, message_read_serial(message), "org.bus1.DBus.Broker.InvalidLimits");
+                break;
         case CONTROLLER_E_LISTENER_NOT_FOUND:
                 r = controller_send_error(connection, message_read_serial(message), "org.bus1.DBus.Listener.NotFound");
                 break;
@@ -615,3 +904,48 @@ int controller_dbus_send_environment(Controller *controller, const char * const
 
         return 0;
 }
+
+/**
+ * controller_dbus_send_activation_failure() - XXX
+ */
+int controller_dbus_send_activation_failure(Controller *controller, const char *unit, const char *error_name, const char *error_message) {
+        static const CDVarType type[] = {
+                C_DVAR_T_INIT(
+                        CONTROLLER_T_MESSAGE(
+                                C_DVAR_T_TUPLE3(
+                                        C_DVAR_T_s,
+                                        C_DVAR_T_s,
+                                        C_DVAR_T_s
+                                )
+                        )
+                )
+        };
+        _c_cleanup_(c_dvar_deinit) CDVar var = C_DVAR_INIT;
+        _c_cleanup_(message_unrefp) Message *message = NULL;
+        size_t n_data;
+        void *data;
+        int r;
+
+        c_dvar_begin_write(&var, type, 1);
+        c_dvar_write(&var, "((yyyyuu[(y<o>)(y<s>)(y<s>)(y<g>)])(sss))",
+                     c_dvar_is_big_endian(&var) ? 'B' : 'l', DBUS_MESSAGE_TYPE_SIGNAL, DBUS_HEADER_FLAG_NO_REPLY_EXPECTED, 1, 0, (uint32_t)-1,
+                     DBUS_MESSAGE_FIELD_PATH, c_dvar_type_o, "/org/bus1/DBus/Broker",
+                     DBUS_MESSAGE_FIELD_INTERFACE, c_dvar_type_s, "org.bus1.DBus.Broker",
+                     DBUS_MESSAGE_FIELD_MEMBER, c_dvar_type_s, "ActivationFailure",
+                     DBUS_MESSAGE_FIELD_SIGNATURE, c_dvar_type_g, "sss",
+                     unit, error_name, error_message);
+
+        r = c_dvar_end_write(&var, &data, &n_data);
+        if (r)
+                return error_origin(r);
+
+        r = message_new_outgoing(&message, data, n_data);
+        if (r)
+                return error_fold(r);
+
+        r = connection_queue(&controller->connection, NULL, message);
+        if (r)
+                return error_fold(r);
+
+        return 0;
+}
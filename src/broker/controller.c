@@ -9,13 +9,16 @@
 #include "broker/controller.h"
 #include "bus/activation.h"
 #include "bus/bus.h"
+#include "bus/driver.h"
 #include "bus/policy.h"
 #include "dbus/connection.h"
 #include "dbus/message.h"
+#include "util/dispatch.h"
 #include "util/error.h"
 #include "util/proc.h"
 #include "util/selinux.h"
 #include "util/sockopt.h"
+#include "util/timer.h"
 
 static int controller_name_compare(CRBTree *t, void *k, CRBNode *rb) {
         ControllerName *name = c_container_of(rb, ControllerName, controller_node);
@@ -64,15 +67,78 @@ static int controller_name_new(ControllerName **namep, Controller *controller, c
 /**
  * controller_name_reset() - XXX
  */
-void controller_name_reset(ControllerName *name) {
-        activation_flush(&name->activation);
+int controller_name_reset(ControllerName *name) {
+        int r;
+
+        r = driver_name_activation_failed(&name->controller->broker->bus,
+                                          &name->activation,
+                                          DRIVER_E_NAME_ACTIVATION_FAILED);
+        if (r)
+                return error_fold(r);
+
+        return 0;
+}
+
+/**
+ * controller_name_fail_activation() - fail pending activation
+ * @name:               name to operate on
+ * @result:             result of the activation job, as reported by systemd
+ *
+ * This is called by the controller if it knows the activation of @name
+ * failed, for instance because the service could not be started. Any queued
+ * caller is answered right away, rather than when the activation times out.
+ * A job result of "timeout" is reported as such, anything else as failure.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int controller_name_fail_activation(ControllerName *name, const char *result) {
+        int r;
+
+        r = driver_name_activation_failed(&name->controller->broker->bus,
+                                          &name->activation,
+                                          strcmp(result, "timeout") ?
+                                                DRIVER_E_NAME_ACTIVATION_FAILED :
+                                                DRIVER_E_NAME_ACTIVATION_TIMEOUT);
+        if (r)
+                return error_fold(r);
+
+        return 0;
+}
+
+static int controller_name_timeout(Timeout *timeout) {
+        ControllerName *name = c_container_of(timeout, ControllerName, activation.timeout);
+        int r;
+
+        r = driver_name_activation_failed(&name->controller->broker->bus,
+                                          &name->activation,
+                                          DRIVER_E_NAME_ACTIVATION_TIMEOUT);
+        if (r)
+                return error_fold(r);
+
+        return 0;
 }
 
 /**
  * controller_name_activate() - XXX
  */
 int controller_name_activate(ControllerName *name) {
-        return controller_dbus_send_activation(name->controller, name->path);
+        Broker *broker = name->controller->broker;
+        int r;
+
+        r = timeout_schedule(&name->activation.timeout,
+                             &broker->timer,
+                             controller_name_timeout,
+                             timer_now() + broker->activation_timeout);
+        if (r)
+                return error_fold(r);
+
+        r = controller_dbus_send_activation(name->controller, name->path);
+        if (r) {
+                timeout_cancel(&name->activation.timeout);
+                return error_trace(r);
+        }
+
+        return 0;
 }
 
 static int controller_listener_compare(CRBTree *t, void *k, CRBNode *rb) {
@@ -185,6 +251,8 @@ int controller_init(Controller *c, Broker *broker, int controller_fd) {
         if (r)
                 return error_fold(r);
 
+        dispatch_file_set_name(&controller->connection.socket_file, "controller", 0);
+
         controller = NULL;
         return 0;
 }
@@ -213,7 +281,8 @@ int controller_add_name(Controller *controller,
                         ControllerName **namep,
                         const char *path,
                         const char *name_str,
-                        uid_t uid) {
+                        uid_t uid,
+                        const ActivationLimits *limits) {
         _c_cleanup_(controller_name_freep) ControllerName *name = NULL;
         _c_cleanup_(name_unrefp) Name *name_entry = NULL;
         _c_cleanup_(user_unrefp) User *user_entry = NULL;
@@ -231,7 +300,7 @@ int controller_add_name(Controller *controller,
         if (r)
                 return error_trace(r);
 
-        r = activation_init(&name->activation, name_entry, user_entry);
+        r = activation_init(&name->activation, name_entry, user_entry, limits);
         if (r)
                 return (r == ACTIVATION_E_ALREADY_ACTIVATABLE) ? CONTROLLER_E_NAME_IS_ACTIVATABLE : error_fold(r);
 
@@ -289,3 +358,32 @@ ControllerListener *controller_find_listener(Controller *controller, const char
                               ControllerListener,
                               controller_node);
 }
+
+/**
+ * controller_drain() - stop taking on new work
+ * @controller:         controller to operate on
+ *
+ * This stops all listeners of @controller from accepting new connections, and
+ * fails all pending activations. Since no new connection can be accepted, the
+ * activated services could never claim their names anyway.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int controller_drain(Controller *controller) {
+        ControllerListener *listener;
+        ControllerName *name;
+        int r;
+
+        c_rbtree_for_each_entry(listener, &controller->listener_tree, controller_node)
+                listener_stop(&listener->listener);
+
+        c_rbtree_for_each_entry(name, &controller->name_tree, controller_node) {
+                r = driver_name_activation_failed(&controller->broker->bus,
+                                                  &name->activation,
+                                                  DRIVER_E_BUS_DRAINING);
+                if (r)
+                        return error_fold(r);
+        }
+
+        return 0;
+}
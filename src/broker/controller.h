@@ -42,6 +42,10 @@ enum {
         CONTROLLER_E_NAME_EXISTS,
         CONTROLLER_E_NAME_IS_ACTIVATABLE,
         CONTROLLER_E_NAME_INVALID,
+        CONTROLLER_E_NAME_LIMITS_INVALID,
+        CONTROLLER_E_RECORDER_INVALID_FD,
+        CONTROLLER_E_RECORDER_FAILED,
+        CONTROLLER_E_USER_LIMITS_INVALID,
 
         CONTROLLER_E_LISTENER_NOT_FOUND,
         CONTROLLER_E_NAME_NOT_FOUND,
@@ -78,8 +82,9 @@ struct Controller {
 /* names */
 
 ControllerName *controller_name_free(ControllerName *name);
-void controller_name_reset(ControllerName *name);
+int controller_name_reset(ControllerName *name);
 int controller_name_activate(ControllerName *name);
+int controller_name_fail_activation(ControllerName *name, const char *result);
 
 C_DEFINE_CLEANUP(ControllerName *, controller_name_free);
 
@@ -98,7 +103,8 @@ int controller_add_name(Controller *controller,
                         ControllerName **namep,
                         const char *path,
                         const char *name_str,
-                        uid_t uid);
+                        uid_t uid,
+                        const ActivationLimits *limits);
 int controller_add_listener(Controller *controller,
                             ControllerListener **listenerp,
                             const char *path,
@@ -106,10 +112,12 @@ int controller_add_listener(Controller *controller,
                             PolicyRegistry *policy);
 ControllerName *controller_find_name(Controller *controller, const char *path);
 ControllerListener *controller_find_listener(Controller *controller, const char *path);
+int controller_drain(Controller *controller);
 
 int controller_dbus_dispatch(Controller *controller, Message *message);
 int controller_dbus_send_activation(Controller *controller, const char *path);
 int controller_dbus_send_environment(Controller *controller, const char * const *env, size_t n_env);
+int controller_dbus_send_activation_failure(Controller *controller, const char *unit, const char *error_name, const char *error_message);
 
 C_DEFINE_CLEANUP(Controller *, controller_deinit);
 
@@ -0,0 +1,136 @@
+/*
+ * Flight Recorder Decoder
+ *
+ * This reads a flight recorder dump, as written by the broker on SIGUSR1 or
+ * via the DumpRecorder() controller method, and prints one line per event.
+ * Timestamps are printed relative to the time the dump was taken.
+ */
+
+#include <c-macro.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbus/protocol.h"
+#include "util/recorder.h"
+
+static const char *decode_event_type(unsigned int type) {
+        static const char *names[] = {
+                [RECORDER_EVENT_INVALID]        = "invalid",
+                [RECORDER_EVENT_CONNECT]        = "connect",
+                [RECORDER_EVENT_GOODBYE]        = "goodbye",
+                [RECORDER_EVENT_DISPATCH]       = "dispatch",
+                [RECORDER_EVENT_BROADCAST]      = "broadcast",
+                [RECORDER_EVENT_QUOTA]          = "quota",
+                [RECORDER_EVENT_DENIED]         = "denied",
+                [RECORDER_EVENT_LOOP]           = "loop",
+                [RECORDER_EVENT_STALL]          = "stall",
+        };
+
+        return (type < C_ARRAY_SIZE(names)) ? names[type] : "unknown";
+}
+
+static const char *decode_message_type(unsigned int type) {
+        switch (type) {
+        case DBUS_MESSAGE_TYPE_METHOD_CALL:
+                return "method_call";
+        case DBUS_MESSAGE_TYPE_METHOD_RETURN:
+                return "method_return";
+        case DBUS_MESSAGE_TYPE_ERROR:
+                return "error";
+        case DBUS_MESSAGE_TYPE_SIGNAL:
+                return "signal";
+        default:
+                return "invalid";
+        }
+}
+
+static void decode_event(const RecorderFileHeader *header, const RecorderEvent *event) {
+        int64_t delta = (int64_t)(event->timestamp - header->timestamp);
+
+        printf("[%+14.6f] %-9s ", delta / 1000000000.0, decode_event_type(event->type));
+
+        switch (event->type) {
+        case RECORDER_EVENT_CONNECT:
+                printf("peer=%" PRIu64 " pid=%" PRIu64 "\n", event->id, event->value);
+                break;
+        case RECORDER_EVENT_GOODBYE:
+                printf("peer=%" PRIu64 " silent=%" PRIu64 "\n", event->id, event->value);
+                break;
+        case RECORDER_EVENT_DISPATCH:
+                printf("sender=%" PRIu64 " type=%s serial=%" PRIu32 " size=%" PRIu64 "\n",
+                       event->id, decode_message_type(event->message_type), event->serial, event->value);
+                break;
+        case RECORDER_EVENT_BROADCAST:
+                printf("sender=%" PRIu64 " type=%s serial=%" PRIu32 " receivers=%" PRIu64 "\n",
+                       event->id, decode_message_type(event->message_type), event->serial, event->value);
+                break;
+        case RECORDER_EVENT_QUOTA:
+        case RECORDER_EVENT_DENIED:
+                printf("sender=%" PRIu64 " type=%s serial=%" PRIu32 " receiver=%" PRIu64 "\n",
+                       event->id, decode_message_type(event->message_type), event->serial, event->value);
+                break;
+        case RECORDER_EVENT_LOOP:
+                printf("files=%" PRIu32 " duration=%" PRIu64 "ns\n", event->serial, event->value);
+                break;
+        case RECORDER_EVENT_STALL:
+                printf("id=%" PRIu64 " events=0x%" PRIx32 " duration=%" PRIu64 "ns\n", event->id, event->serial, event->value);
+                break;
+        default:
+                printf("id=%" PRIu64 " serial=%" PRIu32 " value=%" PRIu64 "\n", event->id, event->serial, event->value);
+                break;
+        }
+}
+
+static int decode(FILE *f, const char *path) {
+        RecorderFileHeader header;
+        RecorderEvent event;
+
+        if (fread(&header, sizeof(header), 1, f) != 1 ||
+            memcmp(header.magic, RECORDER_FILE_MAGIC, sizeof(header.magic)) != 0) {
+                fprintf(stderr, "%s: not a flight recorder file -- '%s'\n", program_invocation_name, path);
+                return 1;
+        }
+
+        if (header.version != RECORDER_FILE_VERSION) {
+                fprintf(stderr, "%s: unsupported flight recorder version %" PRIu32 " -- '%s'\n", program_invocation_name, header.version, path);
+                return 1;
+        }
+
+        printf("%" PRIu32 " of %" PRIu64 " events recorded\n", header.n_events, header.n_total);
+
+        for (uint32_t i = 0; i < header.n_events; ++i) {
+                if (fread(&event, sizeof(event), 1, f) != 1) {
+                        fprintf(stderr, "%s: truncated flight recorder file -- '%s'\n", program_invocation_name, path);
+                        return 1;
+                }
+
+                decode_event(&header, &event);
+        }
+
+        return 0;
+}
+
+int main(int argc, char **argv) {
+        FILE *f;
+        int r;
+
+        if (argc > 2) {
+                fprintf(stderr, "%s [FILE]\n", program_invocation_short_name);
+                return 1;
+        }
+
+        if (argc < 2 || strcmp(argv[1], "-") == 0)
+                return decode(stdin, "-");
+
+        f = fopen(argv[1], "re");
+        if (!f) {
+                fprintf(stderr, "%s: cannot open '%s': %m\n", program_invocation_name, argv[1]);
+                return 1;
+        }
+
+        r = decode(f, argv[1]);
+        fclose(f);
+        return r;
+}
@@ -10,7 +10,9 @@
 #include <sys/types.h>
 #include "broker/broker.h"
 #include "broker/main.h"
+#include "util/dispatch.h"
 #include "util/error.h"
+#include "util/fdlist.h"
 #include "util/selinux.h"
 
 int main_arg_controller = 3;
@@ -19,6 +21,11 @@ uint64_t main_arg_max_fds = 64;
 uint64_t main_arg_max_matches = 10 * 1024;
 uint64_t main_arg_max_objects = 10 * 1024;
 bool main_arg_verbose = false;
+const char *main_arg_flight_recorder = NULL;
+uint64_t main_arg_stall_threshold = DISPATCH_STALL_THRESHOLD_DEFAULT / 1000;
+uint64_t main_arg_activation_timeout = 25 * 1000 * 1000;
+uint64_t main_arg_drain_timeout = 5 * 1000 * 1000;
+uint64_t main_arg_reply_reserve = 8 * 1024;
 
 static void help(void) {
         printf("%s [GLOBALS...] ...\n\n"
@@ -29,8 +36,13 @@ static void help(void) {
                "     --controller FD            Change controller file-descriptor\n"
                "     --max-bytes BYTES          The maximum number of bytes each user may own in the broker\n"
                "     --max-fds FDS              The maximum number of file descriptors each user may own in the broker\n"
-               "     --max-matches MATCHES      The maximum number of match rules each user may own in the broker\n"
+               "     --max-matches MATCHES      The maximum cost of match rules, in match cost units, each user may own in the broker\n"
                "     --max-objects OBJECTS      The maximum total number of names, peers, pending replies, etc each user may own in the broker\n"
+               "     --flight-recorder PATH     Dump recent broker events to PATH on SIGUSR1\n"
+               "     --stall-threshold USEC     Record dispatch callbacks running longer than USEC micro seconds\n"
+               "     --activation-timeout USEC  Fail activation requests if the name is not claimed within USEC micro seconds\n"
+               "     --drain-timeout USEC       Deliver queued messages for up to USEC micro seconds on SIGTERM, before exiting\n"
+               "     --reply-reserve BYTES      The number of bytes reserved in the caller's quota for each pending reply\n"
                , program_invocation_short_name);
 }
 
@@ -42,6 +54,11 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_MAX_FDS,
                 ARG_MAX_MATCHES,
                 ARG_MAX_OBJECTS,
+                ARG_FLIGHT_RECORDER,
+                ARG_STALL_THRESHOLD,
+                ARG_ACTIVATION_TIMEOUT,
+                ARG_DRAIN_TIMEOUT,
+                ARG_REPLY_RESERVE,
         };
         static const struct option options[] = {
                 { "help",               no_argument,            NULL,   'h'                     },
@@ -52,6 +69,11 @@ static int parse_argv(int argc, char *argv[]) {
                 { "max-fds",            required_argument,      NULL,   ARG_MAX_FDS             },
                 { "max-matches",        required_argument,      NULL,   ARG_MAX_MATCHES         },
                 { "max-objects",        required_argument,      NULL,   ARG_MAX_OBJECTS         },
+                { "flight-recorder",    required_argument,      NULL,   ARG_FLIGHT_RECORDER     },
+                { "stall-threshold",    required_argument,      NULL,   ARG_STALL_THRESHOLD     },
+                { "activation-timeout", required_argument,      NULL,   ARG_ACTIVATION_TIMEOUT  },
+                { "drain-timeout",      required_argument,      NULL,   ARG_DRAIN_TIMEOUT       },
+                { "reply-reserve",      required_argument,      NULL,   ARG_REPLY_RESERVE       },
                 {}
         };
         int r, c;
@@ -145,6 +167,70 @@ static int parse_argv(int argc, char *argv[]) {
                         break;
                 }
 
+                case ARG_FLIGHT_RECORDER:
+                        main_arg_flight_recorder = optarg;
+                        break;
+
+                case ARG_STALL_THRESHOLD: {
+                        unsigned long long vul;
+                        char *end;
+
+                        errno = 0;
+                        vul = strtoull(optarg, &end, 10);
+                        if (errno != 0 || *end || optarg == end || !vul || vul > UINT64_MAX / 1000) {
+                                fprintf(stderr, "%s: invalid stall threshold -- '%s'\n", program_invocation_name, optarg);
+                                return MAIN_FAILED;
+                        }
+
+                        main_arg_stall_threshold = vul;
+                        break;
+                }
+
+                case ARG_ACTIVATION_TIMEOUT: {
+                        unsigned long long vul;
+                        char *end;
+
+                        errno = 0;
+                        vul = strtoull(optarg, &end, 10);
+                        if (errno != 0 || *end || optarg == end || !vul || vul > UINT64_MAX / 1000) {
+                                fprintf(stderr, "%s: invalid activation timeout -- '%s'\n", program_invocation_name, optarg);
+                                return MAIN_FAILED;
+                        }
+
+                        main_arg_activation_timeout = vul;
+                        break;
+                }
+
+                case ARG_DRAIN_TIMEOUT: {
+                        unsigned long long vul;
+                        char *end;
+
+                        errno = 0;
+                        vul = strtoull(optarg, &end, 10);
+                        if (errno != 0 || *end || optarg == end || vul > UINT64_MAX / 1000) {
+                                fprintf(stderr, "%s: invalid drain timeout -- '%s'\n", program_invocation_name, optarg);
+                                return MAIN_FAILED;
+                        }
+
+                        main_arg_drain_timeout = vul;
+                        break;
+                }
+
+                case ARG_REPLY_RESERVE: {
+                        unsigned long long vul;
+                        char *end;
+
+                        errno = 0;
+                        vul = strtoull(optarg, &end, 10);
+                        if (errno != 0 || *end || optarg == end || vul > UINT_MAX) {
+                                fprintf(stderr, "%s: invalid reply reserve -- '%s'\n", program_invocation_name, optarg);
+                                return MAIN_FAILED;
+                        }
+
+                        main_arg_reply_reserve = vul;
+                        break;
+                }
+
                 case '?':
                         /* getopt_long() prints warning */
                         return MAIN_FAILED;
@@ -214,6 +300,7 @@ int main(int argc, char **argv) {
                 goto exit;
 
         r = run();
+        fdlist_flush();
 
 exit:
         r = error_trace(r);
@@ -15,3 +15,8 @@ enum {
 
 extern int main_arg_controller;
 extern bool main_arg_verbose;
+extern const char *main_arg_flight_recorder;
+extern uint64_t main_arg_stall_threshold;
+extern uint64_t main_arg_activation_timeout;
+extern uint64_t main_arg_drain_timeout;
+extern uint64_t main_arg_reply_reserve;
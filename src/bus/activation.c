@@ -12,6 +12,7 @@
 #include "dbus/message.h"
 #include "util/error.h"
 #include "util/fdlist.h"
+#include "util/timer.h"
 #include "util/user.h"
 
 ActivationRequest *activation_request_free(ActivationRequest *request) {
@@ -31,6 +32,12 @@ ActivationMessage *activation_message_free(ActivationMessage *message) {
         if (!message)
                 return NULL;
 
+        if (message->activation) {
+                message->activation->usage.n_bytes -= message->n_bytes;
+                message->activation->usage.n_fds -= message->n_fds;
+                --message->activation->usage.n_messages;
+        }
+
         name_snapshot_free(message->senders_names);
         policy_snapshot_free(message->senders_policy);
         message_unref(message->message);
@@ -46,9 +53,22 @@ ActivationMessage *activation_message_free(ActivationMessage *message) {
 C_DEFINE_CLEANUP(ActivationMessage *, activation_message_free);
 
 /**
- * activation_init() - XXX
+ * activation_init() - initialize activation context
+ * @a:                  activation context to initialize
+ * @name:               name to make activatable
+ * @user:               user to charge queued messages to
+ * @limits:             limits on queued messages, or NULL
+ *
+ * This makes @name activatable. Messages and requests sent to @name while it
+ * has no owner are queued on the activation context, until it is claimed. The
+ * queued messages are charged to @user on behalf of their senders, and their
+ * total is additionally capped by @limits, regardless of the sender. If
+ * @limits is NULL, no such cap applies.
+ *
+ * Return: 0 on success, ACTIVATION_E_ALREADY_ACTIVATABLE if @name already is
+ *         activatable.
  */
-int activation_init(Activation *a, Name *name, User *user) {
+int activation_init(Activation *a, Name *name, User *user, const ActivationLimits *limits) {
         _c_cleanup_(activation_deinitp) Activation *activation = a;
 
         if (name->activation)
@@ -57,6 +77,8 @@ int activation_init(Activation *a, Name *name, User *user) {
         *activation = (Activation)ACTIVATION_NULL(*activation);
         activation->name = name_ref(name);
         activation->user = user_ref(user);
+        if (limits)
+                activation->limits = *limits;
 
         name->activation = activation;
         activation = NULL;
@@ -71,6 +93,7 @@ void activation_deinit(Activation *activation) {
 
         assert(c_list_is_empty(&activation->activation_messages));
         assert(c_list_is_empty(&activation->activation_requests));
+        assert(!activation->usage.n_messages);
 
         activation->user = user_unref(activation->user);
 
@@ -98,7 +121,8 @@ int activation_flush(Activation *activation) {
         ActivationRequest *request;
         ActivationMessage *message;
 
-        /* XXX: send out error replies */
+        timeout_cancel(&activation->timeout);
+        activation->requested = false;
 
         while ((message = c_list_first_entry(&activation->activation_messages, ActivationMessage, link)))
                 activation_message_free(message);
@@ -115,8 +139,23 @@ int activation_queue_message(Activation *activation,
                              PolicySnapshot *policy,
                              Message *m) {
         _c_cleanup_(activation_message_freep) ActivationMessage *message = NULL;
+        ActivationLimits *limits = &activation->limits, *usage = &activation->usage;
+        unsigned int n_bytes, n_fds;
         int r;
 
+        n_bytes = sizeof(ActivationMessage) + sizeof(Message) + m->n_data;
+        n_fds = fdlist_count(m->fds);
+
+        /*
+         * Apply the limits of the name before anything else. They bound the
+         * queue as a whole, so a service that is slow to start cannot pile up
+         * messages from many senders, each within its own quota.
+         */
+        if (usage->n_messages >= limits->n_messages ||
+            n_bytes > limits->n_bytes - usage->n_bytes ||
+            n_fds > limits->n_fds - usage->n_fds)
+                return ACTIVATION_E_QUOTA;
+
         r = activation_request(activation);
         if (r)
                 return error_trace(r);
@@ -131,10 +170,15 @@ int activation_queue_message(Activation *activation,
         message->link = (CList)C_LIST_INIT(message->link);
         message->message = message_ref(m);
 
-        r = user_charge(activation->user, &message->charges[0], user, USER_SLOT_BYTES,
-                        sizeof(ActivationMessage) + sizeof(Message) + m->n_data);
-        r = r ?: user_charge(activation->user, &message->charges[1], user, USER_SLOT_FDS,
-                             fdlist_count(m->fds));
+        message->activation = activation;
+        message->n_bytes = n_bytes;
+        message->n_fds = n_fds;
+        usage->n_bytes += n_bytes;
+        usage->n_fds += n_fds;
+        ++usage->n_messages;
+
+        r = user_charge(activation->user, &message->charges[0], user, USER_SLOT_BYTES, n_bytes);
+        r = r ?: user_charge(activation->user, &message->charges[1], user, USER_SLOT_FDS, n_fds);
         if (r)
                 return (r == USER_E_QUOTA) ? ACTIVATION_E_QUOTA : error_fold(r);
 
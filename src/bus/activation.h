@@ -6,11 +6,14 @@
 
 #include <c-list.h>
 #include <c-macro.h>
+#include <limits.h>
 #include <stdlib.h>
 #include "bus/policy.h"
+#include "util/timer.h"
 #include "util/user.h"
 
 typedef struct Activation Activation;
+typedef struct ActivationLimits ActivationLimits;
 typedef struct ActivationMessage ActivationMessage;
 typedef struct ActivationRequest ActivationRequest;
 typedef struct Message Message;
@@ -26,6 +29,18 @@ enum {
         ACTIVATION_E_ALREADY_ACTIVATABLE,
 };
 
+struct ActivationLimits {
+        unsigned int n_bytes;
+        unsigned int n_fds;
+        unsigned int n_messages;
+};
+
+#define ACTIVATION_LIMITS_UNLIMITED {                                           \
+                .n_bytes = UINT_MAX,                                            \
+                .n_fds = UINT_MAX,                                              \
+                .n_messages = UINT_MAX,                                         \
+        }
+
 struct ActivationRequest {
         UserCharge charge;
         uint64_t sender_id;
@@ -34,8 +49,11 @@ struct ActivationRequest {
 };
 
 struct ActivationMessage {
+        Activation *activation;
         User *user;
         UserCharge charges[2];
+        unsigned int n_bytes;
+        unsigned int n_fds;
         CList link;
         Message *message;
         PolicySnapshot *senders_policy;
@@ -47,12 +65,17 @@ struct Activation {
         User *user;
         CList activation_messages;
         CList activation_requests;
+        ActivationLimits limits;
+        ActivationLimits usage;
+        Timeout timeout;
         bool requested : 1;
 };
 
 #define ACTIVATION_NULL(_x) {                                                   \
                 .activation_messages = C_LIST_INIT((_x).activation_messages),   \
                 .activation_requests = C_LIST_INIT((_x).activation_requests),   \
+                .limits = ACTIVATION_LIMITS_UNLIMITED,                          \
+                .timeout = TIMEOUT_NULL((_x).timeout),                          \
         }
 
 /* requests */
@@ -65,7 +88,7 @@ ActivationMessage *activation_message_free(ActivationMessage *message);
 
 /* activation */
 
-int activation_init(Activation *activation, Name *name, User *user);
+int activation_init(Activation *activation, Name *name, User *user, const ActivationLimits *limits);
 void activation_deinit(Activation *activation);
 
 int activation_queue_message(Activation *activation,
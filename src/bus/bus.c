@@ -42,12 +42,14 @@ int bus_init(Bus *bus,
 void bus_deinit(Bus *bus) {
         bus->pid = 0;
         bus->user = user_unref(bus->user);
+        recorder_deinit(&bus->recorder);
         metrics_deinit(&bus->metrics);
         peer_registry_deinit(&bus->peers);
         user_registry_deinit(&bus->users);
         name_registry_deinit(&bus->names);
         match_registry_deinit(&bus->driver_matches);
         match_registry_deinit(&bus->wildcard_matches);
+        match_cache_deinit(&bus->match_cache);
 }
 
 Peer *bus_find_peer_by_name(Bus *bus, Name **namep, const char *name_str) {
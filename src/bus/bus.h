@@ -12,6 +12,7 @@
 #include "bus/name.h"
 #include "bus/peer.h"
 #include "util/metrics.h"
+#include "util/recorder.h"
 #include "util/user.h"
 
 enum {
@@ -31,23 +32,29 @@ struct Bus {
 
         UserRegistry users;
         NameRegistry names;
+        MatchCache match_cache;
         MatchRegistry wildcard_matches;
         MatchRegistry driver_matches;
         PeerRegistry peers;
 
         uint64_t transaction_ids;
         uint64_t listener_ids;
+        unsigned int reply_reserve;
+        bool draining;
 
         Metrics metrics;
+        Recorder recorder;
 };
 
 #define BUS_NULL(_x) {                                                          \
                 .users = USER_REGISTRY_NULL,                                    \
                 .names = NAME_REGISTRY_INIT,                                    \
+                .match_cache = MATCH_CACHE_INIT,                                \
                 .wildcard_matches = MATCH_REGISTRY_INIT((_x).wildcard_matches), \
                 .driver_matches = MATCH_REGISTRY_INIT((_x).driver_matches),     \
                 .peers = PEER_REGISTRY_INIT,                                    \
                 .metrics = METRICS_INIT,                                        \
+                .recorder = RECORDER_INIT,                                      \
         }
 
 int bus_init(Bus *bus,
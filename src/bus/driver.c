@@ -8,6 +8,7 @@
 #include <c-string.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
+#include <unistd.h>
 #include "broker/broker.h"
 #include "bus/activation.h"
 #include "bus/bus.h"
@@ -19,7 +20,10 @@
 #include "dbus/protocol.h"
 #include "dbus/socket.h"
 #include "util/error.h"
+#include "util/fdlist.h"
+#include "util/recorder.h"
 #include "util/selinux.h"
+#include "util/timer.h"
 
 typedef struct DriverMethod DriverMethod;
 typedef int (*DriverMethodFn) (Peer *peer, CDVar *var_in, uint32_t serial, CDVar *var_out);
@@ -74,6 +78,15 @@ static const CDVarType driver_type_in_su[] = {
                 )
         )
 };
+static const CDVarType driver_type_in_sss[] = {
+        C_DVAR_T_INIT(
+                C_DVAR_T_TUPLE3(
+                        C_DVAR_T_s,
+                        C_DVAR_T_s,
+                        C_DVAR_T_s
+                )
+        )
+};
 static const CDVarType driver_type_in_apss[] = {
         C_DVAR_T_INIT(
                 C_DVAR_T_TUPLE1(
@@ -130,6 +143,15 @@ static const CDVarType driver_type_out_u[] = {
                 )
         )
 };
+static const CDVarType driver_type_out_h[] = {
+        C_DVAR_T_INIT(
+                DRIVER_T_MESSAGE(
+                        C_DVAR_T_TUPLE1(
+                                C_DVAR_T_h
+                        )
+                )
+        )
+};
 static const CDVarType driver_type_out_as[] = {
         C_DVAR_T_INIT(
                 DRIVER_T_MESSAGE(
@@ -222,7 +244,22 @@ static int driver_dvar_verify_signature_in(const CDVarType *type, const char *si
         return 0;
 }
 
+static uint32_t driver_type_count_fds(const CDVarType *type) {
+        uint32_t n_fds = 0;
+
+        /* file-descriptors are only supported as plain members of the body */
+        for (unsigned int i = 0; i < type->length; ++i) {
+                assert(type[i].element != 'a' || type[i + 1].element != 'h');
+                if (type[i].element == 'h')
+                        ++n_fds;
+        }
+
+        return n_fds;
+}
+
 static void driver_write_reply_header(CDVar *var, Peer *peer, uint32_t serial, const CDVarType *type) {
+        uint32_t n_fds;
+
         c_dvar_write(var, "(yyyyuu[(y<u>)(y<s>)(y<",
                      c_dvar_is_big_endian(var) ? 'B' : 'l', DBUS_MESSAGE_TYPE_METHOD_RETURN, DBUS_HEADER_FLAG_NO_REPLY_EXPECTED, 1, 0, (uint32_t)-1,
                      DBUS_MESSAGE_FIELD_REPLY_SERIAL, c_dvar_type_u, serial,
@@ -232,7 +269,13 @@ static void driver_write_reply_header(CDVar *var, Peer *peer, uint32_t serial, c
         c_dvar_write(var, ">)(y<",
                      DBUS_MESSAGE_FIELD_SIGNATURE, c_dvar_type_g);
         driver_dvar_write_signature_out(var, type);
-        c_dvar_write(var, ">)])");
+        c_dvar_write(var, ">)");
+
+        n_fds = driver_type_count_fds(type);
+        if (n_fds)
+                c_dvar_write(var, "(y<u>)", DBUS_MESSAGE_FIELD_UNIX_FDS, c_dvar_type_u, n_fds);
+
+        c_dvar_write(var, "])");
 }
 
 static void driver_write_signal_header(CDVar *var, Peer *peer, const char *member, const char *signature) {
@@ -266,6 +309,7 @@ static const char *driver_error_to_string(int r) {
                 [DRIVER_E_UNEXPECTED_SIGNATURE]                 = "Invalid signature for method",
                 [DRIVER_E_UNEXPECTED_REPLY]                     = "No pending reply with that serial",
                 [DRIVER_E_QUOTA]                                = "Sending user's quota exceeded",
+                [DRIVER_E_BUS_DRAINING]                         = "The bus is shutting down",
                 [DRIVER_E_UNEXPECTED_FLAGS]                     = "Invalid flags",
                 [DRIVER_E_UNEXPECTED_ENVIRONMENT_UPDATE]        = "User is not authorized to update environment variables",
                 [DRIVER_E_SEND_DENIED]                          = "Sender is not authorized to send message",
@@ -277,6 +321,8 @@ static const char *driver_error_to_string(int r) {
                 [DRIVER_E_NAME_REFUSED]                         = "Request to own name refused by policy",
                 [DRIVER_E_NAME_NOT_FOUND]                       = "The name does not exist",
                 [DRIVER_E_NAME_NOT_ACTIVATABLE]                 = "The name is not activatable",
+                [DRIVER_E_NAME_ACTIVATION_FAILED]               = "Activation of the name failed",
+                [DRIVER_E_NAME_ACTIVATION_TIMEOUT]              = "Activation of the name timed out",
                 [DRIVER_E_NAME_OWNER_NOT_FOUND]                 = "The name does not have an owner",
                 [DRIVER_E_PEER_NOT_FOUND]                       = "The connection does not exist",
                 [DRIVER_E_DESTINATION_NOT_FOUND]                = "Destination does not exist",
@@ -347,7 +393,7 @@ static int driver_send_error(Peer *receiver, uint32_t serial, const char *error,
         return 0;
 }
 
-static int driver_send_reply(Peer *peer, CDVar *var, uint32_t serial) {
+static int driver_send_reply_with_fds(Peer *peer, CDVar *var, uint32_t serial, FDList **fdsp) {
         _c_cleanup_(message_unrefp) Message *message = NULL;
         void *data;
         size_t n_data;
@@ -374,6 +420,11 @@ static int driver_send_reply(Peer *peer, CDVar *var, uint32_t serial) {
         if (r)
                 return error_fold(r);
 
+        if (fdsp) {
+                message->fds = *fdsp;
+                *fdsp = NULL;
+        }
+
         r = driver_send_unicast(peer, message);
         if (r)
                 return error_trace(r);
@@ -381,6 +432,10 @@ static int driver_send_reply(Peer *peer, CDVar *var, uint32_t serial) {
         return 0;
 }
 
+static int driver_send_reply(Peer *peer, CDVar *var, uint32_t serial) {
+        return error_trace(driver_send_reply_with_fds(peer, var, serial, NULL));
+}
+
 static int driver_notify_name_acquired(Peer *peer, const char *name) {
         static const CDVarType type[] = {
                 C_DVAR_T_INIT(
@@ -417,6 +472,66 @@ static int driver_notify_name_acquired(Peer *peer, const char *name) {
         return 0;
 }
 
+static int driver_notify_peer_connected(Peer *peer, Peer *sender, FDList **fdsp) {
+        static const CDVarType type[] = {
+                C_DVAR_T_INIT(
+                        DRIVER_T_MESSAGE(
+                                C_DVAR_T_TUPLE2(
+                                        C_DVAR_T_s,
+                                        C_DVAR_T_h
+                                )
+                        )
+                )
+        };
+        _c_cleanup_(c_dvar_deinit) CDVar var = C_DVAR_INIT;
+        _c_cleanup_(message_unrefp) Message *message = NULL;
+        void *data;
+        size_t n_data;
+        int r;
+
+        c_dvar_begin_write(&var, type, 1);
+        c_dvar_write(&var, "((yyyyuu[(y<s>)(y<",
+                     c_dvar_is_big_endian(&var) ? 'B' : 'l', DBUS_MESSAGE_TYPE_SIGNAL, DBUS_HEADER_FLAG_NO_REPLY_EXPECTED, 1, 0, (uint32_t)-1,
+                     DBUS_MESSAGE_FIELD_SENDER, c_dvar_type_s, "org.freedesktop.DBus",
+                     DBUS_MESSAGE_FIELD_DESTINATION, c_dvar_type_s);
+        driver_dvar_write_unique_name(&var, peer);
+        c_dvar_write(&var, ">)(y<o>)(y<s>)(y<s>)(y<g>)(y<u>)])",
+                     DBUS_MESSAGE_FIELD_PATH, c_dvar_type_o, "/org/freedesktop/DBus",
+                     DBUS_MESSAGE_FIELD_INTERFACE, c_dvar_type_s, "org.bus1.DBus.Direct",
+                     DBUS_MESSAGE_FIELD_MEMBER, c_dvar_type_s, "PeerConnected",
+                     DBUS_MESSAGE_FIELD_SIGNATURE, c_dvar_type_g, "sh",
+                     DBUS_MESSAGE_FIELD_UNIX_FDS, c_dvar_type_u, 1);
+        c_dvar_write(&var, "(");
+        driver_dvar_write_unique_name(&var, sender);
+        c_dvar_write(&var, "h))", 0);
+
+        r = c_dvar_end_write(&var, &data, &n_data);
+        if (r)
+                return error_origin(r);
+
+        r = message_new_outgoing(&message, data, n_data);
+        if (r)
+                return error_fold(r);
+
+        message->fds = *fdsp;
+        *fdsp = NULL;
+
+        /*
+         * The socket is charged on @peer on behalf of @sender, just like any
+         * unicast @sender queues. The charge is released as soon as @peer
+         * dequeued the message, so it cannot pile up.
+         */
+        r = connection_queue(&peer->connection, sender->user, message);
+        if (r) {
+                if (r == CONNECTION_E_QUOTA)
+                        return DRIVER_E_QUOTA;
+
+                return error_fold(r);
+        }
+
+        return 0;
+}
+
 static int driver_notify_name_lost(Peer *peer, const char *name) {
         static const CDVarType type[] = {
                 C_DVAR_T_INIT(
@@ -544,6 +659,7 @@ static int driver_name_activated(Activation *activation, Peer *receiver) {
 
         /* in case the name is dropped again in the future, we should request it again */
         activation->requested = false;
+        timeout_cancel(&activation->timeout);
 
         c_list_for_each_entry_safe(request, request_safe, &activation->activation_requests, link) {
                 Peer *sender;
@@ -611,6 +727,69 @@ static int driver_name_activated(Activation *activation, Peer *receiver) {
         return 0;
 }
 
+/**
+ * driver_name_activation_failed() - fail a pending activation
+ * @bus:                bus the activation belongs to
+ * @activation:         activation to fail
+ * @error:              DRIVER_E_NAME_ACTIVATION_* code describing the failure, or
+ *                      DRIVER_E_BUS_DRAINING if the bus is shutting down
+ *
+ * This answers all StartServiceByName() requests and method calls queued on
+ * @activation with an error, and releases them together with the quota they
+ * were charged. The activation will be requested again by the next caller.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int driver_name_activation_failed(Bus *bus, Activation *activation, int error) {
+        ActivationRequest *request, *request_safe;
+        ActivationMessage *message, *message_safe;
+        const char *error_name;
+        Peer *sender;
+        int r;
+
+        switch (error) {
+        case DRIVER_E_NAME_ACTIVATION_TIMEOUT:
+                error_name = "org.freedesktop.DBus.Error.TimedOut";
+                break;
+        case DRIVER_E_NAME_ACTIVATION_FAILED:
+                error_name = "org.freedesktop.DBus.Error.ServiceUnknown";
+                break;
+        case DRIVER_E_BUS_DRAINING:
+                error_name = "org.freedesktop.DBus.Error.NoServer";
+                break;
+        default:
+                return error_origin(-EINVAL);
+        }
+
+        activation->requested = false;
+        timeout_cancel(&activation->timeout);
+
+        c_list_for_each_entry_safe(request, request_safe, &activation->activation_requests, link) {
+                sender = peer_registry_find_peer(&bus->peers, request->sender_id);
+                if (sender) {
+                        r = driver_send_error(sender, request->serial, error_name, driver_error_to_string(error));
+                        if (r)
+                                return error_trace(r);
+                }
+
+                activation_request_free(request);
+        }
+
+        c_list_for_each_entry_safe(message, message_safe, &activation->activation_messages, link) {
+                sender = peer_registry_find_peer(&bus->peers, message->message->sender_id);
+                if (sender) {
+                        r = driver_send_error(sender, message_read_serial(message->message),
+                                              error_name, driver_error_to_string(error));
+                        if (r)
+                                return error_trace(r);
+                }
+
+                activation_message_free(message);
+        }
+
+        return 0;
+}
+
 static int driver_end_read(CDVar *var) {
         int r;
 
@@ -799,6 +978,38 @@ static int driver_method_list_queued_owners(Peer *peer, CDVar *in_v, uint32_t se
         return 0;
 }
 
+static int driver_method_get_queue_length(Peer *peer, CDVar *in_v, uint32_t serial, CDVar *out_v) {
+        const char *name_str;
+        Peer *owner;
+        Name *name;
+        uint32_t length;
+        int r;
+
+        c_dvar_read(in_v, "(s)", &name_str);
+
+        r = driver_end_read(in_v);
+        if (r)
+                return error_trace(r);
+
+        if (!strcmp(name_str, "org.freedesktop.DBus")) {
+                length = 1;
+        } else {
+                owner = bus_find_peer_by_name(peer->bus, &name, name_str);
+                if (!owner)
+                        return DRIVER_E_NAME_NOT_FOUND;
+
+                length = name ? name->n_ownerships : 1;
+        }
+
+        c_dvar_write(out_v, "(u)", length);
+
+        r = driver_send_reply(peer, out_v, serial);
+        if (r)
+                return error_trace(r);
+
+        return 0;
+}
+
 static int driver_method_list_names(Peer *peer, CDVar *in_v, uint32_t serial, CDVar *out_v) {
         Peer *p;
         Name *name;
@@ -914,7 +1125,7 @@ static int driver_method_start_service_by_name(Peer *peer, CDVar *in_v, uint32_t
         } else {
                 r = activation_queue_request(name->activation, peer->user, peer->id, serial);
                 if (r)
-                        return error_fold(r);
+                        return (r == ACTIVATION_E_QUOTA) ? DRIVER_E_QUOTA : error_fold(r);
         }
 
         return 0;
@@ -1028,6 +1239,60 @@ static int driver_method_get_connection_unix_user(Peer *peer, CDVar *in_v, uint3
         return 0;
 }
 
+static int driver_method_connect_peer(Peer *peer, CDVar *in_v, uint32_t serial, CDVar *out_v) {
+        _c_cleanup_(fdlist_freep) FDList *sender_fds = NULL, *receiver_fds = NULL;
+        Peer *receiver;
+        const char *name;
+        int r, pair[2];
+
+        c_dvar_read(in_v, "(s)", &name);
+
+        r = driver_end_read(in_v);
+        if (r)
+                return error_trace(r);
+
+        receiver = bus_find_peer_by_name(peer->bus, NULL, name);
+        if (!receiver || receiver == peer || !peer_is_registered(receiver) || peer_is_monitor(receiver))
+                return DRIVER_E_PEER_NOT_FOUND;
+
+        r = peer_connect_peer(peer, receiver, pair);
+        if (r) {
+                if (r == PEER_E_SEND_DENIED)
+                        return DRIVER_E_SEND_DENIED;
+                else if (r == PEER_E_RECEIVE_DENIED)
+                        return DRIVER_E_RECEIVE_DENIED;
+                else if (r == PEER_E_QUOTA)
+                        return DRIVER_E_QUOTA;
+                else
+                        return error_fold(r);
+        }
+
+        r = fdlist_new_consume_fds(&sender_fds, &pair[0], 1);
+        if (r) {
+                close(pair[1]);
+                close(pair[0]);
+                return error_fold(r);
+        }
+
+        r = fdlist_new_consume_fds(&receiver_fds, &pair[1], 1);
+        if (r) {
+                close(pair[1]);
+                return error_fold(r);
+        }
+
+        r = driver_notify_peer_connected(receiver, peer, &receiver_fds);
+        if (r)
+                return error_trace(r);
+
+        c_dvar_write(out_v, "(h)", 0);
+
+        r = driver_send_reply_with_fds(peer, out_v, serial, &sender_fds);
+        if (r)
+                return error_trace(r);
+
+        return 0;
+}
+
 static int driver_method_get_connection_unix_process_id(Peer *peer, CDVar *in_v, uint32_t serial, CDVar *out_v) {
         Peer *connection;
         const char *name;
@@ -1342,6 +1607,22 @@ static int driver_method_introspect(Peer *peer, CDVar *in_v, uint32_t serial, CD
                 "      <arg direction=\"in\" type=\"u\"/>\n"
                 "    </method>\n"
                 "  </interface>\n"
+                "  <interface name=\"org.bus1.DBus.Direct\">\n"
+                "    <method name=\"ConnectPeer\">\n"
+                "      <arg direction=\"in\" type=\"s\"/>\n"
+                "      <arg direction=\"out\" type=\"h\"/>\n"
+                "    </method>\n"
+                "    <signal name=\"PeerConnected\">\n"
+                "      <arg type=\"s\"/>\n"
+                "      <arg type=\"h\"/>\n"
+                "    </signal>\n"
+                "  </interface>\n"
+                "  <interface name=\"org.bus1.DBus.NameQueue\">\n"
+                "    <method name=\"GetQueueLength\">\n"
+                "      <arg direction=\"in\" type=\"s\"/>\n"
+                "      <arg direction=\"out\" type=\"u\"/>\n"
+                "    </method>\n"
+                "  </interface>\n"
                 "</node>\n";
         int r;
 
@@ -1384,7 +1665,7 @@ static int driver_method_become_monitor(Peer *peer, CDVar *in_v, uint32_t serial
                 else
                         match_string = "";
 
-                r = match_owner_ref_rule(&owned_matches, NULL, peer->user, match_string);
+                r = match_owner_ref_rule(&owned_matches, NULL, &peer->bus->match_cache, peer->user, match_string);
                 if (r) {
                         r = (r == MATCH_E_INVALID) ? DRIVER_E_MATCH_INVALID : error_fold(r);
                         goto error;
@@ -1496,6 +1777,8 @@ static int driver_dispatch_method(Peer *peer, uint32_t serial, const char *metho
                 { "GetId",                                      NULL,                           driver_method_get_id,                                           c_dvar_type_unit,       driver_type_out_s },
                 { "Introspect",                                 NULL,                           driver_method_introspect,                                       c_dvar_type_unit,       driver_type_out_s },
                 { "BecomeMonitor",                              "/org/freedesktop/DBus",        driver_method_become_monitor,                                   driver_type_in_asu,     driver_type_out_unit },
+                { "ConnectPeer",                                NULL,                           driver_method_connect_peer,                                     driver_type_in_s,       driver_type_out_h },
+                { "GetQueueLength",                             NULL,                           driver_method_get_queue_length,                                 driver_type_in_s,       driver_type_out_u },
         };
 
         if (_c_unlikely_(!peer_is_registered(peer)) && strcmp(method, "Hello") != 0)
@@ -1511,11 +1794,49 @@ static int driver_dispatch_method(Peer *peer, uint32_t serial, const char *metho
         return DRIVER_E_UNEXPECTED_METHOD;
 }
 
+static int driver_handle_activation_failure(Peer *peer, const char *signature, Message *message) {
+        _c_cleanup_(c_dvar_deinit) CDVar var = C_DVAR_INIT;
+        const char *unit, *error_name, *error_message;
+        int r;
+
+        /*
+         * systemd answers activation requests it cannot enqueue with an
+         * ActivationFailure signal, addressed to the driver. Only systemd may
+         * report those, and malformed ones are ignored like any other signal
+         * sent to the driver. The broker does not know which unit belongs to
+         * which name, so the controller is left to fail the activation.
+         */
+        if (bus_find_peer_by_name(peer->bus, NULL, "org.freedesktop.systemd1") != peer)
+                return 0;
+
+        if (driver_dvar_verify_signature_in(driver_type_in_sss, signature))
+                return 0;
+
+        c_dvar_begin_read(&var, message->big_endian, driver_type_in_sss, 1, message->body, message->n_body);
+        c_dvar_read(&var, "(sss)", &unit, &error_name, &error_message);
+
+        r = driver_end_read(&var);
+        if (r)
+                return (r == DRIVER_E_INVALID_MESSAGE) ? 0 : error_trace(r);
+
+        r = broker_report_activation_failure(BROKER(peer->bus), unit, error_name, error_message);
+        if (r)
+                return error_fold(r);
+
+        return 0;
+}
+
 static int driver_dispatch_interface(Peer *peer, uint32_t serial, const char *interface, const char *member, const char *path, const char *signature, Message *message) {
         int r;
-        if (message->header->type != DBUS_MESSAGE_TYPE_METHOD_CALL)
+        if (message->header->type != DBUS_MESSAGE_TYPE_METHOD_CALL) {
+                if (message->header->type == DBUS_MESSAGE_TYPE_SIGNAL &&
+                    c_string_equal(interface, "org.freedesktop.systemd1.Activator") &&
+                    c_string_equal(member, "ActivationFailure"))
+                        return error_trace(driver_handle_activation_failure(peer, signature, message));
+
                 /* ignore */
                 return 0;
+        }
 
         r = policy_snapshot_check_send(peer->policy, NULL, NULL, interface, member, path, message->header->type);
         if (r) {
@@ -1532,6 +1853,12 @@ static int driver_dispatch_interface(Peer *peer, uint32_t serial, const char *in
                 } else if (_c_unlikely_(strcmp(member, "BecomeMonitor") == 0)) {
                         if (strcmp(interface, "org.freedesktop.DBus.Monitoring") != 0)
                                 return DRIVER_E_UNEXPECTED_INTERFACE;
+                } else if (_c_unlikely_(strcmp(member, "ConnectPeer") == 0)) {
+                        if (strcmp(interface, "org.bus1.DBus.Direct") != 0)
+                                return DRIVER_E_UNEXPECTED_INTERFACE;
+                } else if (_c_unlikely_(strcmp(member, "GetQueueLength") == 0)) {
+                        if (strcmp(interface, "org.bus1.DBus.NameQueue") != 0)
+                                return DRIVER_E_UNEXPECTED_INTERFACE;
                 } else {
                         if (_c_unlikely_(strcmp(interface, "org.freedesktop.DBus") != 0))
                                 return DRIVER_E_UNEXPECTED_INTERFACE;
@@ -1547,6 +1874,8 @@ int driver_goodbye(Peer *peer, bool silent) {
         NameOwnership *ownership, *ownership_safe;
         int r;
 
+        recorder_record(&peer->bus->recorder, RECORDER_EVENT_GOODBYE, peer->id, 0, 0, silent);
+
         peer_flush_matches(peer);
 
         c_list_for_each_entry_safe(reply, reply_safe, &peer->owned_replies.reply_list, owner_link)
@@ -1583,14 +1912,16 @@ int driver_goodbye(Peer *peer, bool silent) {
 
         c_rbtree_for_each_entry_unlink(reply, reply_safe, &peer->replies_outgoing.reply_tree, registry_node) {
                 Peer *sender = c_container_of(reply->owner, Peer, owned_replies);
+                uint32_t serial = reply->serial;
+
+                /* release the reserved reply quota before sending the error */
+                reply_slot_free(reply);
 
                 if (!silent) {
-                        r = driver_send_error(sender, reply->serial, "org.freedesktop.DBus.Error.NoReply", "Remote peer disconnected");
+                        r = driver_send_error(sender, serial, "org.freedesktop.DBus.Error.NoReply", "Remote peer disconnected");
                         if (r)
                                 return error_trace(r);
                 }
-
-                reply_slot_free(reply);
         }
 
         return 0;
@@ -1609,7 +1940,7 @@ static int driver_forward_unicast(Peer *sender, const char *destination, Message
 
                 r = activation_queue_message(name->activation, sender->user, &sender->owned_names, sender->policy, message);
                 if (r)
-                        return error_fold(r);
+                        return (r == ACTIVATION_E_QUOTA) ? DRIVER_E_QUOTA : error_fold(r);
 
                 return 0;
         }
@@ -1701,9 +2032,27 @@ static int driver_monitor(Peer *sender, Message *message) {
 static int driver_dispatch_internal(Peer *peer, Message *message) {
         int r;
 
-        r = driver_monitor(peer, message);
-        if (r)
-                return error_trace(r);
+        /*
+         * Without any monitor on the bus, there is nothing to match against,
+         * so skip preparing the match filter altogether. This is the common
+         * case, and matters most for replies, which are otherwise queued
+         * straight on the pending reply slot.
+         */
+        if (peer->bus->peers.n_monitors) {
+                r = driver_monitor(peer, message);
+                if (r)
+                        return error_trace(r);
+        }
+
+        /*
+         * While the bus is draining, refuse anything that would start new
+         * work. Calls are answered right away, so callers can retry on the
+         * next instance of the bus, rather than wait for a reply that might
+         * never come. Signals and replies are still delivered.
+         */
+        if (_c_unlikely_(peer->bus->draining) &&
+            message->metadata.header.type == DBUS_MESSAGE_TYPE_METHOD_CALL)
+                return DRIVER_E_BUS_DRAINING;
 
         if (_c_unlikely_(c_string_equal(message->metadata.fields.destination, "org.freedesktop.DBus"))) {
                 return error_trace(driver_dispatch_interface(peer,
@@ -1759,13 +2108,13 @@ int driver_dispatch(Peer *peer, Message *message) {
         if (peer_is_monitor(peer))
                 return DRIVER_E_PROTOCOL_VIOLATION;
 
-        r = message_parse_metadata(message);
+        r = message_parse_metadata(message, &peer->message_cache);
         if (r > 0)
                 return DRIVER_E_PROTOCOL_VIOLATION;
         else if (r < 0)
                 return error_fold(r);
 
-        message_stitch_sender(message, peer->id);
+        message_stitch_sender_prepared(message, &peer->message_sender);
 
         r = driver_dispatch_internal(peer, message);
         switch (r) {
@@ -1806,6 +2155,9 @@ int driver_dispatch(Peer *peer, Message *message) {
         case DRIVER_E_QUOTA:
                 r = driver_send_error(peer, message_read_serial(message), "org.freedesktop.DBus.Error.LimitsExceeded", driver_error_to_string(r));
                 break;
+        case DRIVER_E_BUS_DRAINING:
+                r = driver_send_error(peer, message_read_serial(message), "org.freedesktop.DBus.Error.NoServer", driver_error_to_string(r));
+                break;
         case DRIVER_E_PEER_NOT_FOUND:
         case DRIVER_E_NAME_NOT_FOUND:
         case DRIVER_E_NAME_OWNER_NOT_FOUND:
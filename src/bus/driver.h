@@ -6,6 +6,7 @@
 
 #include <stdlib.h>
 
+typedef struct Activation Activation;
 typedef struct Bus Bus;
 typedef struct MatchOwner MatchOwner;
 typedef struct Message Message;
@@ -32,6 +33,7 @@ enum {
         DRIVER_E_UNEXPECTED_REPLY,
 
         DRIVER_E_QUOTA,
+        DRIVER_E_BUS_DRAINING,
 
         DRIVER_E_UNEXPECTED_FLAGS,
         DRIVER_E_UNEXPECTED_ENVIRONMENT_UPDATE,
@@ -46,6 +48,8 @@ enum {
         DRIVER_E_NAME_REFUSED,
         DRIVER_E_NAME_NOT_FOUND,
         DRIVER_E_NAME_NOT_ACTIVATABLE,
+        DRIVER_E_NAME_ACTIVATION_FAILED,
+        DRIVER_E_NAME_ACTIVATION_TIMEOUT,
         DRIVER_E_NAME_OWNER_NOT_FOUND,
         DRIVER_E_PEER_NOT_FOUND,
         DRIVER_E_DESTINATION_NOT_FOUND,
@@ -62,3 +66,4 @@ enum {
 int driver_dispatch(Peer *peer, Message *message);
 void driver_matches_cleanup(MatchOwner *owner, Bus *bus, User *user);
 int driver_goodbye(Peer *peer, bool silent);
+int driver_name_activation_failed(Bus *bus, Activation *activation, int error);
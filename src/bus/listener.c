@@ -99,7 +99,9 @@ int listener_init_with_fd(Listener *l,
         if (r)
                 return error_fold(r);
 
-        dispatch_file_select(&listener->socket_file, EPOLLIN);
+        dispatch_file_set_name(&listener->socket_file, "listener", bus->listener_ids);
+        if (!bus->draining)
+                dispatch_file_select(&listener->socket_file, EPOLLIN);
 
         listener->socket_fd = socket_fd;
         listener->policy = policy;
@@ -118,3 +120,15 @@ void listener_deinit(Listener *listener) {
         listener->socket_fd = c_close(listener->socket_fd);
         listener->bus = NULL;
 }
+
+/**
+ * listener_stop() - stop accepting connections
+ * @listener:           listener to operate on
+ *
+ * This stops dispatching the listener socket. Connection attempts are left in
+ * its backlog, so they are picked up by whoever owns the socket next, rather
+ * than being refused.
+ */
+void listener_stop(Listener *listener) {
+        dispatch_file_deselect(&listener->socket_file, EPOLLIN);
+}
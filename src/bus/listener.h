@@ -36,5 +36,6 @@ int listener_init_with_fd(Listener *listener,
                           PolicyRegistry *policy);
 Listener *listener_free(Listener *free);
 void listener_deinit(Listener *listener);
+void listener_stop(Listener *listener);
 
 C_DEFINE_CLEANUP(Listener *, listener_deinit);
@@ -18,6 +18,29 @@ static bool match_key_equal(const char *key1, const char *key2, size_t n_key2) {
         return !strncmp(key1, key2, n_key2);
 }
 
+static int match_keys_add_arg(MatchKeys *keys, unsigned int index, bool path, const char *value) {
+        size_t i;
+
+        /*
+         * The argN and argNpath keys are kept in a sorted array, which only
+         * contains the keys that were actually specified. The array is sized
+         * by the caller, based on match_count_args(), so it cannot overflow.
+         * Any index can be given at most once, regardless of its kind.
+         */
+
+        for (i = 0; i < keys->n_args && keys->args[i].index < index; ++i)
+                ;
+
+        if (i < keys->n_args && keys->args[i].index == index)
+                return MATCH_E_INVALID;
+
+        memmove(keys->args + i + 1, keys->args + i, (keys->n_args - i) * sizeof(*keys->args));
+        keys->args[i] = (MatchArg){ .index = index, .path = path, .value = value };
+        ++keys->n_args;
+
+        return 0;
+}
+
 static int match_keys_assign(MatchKeys *keys, const char *key, size_t n_key, const char *value) {
         Address addr;
 
@@ -39,6 +62,14 @@ static int match_keys_assign(MatchKeys *keys, const char *key, size_t n_key, con
                 if (keys->sender)
                         return MATCH_E_INVALID;
                 keys->sender = value;
+
+                /*
+                 * Unique names are resolved right away, so rules on peers
+                 * that do not exist, yet, can be matched on their ID.
+                 */
+                address_from_string(&addr, value);
+                if (addr.type == ADDRESS_TYPE_ID)
+                        keys->filter.sender = addr.id;
         } else if (match_key_equal("destination", key, n_key)) {
                 if (keys->destination)
                         return MATCH_E_INVALID;
@@ -66,11 +97,19 @@ static int match_keys_assign(MatchKeys *keys, const char *key, size_t n_key, con
                         return MATCH_E_INVALID;
                 keys->path_namespace = value;
         } else if (match_key_equal("arg0namespace", key, n_key)) {
-                if (keys->arg0namespace || keys->filter.args[0] || keys->filter.argpaths[0])
+                if (keys->arg0namespace || (keys->n_args && keys->args[0].index == 0))
                         return MATCH_E_INVALID;
                 keys->arg0namespace = value;
+        } else if (match_key_equal("coalesce", key, n_key)) {
+                if (strcmp(value, "true") == 0)
+                        keys->coalesce = true;
+                else if (strcmp(value, "false") == 0)
+                        keys->coalesce = false;
+                else
+                        return MATCH_E_INVALID;
         } else if (n_key >= strlen("arg") && match_key_equal("arg", key, strlen("arg"))) {
                 unsigned int i = 0;
+                bool path;
 
                 key += strlen("arg");
                 n_key -= strlen("arg");
@@ -84,18 +123,17 @@ static int match_keys_assign(MatchKeys *keys, const char *key, size_t n_key, con
 
                 if (i == 0 && keys->arg0namespace)
                         return MATCH_E_INVALID;
-                if (i > 63)
+                if (i >= MATCH_ARGS_MAX)
                         return MATCH_E_INVALID;
 
-                if (keys->filter.args[i] || keys->filter.argpaths[i])
+                if (match_key_equal("", key, n_key))
+                        path = false;
+                else if (match_key_equal("path", key, n_key))
+                        path = true;
+                else
                         return MATCH_E_INVALID;
 
-                if (match_key_equal("", key, n_key)) {
-                        keys->filter.args[i] = value;
-                } else if (match_key_equal("path", key, n_key)) {
-                        keys->filter.argpaths[i] = value;
-                } else
-                        return MATCH_E_INVALID;
+                return match_keys_add_arg(keys, i, path, value);
         } else {
                 return MATCH_E_INVALID;
         }
@@ -176,7 +214,7 @@ static int match_parse_key(const char **match, const char **keyp, size_t *n_keyp
         return 0;
 }
 
-static int match_keys_parse(MatchKeys *keys, const char *string) {
+static int match_keys_parse(MatchKeys *keys, char *buffer, const char *string) {
         const char *key, *value;
         size_t n_key;
         char *p;
@@ -190,7 +228,7 @@ static int match_keys_parse(MatchKeys *keys, const char *string) {
          * Note that we rely on @string to be zero-terminated!
          */
 
-        p = keys->buffer;
+        p = buffer;
 
         for (;;) {
                 r = match_parse_key(&string, &key, &n_key);
@@ -210,53 +248,77 @@ static int match_keys_parse(MatchKeys *keys, const char *string) {
         return (r == MATCH_E_EOF) ? 0 : error_trace(r);
 }
 
-static void match_keys_deinit(MatchKeys *keys) {
-        *keys = (MatchKeys)MATCH_KEYS_NULL;
-}
-
-C_DEFINE_CLEANUP(MatchKeys *, match_keys_deinit);
+static size_t match_count_args(const char *string) {
+        size_t n_args = 0;
 
-static int match_keys_init(MatchKeys *k, const char *string, size_t n_string) {
-        _c_cleanup_(match_keys_deinitp) MatchKeys *keys = k;
-        int r;
+        /*
+         * Keys are never quoted, so every argN or argNpath key contains the
+         * literal "arg". Counting its occurrences yields an upper bound for
+         * the number of arguments in @string, without parsing it twice. Since
+         * each index can be given at most once, this is also capped at
+         * MATCH_ARGS_MAX.
+         */
+        while ((string = strstr(string, "arg"))) {
+                string += strlen("arg");
+                ++n_args;
+        }
 
-        assert(n_string > 0);
-        assert(n_string - 1 <= MATCH_RULE_LENGTH_MAX);
+        return c_min(n_args, MATCH_ARGS_MAX);
+}
 
-        *keys = (MatchKeys)MATCH_KEYS_NULL;
+static uint64_t match_string_hash(const char *string) {
+        uint64_t hash = 0xcbf29ce484222325ULL;
 
-        r = match_keys_parse(keys, string);
-        if (r)
-                return error_trace(r);
+        /* FNV-1a, only used to speed up comparisons in the cache */
+        for ( ; *string; ++string) {
+                hash ^= (uint8_t)*string;
+                hash *= 0x100000001b3ULL;
+        }
 
-        keys = NULL;
-        return 0;
+        return hash;
 }
 
-static MatchKeys *match_keys_free(MatchKeys *keys) {
-        if (keys) {
-                match_keys_deinit(keys);
-                free(keys);
-        }
-        return NULL;
-}
+/**
+ * match_keys_free() - XXX
+ */
+void match_keys_free(Ref *n_refs, void *userdata) {
+        MatchKeys *keys = c_container_of(n_refs, MatchKeys, n_refs);
+
+        if (keys->cache)
+                c_rbtree_remove_init(&keys->cache->keys_tree, &keys->cache_node);
 
-C_DEFINE_CLEANUP(MatchKeys *, match_keys_free);
+        free(keys);
+}
 
 static int match_keys_new(MatchKeys **keysp, const char *string) {
-        _c_cleanup_(match_keys_freep) MatchKeys *keys = NULL;
-        size_t n_string;
+        _c_cleanup_(match_keys_unrefp) MatchKeys *keys = NULL;
+        size_t n_string, n_args_max, n_allocation;
+        char *buffer;
         int r;
 
         n_string = strlen(string) + 1;
         if (n_string - 1 > MATCH_RULE_LENGTH_MAX)
                 return MATCH_E_INVALID;
 
-        keys = calloc(1, sizeof(*keys) + n_string);
+        /*
+         * The keys are allocated in one chunk: the object itself, followed by
+         * the sparse argument array, a copy of the raw rule string (used as
+         * cache key), and the buffer holding the parsed, unquoted values.
+         */
+        n_args_max = match_count_args(string);
+        n_allocation = sizeof(*keys) + n_args_max * sizeof(MatchArg) + 2 * n_string;
+
+        keys = calloc(1, n_allocation);
         if (!keys)
                 return error_origin(-ENOMEM);
 
-        r = match_keys_init(keys, string, n_string);
+        *keys = (MatchKeys)MATCH_KEYS_NULL(*keys);
+        keys->n_allocation = n_allocation;
+
+        buffer = (char *)(keys->args + n_args_max);
+        keys->string = memcpy(buffer, string, n_string);
+
+        r = match_keys_parse(keys, buffer + n_string, string);
         if (r)
                 return error_trace(r);
 
@@ -315,13 +377,15 @@ static bool match_keys_match_filter(MatchKeys *keys, MatchFilter *filter) {
         if (keys->arg0namespace && !match_string_prefix(keys->arg0namespace, filter->args[0], '.', false))
                 return false;
 
-        for (unsigned int i = 0; i < C_ARRAY_SIZE(filter->args); i ++) {
-                if (keys->filter.args[i] && !c_string_equal(keys->filter.args[i], filter->args[i]))
-                        return false;
+        for (size_t i = 0; i < keys->n_args; ++i) {
+                MatchArg *arg = &keys->args[i];
 
-                if (keys->filter.argpaths[i]) {
-                        if (!match_string_prefix(filter->argpaths[i], keys->filter.argpaths[i], '/', true) &&
-                            !match_string_prefix(keys->filter.argpaths[i], filter->argpaths[i], '/', true))
+                if (arg->path) {
+                        if (!match_string_prefix(filter->argpaths[arg->index], arg->value, '/', true) &&
+                            !match_string_prefix(arg->value, filter->argpaths[arg->index], '/', true))
+                                return false;
+                } else {
+                        if (!c_string_equal(arg->value, filter->args[arg->index]))
                                 return false;
                 }
         }
@@ -331,9 +395,12 @@ static bool match_keys_match_filter(MatchKeys *keys, MatchFilter *filter) {
 
 static int match_rule_compare(CRBTree *tree, void *k, CRBNode *rb) {
         MatchRule *rule = c_container_of(rb, MatchRule, owner_node);
-        MatchKeys *key1 = k, *key2 = &rule->keys;
+        MatchKeys *key1 = k, *key2 = rule->keys;
         int r;
 
+        if (key1 == key2)
+                return 0;
+
         if ((r = c_string_compare(key1->sender, key2->sender)) ||
             (r = c_string_compare(key1->destination, key2->destination)) ||
             (r = c_string_compare(key1->filter.interface, key2->filter.interface)) ||
@@ -348,9 +415,26 @@ static int match_rule_compare(CRBTree *tree, void *k, CRBNode *rb) {
         if (key1->filter.type < key2->filter.type)
                 return -1;
 
-        for (size_t i = 0; i < C_ARRAY_SIZE(key1->filter.args); i ++) {
-                if ((r = c_string_compare(key1->filter.args[i], key2->filter.args[i])) ||
-                    (r = c_string_compare(key1->filter.argpaths[i], key2->filter.argpaths[i])))
+        if (key1->coalesce > key2->coalesce)
+                return 1;
+        if (key1->coalesce < key2->coalesce)
+                return -1;
+
+        if (key1->n_args > key2->n_args)
+                return 1;
+        if (key1->n_args < key2->n_args)
+                return -1;
+
+        for (size_t i = 0; i < key1->n_args; ++i) {
+                if (key1->args[i].index > key2->args[i].index)
+                        return 1;
+                if (key1->args[i].index < key2->args[i].index)
+                        return -1;
+                if (key1->args[i].path > key2->args[i].path)
+                        return 1;
+                if (key1->args[i].path < key2->args[i].path)
+                        return -1;
+                if ((r = c_string_compare(key1->args[i].value, key2->args[i].value)))
                         return r;
         }
 
@@ -363,11 +447,11 @@ static MatchRule *match_rule_free(MatchRule *rule) {
 
         assert(!rule->n_user_refs);
 
-        match_keys_deinit(&rule->keys);
         user_charge_deinit(&rule->charge[1]);
         user_charge_deinit(&rule->charge[0]);
         c_rbtree_remove_init(&rule->owner->rule_tree, &rule->owner_node);
         match_rule_unlink(rule);
+        match_keys_unref(rule->keys);
         free(rule);
 
         return NULL;
@@ -375,31 +459,59 @@ static MatchRule *match_rule_free(MatchRule *rule) {
 
 C_DEFINE_CLEANUP(MatchRule *, match_rule_free);
 
-static int match_rule_new(MatchRule **rulep, MatchOwner *owner, User *user, const char *string) {
+/**
+ * match_keys_get_cost() - estimate evaluation cost of match keys
+ * @keys:               keys to operate on
+ *
+ * This estimates how expensive it is to evaluate @keys against a broadcast,
+ * in units of the matches quota. Every rule costs one unit, which covers the
+ * fixed header fields. On top, every argument key, as well as any
+ * namespace key, is weighted by the number of string comparisons it needs,
+ * and each MATCH_COST_KEYS_PER_UNIT of those add another unit.
+ *
+ * Hence, common rules with a handful of keys cost a single unit, while rules
+ * with dozens of argument keys are charged for the work they cause on every
+ * broadcast they are evaluated against.
+ *
+ * Return: The cost of @keys.
+ */
+unsigned int match_keys_get_cost(MatchKeys *keys) {
+        unsigned int weight = 0;
+
+        if (keys->path_namespace)
+                ++weight;
+        if (keys->arg0namespace)
+                ++weight;
+
+        /* argNpath keys are checked as prefix in both directions */
+        for (size_t i = 0; i < keys->n_args; ++i)
+                weight += keys->args[i].path ? 2 : 1;
+
+        return 1 + weight / MATCH_COST_KEYS_PER_UNIT;
+}
+
+static int match_rule_new(MatchRule **rulep, MatchOwner *owner, User *user, MatchKeys *keys) {
         _c_cleanup_(match_rule_freep) MatchRule *rule = NULL;
-        size_t n_string;
         int r;
 
-        n_string = strlen(string) + 1;
-        if (n_string - 1 > MATCH_RULE_LENGTH_MAX)
-                return MATCH_E_INVALID;
-
-        rule = calloc(1, sizeof(*rule) + n_string);
+        rule = calloc(1, sizeof(*rule));
         if (!rule)
                 return error_origin(-ENOMEM);
 
         *rule = (MatchRule)MATCH_RULE_NULL(*rule);
         rule->owner = owner;
+        rule->keys = match_keys_ref(keys);
 
-        r = user_charge(user, &rule->charge[0], NULL, USER_SLOT_BYTES, sizeof(*rule) + n_string);
-        r = r ?: user_charge(user, &rule->charge[1], NULL, USER_SLOT_MATCHES, 1);
+        /*
+         * Keys might be shared with other rules via the cache. Regardless,
+         * every rule is charged for the full keys object, so the accounting
+         * does not depend on what other peers subscribed to.
+         */
+        r = user_charge(user, &rule->charge[0], NULL, USER_SLOT_BYTES, sizeof(*rule) + keys->n_allocation);
+        r = r ?: user_charge(user, &rule->charge[1], NULL, USER_SLOT_MATCHES, match_keys_get_cost(keys));
         if (r)
                 return (r == USER_E_QUOTA) ? MATCH_E_QUOTA : error_fold(r);
 
-        r = match_keys_init(&rule->keys, string, n_string);
-        if (r)
-                return error_trace(r);
-
         *rulep = rule;
         rule = NULL;
         return 0;
@@ -470,7 +582,7 @@ static MatchRule *match_rule_next_match_internal(CList *rules, MatchRule *rule,
              entry = entry->next) {
                 rule = c_list_entry(entry, MatchRule, registry_link);
 
-                if (match_keys_match_filter(&rule->keys, filter))
+                if (match_keys_match_filter(rule->keys, filter))
                         return rule;
         }
 
@@ -505,23 +617,31 @@ void match_owner_deinit(MatchOwner *owner) {
 /**
  * match_owner_ref_rule() - XXX
  */
-int match_owner_ref_rule(MatchOwner *owner, MatchRule **rulep, User *user, const char *rule_string) {
+int match_owner_ref_rule(MatchOwner *owner, MatchRule **rulep, MatchCache *cache, User *user, const char *rule_string) {
+        _c_cleanup_(match_keys_unrefp) MatchKeys *keys = NULL;
         _c_cleanup_(match_rule_user_unrefp) MatchRule *rule = NULL;
         CRBNode **slot, *parent;
         int r;
 
-        r = match_rule_new(&rule, owner, user, rule_string);
+        if (cache)
+                r = match_cache_ref_keys(cache, &keys, rule_string);
+        else
+                r = match_keys_new(&keys, rule_string);
         if (r)
                 return error_trace(r);
 
-        ++rule->n_user_refs;
-
-        slot = c_rbtree_find_slot(&owner->rule_tree, match_rule_compare, &rule->keys, &parent);
+        slot = c_rbtree_find_slot(&owner->rule_tree, match_rule_compare, keys, &parent);
         if (!slot) {
-                /* one already exists, take a ref on that instead and drop the one we created */
+                /* one already exists, take a ref on that instead */
                 if (rulep)
                         *rulep = match_rule_user_ref(c_container_of(parent, MatchRule, owner_node));
         } else {
+                r = match_rule_new(&rule, owner, user, keys);
+                if (r)
+                        return error_trace(r);
+
+                ++rule->n_user_refs;
+
                 /* link the new rule into the rbtree */
                 c_rbtree_add(&owner->rule_tree, parent, slot, &rule->owner_node);
                 if (rulep)
@@ -535,15 +655,106 @@ int match_owner_ref_rule(MatchOwner *owner, MatchRule **rulep, User *user, const
 /**
  * match_owner_find_rule() - XXX
  */
-int match_owner_find_rule(MatchOwner *owner, MatchRule **rulep, const char *rule_string) {
-        _c_cleanup_(match_keys_freep) MatchKeys *keys = NULL;
+int match_owner_find_rule(MatchOwner *owner, MatchRule **rulep, MatchCache *cache, const char *rule_string) {
+        _c_cleanup_(match_keys_unrefp) MatchKeys *keys = NULL;
         int r;
 
+        /*
+         * If the rule string is cached, use the parsed keys from the cache.
+         * Otherwise, a matching rule might still exist, since different rule
+         * strings can parse to the same keys. Parse the string, but do not
+         * add it to the cache, as it would be dropped right away.
+         */
+        if (cache)
+                keys = match_keys_ref(match_cache_find_keys(cache, rule_string));
+
+        if (!keys) {
+                r = match_keys_new(&keys, rule_string);
+                if (r)
+                        return error_trace(r);
+        }
+
+        *rulep = c_rbtree_find_entry(&owner->rule_tree, match_rule_compare, keys, MatchRule, owner_node);
+        return 0;
+}
+
+typedef struct MatchCacheKey {
+        uint64_t hash;
+        const char *string;
+} MatchCacheKey;
+
+static int match_cache_compare(CRBTree *tree, void *k, CRBNode *rb) {
+        MatchKeys *keys = c_container_of(rb, MatchKeys, cache_node);
+        MatchCacheKey *key = k;
+
+        if (key->hash > keys->hash)
+                return 1;
+        if (key->hash < keys->hash)
+                return -1;
+
+        return strcmp(key->string, keys->string);
+}
+
+/**
+ * match_cache_init() - XXX
+ */
+void match_cache_init(MatchCache *cache) {
+        *cache = (MatchCache)MATCH_CACHE_INIT;
+}
+
+/**
+ * match_cache_deinit() - XXX
+ */
+void match_cache_deinit(MatchCache *cache) {
+        assert(c_rbtree_is_empty(&cache->keys_tree));
+}
+
+/**
+ * match_cache_find_keys() - XXX
+ */
+MatchKeys *match_cache_find_keys(MatchCache *cache, const char *rule_string) {
+        MatchCacheKey key = {
+                .hash = match_string_hash(rule_string),
+                .string = rule_string,
+        };
+
+        return c_rbtree_find_entry(&cache->keys_tree, match_cache_compare, &key, MatchKeys, cache_node);
+}
+
+/**
+ * match_cache_ref_keys() - XXX
+ */
+int match_cache_ref_keys(MatchCache *cache, MatchKeys **keysp, const char *rule_string) {
+        _c_cleanup_(match_keys_unrefp) MatchKeys *keys = NULL;
+        MatchCacheKey key = {
+                .hash = match_string_hash(rule_string),
+                .string = rule_string,
+        };
+        CRBNode **slot, *parent;
+        int r;
+
+        /*
+         * The cache maps raw rule strings to their parsed keys. It does not
+         * hold any references itself, keys are unlinked from the cache when
+         * their last user drops them. Invalid rule strings are not cached.
+         */
+
+        slot = c_rbtree_find_slot(&cache->keys_tree, match_cache_compare, &key, &parent);
+        if (!slot) {
+                *keysp = match_keys_ref(c_container_of(parent, MatchKeys, cache_node));
+                return 0;
+        }
+
         r = match_keys_new(&keys, rule_string);
         if (r)
                 return error_trace(r);
 
-        *rulep = c_rbtree_find_entry(&owner->rule_tree, match_rule_compare, keys, MatchRule, owner_node);
+        keys->cache = cache;
+        keys->hash = key.hash;
+        c_rbtree_add(&cache->keys_tree, parent, slot, &keys->cache_node);
+
+        *keysp = keys;
+        keys = NULL;
         return 0;
 }
 
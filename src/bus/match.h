@@ -8,8 +8,11 @@
 #include <c-rbtree.h>
 #include <stdlib.h>
 #include "dbus/address.h"
+#include "util/ref.h"
 #include "util/user.h"
 
+typedef struct MatchArg MatchArg;
+typedef struct MatchCache MatchCache;
 typedef struct MatchFilter MatchFilter;
 typedef struct MatchKeys MatchKeys;
 typedef struct MatchOwner MatchOwner;
@@ -17,6 +20,14 @@ typedef struct MatchRegistry MatchRegistry;
 typedef struct MatchRule MatchRule;
 
 #define MATCH_RULE_LENGTH_MAX (1024UL) /* taken from dbus-daemon(1) */
+#define MATCH_ARGS_MAX (64UL)
+#define MATCH_COST_KEYS_PER_UNIT (4U) /* see match_keys_get_cost() */
+
+enum {
+        MATCH_VERDICT_UNKNOWN,
+        MATCH_VERDICT_ALLOW,
+        MATCH_VERDICT_DENY,
+};
 
 enum {
         _MATCH_E_SUCCESS,
@@ -33,8 +44,8 @@ struct MatchFilter {
         const char *interface;
         const char *member;
         const char *path;
-        const char *args[64];
-        const char *argpaths[64];
+        const char *args[MATCH_ARGS_MAX];
+        const char *argpaths[MATCH_ARGS_MAX];
 };
 
 #define MATCH_FILTER_INIT {                             \
@@ -43,17 +54,42 @@ struct MatchFilter {
                 .sender = ADDRESS_ID_INVALID,           \
         }
 
+struct MatchArg {
+        uint8_t index;
+        bool path;
+        const char *value;
+};
+
 struct MatchKeys {
-        MatchFilter filter;
+        Ref n_refs;
+        MatchCache *cache;
+        CRBNode cache_node;
+        uint64_t hash;
+        const char *string;
+        size_t n_allocation;
+
+        struct {
+                uint8_t type;
+                uint64_t destination;
+                uint64_t sender;
+                const char *interface;
+                const char *member;
+                const char *path;
+        } filter;
         const char *destination;
         const char *sender;
         const char *path_namespace;
         const char *arg0namespace;
+        bool coalesce;
 
-        char buffer[];
+        size_t n_args;
+        MatchArg args[];
+        /* the string buffers follow the VLA */
 };
 
-#define MATCH_KEYS_NULL {                                                       \
+#define MATCH_KEYS_NULL(_x) {                                                   \
+                .n_refs = REF_INIT,                                             \
+                .cache_node = C_RBNODE_INIT((_x).cache_node),                   \
                 .filter = MATCH_FILTER_INIT,                                    \
         }
 
@@ -65,15 +101,16 @@ struct MatchRule {
         CRBNode owner_node;
 
         UserCharge charge[2];
-        MatchKeys keys;
-        /* @keys must be last, as it contains a VLA */
+        MatchKeys *keys;
+
+        /* receive-policy verdict of the owner, if independent of the sender */
+        unsigned int receive_verdict;
 };
 
 #define MATCH_RULE_NULL(_x) {                                                   \
                 .registry_link = C_LIST_INIT((_x).registry_link),               \
                 .owner_node = C_RBNODE_INIT((_x).owner_node),                   \
                 .charge = { USER_CHARGE_INIT, USER_CHARGE_INIT },               \
-                .keys = MATCH_KEYS_NULL,                                        \
         }
 
 struct MatchOwner {
@@ -84,6 +121,14 @@ struct MatchOwner {
                 .rule_tree = C_RBTREE_INIT,     \
         }
 
+struct MatchCache {
+        CRBTree keys_tree;
+};
+
+#define MATCH_CACHE_INIT {                      \
+                .keys_tree = C_RBTREE_INIT,     \
+        }
+
 struct MatchRegistry {
         CList rule_list;
         CList monitor_list;
@@ -94,6 +139,11 @@ struct MatchRegistry {
                 .monitor_list = (CList)C_LIST_INIT((_x).monitor_list),          \
         }
 
+/* keys */
+
+void match_keys_free(Ref *n_refs, void *userdata);
+unsigned int match_keys_get_cost(MatchKeys *keys);
+
 /* rules */
 
 MatchRule *match_rule_user_ref(MatchRule *rule);
@@ -112,10 +162,34 @@ C_DEFINE_CLEANUP(MatchRule *, match_rule_user_unref);
 void match_owner_init(MatchOwner *owner);
 void match_owner_deinit(MatchOwner *owner);
 
-int match_owner_ref_rule(MatchOwner *owner, MatchRule **rulep, User *user, const char *rule_string);
-int match_owner_find_rule(MatchOwner *owner, MatchRule **rulep, const char *rule_string);
+int match_owner_ref_rule(MatchOwner *owner, MatchRule **rulep, MatchCache *cache, User *user, const char *rule_string);
+int match_owner_find_rule(MatchOwner *owner, MatchRule **rulep, MatchCache *cache, const char *rule_string);
+
+/* cache */
+
+void match_cache_init(MatchCache *cache);
+void match_cache_deinit(MatchCache *cache);
+
+MatchKeys *match_cache_find_keys(MatchCache *cache, const char *rule_string);
+int match_cache_ref_keys(MatchCache *cache, MatchKeys **keysp, const char *rule_string);
 
 /* registry */
 
 void match_registry_init(MatchRegistry *registry);
 void match_registry_deinit(MatchRegistry *registry);
+
+/* inline helpers */
+
+static inline MatchKeys *match_keys_ref(MatchKeys *keys) {
+        if (keys)
+                ref_inc(&keys->n_refs);
+        return keys;
+}
+
+static inline MatchKeys *match_keys_unref(MatchKeys *keys) {
+        if (keys)
+                ref_dec(&keys->n_refs, match_keys_free, NULL);
+        return NULL;
+}
+
+C_DEFINE_CLEANUP(MatchKeys *, match_keys_unref);
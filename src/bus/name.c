@@ -4,13 +4,13 @@
 
 #include <c-macro.h>
 #include <c-rbtree.h>
-#include <c-ref.h>
 #include <c-list.h>
 #include <stdlib.h>
 #include "bus/name.h"
 #include "dbus/protocol.h"
 #include "dbus/socket.h"
 #include "util/error.h"
+#include "util/ref.h"
 #include "util/user.h"
 
 /**
@@ -53,6 +53,39 @@ static void name_ownership_link(NameOwnership *ownership, CRBNode *parent, CRBNo
         c_rbtree_add(&ownership->owner->ownership_tree, parent, slot, &ownership->owner_node);
 }
 
+static void name_ownership_queue_front(NameOwnership *ownership) {
+        Name *name = ownership->name;
+
+        if (c_list_is_linked(&ownership->name_link))
+                c_list_unlink(&ownership->name_link);
+        else
+                ++name->n_ownerships;
+
+        c_list_link_front(&name->ownership_list, &ownership->name_link);
+}
+
+static void name_ownership_queue_tail(NameOwnership *ownership) {
+        Name *name = ownership->name;
+
+        if (c_list_is_linked(&ownership->name_link))
+                return;
+
+        ++name->n_ownerships;
+        c_list_link_tail(&name->ownership_list, &ownership->name_link);
+}
+
+static void name_ownership_dequeue(NameOwnership *ownership) {
+        Name *name = ownership->name;
+
+        if (!c_list_is_linked(&ownership->name_link))
+                return;
+
+        assert(name->n_ownerships > 0);
+
+        --name->n_ownerships;
+        c_list_unlink_init(&ownership->name_link);
+}
+
 static NameOwnership *name_ownership_free(NameOwnership *ownership) {
         if (!ownership)
                 return NULL;
@@ -121,7 +154,7 @@ void name_ownership_release(NameOwnership *ownership, NameChange *change) {
         assert(!change->new_owner);
 
         primary = name_primary(ownership->name);
-        c_list_unlink_init(&ownership->name_link);
+        name_ownership_dequeue(ownership);
 
         if (ownership == primary) {
                 primary = name_primary(ownership->name);
@@ -155,7 +188,7 @@ static int name_ownership_update(NameOwnership *ownership, uint32_t flags, NameC
                 /* @owner cannot already be linked */
                 assert(!c_list_is_linked(&ownership->name_link));
 
-                c_list_link_front(&name->ownership_list, &ownership->name_link);
+                name_ownership_queue_front(ownership);
                 r = 0;
         } else if (primary == ownership) {
                 /* we are already the primary owner */
@@ -167,24 +200,22 @@ static int name_ownership_update(NameOwnership *ownership, uint32_t flags, NameC
                 change->old_owner = primary->owner;
                 change->new_owner = ownership->owner;
 
-                c_list_unlink_init(&ownership->name_link);
-                c_list_link_front(&name->ownership_list, &ownership->name_link);
+                name_ownership_queue_front(ownership);
 
                 /* drop previous primary owner, if queuing is not requested */
                 if (primary->flags & DBUS_NAME_FLAG_DO_NOT_QUEUE) {
-                        c_list_unlink_init(&primary->name_link);
+                        name_ownership_dequeue(primary);
                         name_ownership_free(primary);
                 }
 
                 r = 0;
         } else if (!(ownership->flags & DBUS_NAME_FLAG_DO_NOT_QUEUE)) {
                 /* we are appended to the queue */
-                if (!c_list_is_linked(&ownership->name_link))
-                        c_list_link_tail(&name->ownership_list, &ownership->name_link);
+                name_ownership_queue_tail(ownership);
                 r = NAME_E_IN_QUEUE;
         } else {
                 /* we are dropped */
-                c_list_unlink_init(&ownership->name_link);
+                name_ownership_dequeue(ownership);
                 r = NAME_E_EXISTS;
         }
 
@@ -221,10 +252,11 @@ static int name_new(Name **namep, NameRegistry *registry, const char *name_str)
         return 0;
 }
 
-void name_free(_Atomic unsigned long *n_refs, void *userdata) {
+void name_free(Ref *n_refs, void *userdata) {
         Name *name = c_container_of(n_refs, Name, n_refs);
 
         assert(c_list_is_empty(&name->ownership_list));
+        assert(!name->n_ownerships);
         assert(!name->activation);
 
         match_registry_deinit(&name->matches);
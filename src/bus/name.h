@@ -5,9 +5,9 @@
  */
 
 #include <c-macro.h>
-#include <c-ref.h>
 #include <stdlib.h>
 #include "bus/match.h"
+#include "util/ref.h"
 #include "util/user.h"
 
 typedef struct Activation Activation;
@@ -55,7 +55,7 @@ struct NameOwnership {
         }
 
 struct Name {
-        _Atomic unsigned long n_refs;
+        Ref n_refs;
         NameRegistry *registry;
         CRBNode registry_node;
 
@@ -63,11 +63,12 @@ struct Name {
         MatchRegistry matches;
 
         CList ownership_list;
+        size_t n_ownerships;
         char name[];
 };
 
 #define NAME_INIT(_x) {                                                         \
-                .n_refs = C_REF_INIT,                                           \
+                .n_refs = REF_INIT,                                             \
                 .registry_node = C_RBNODE_INIT((_x).registry_node),             \
                 .matches = MATCH_REGISTRY_INIT((_x).matches),                   \
                 .ownership_list = C_LIST_INIT((_x).ownership_list),             \
@@ -131,7 +132,7 @@ bool name_ownership_is_primary(NameOwnership *owner);
 
 /* names */
 
-void name_free(_Atomic unsigned long *n_refs, void *userdata);
+void name_free(Ref *n_refs, void *userdata);
 
 /* owners */
 
@@ -168,13 +169,13 @@ C_DEFINE_CLEANUP(NameSnapshot *, name_snapshot_free);
 
 static inline Name *name_ref(Name *name) {
         if (name)
-                c_ref_inc(&name->n_refs);
+                ref_inc(&name->n_refs);
         return name;
 }
 
 static inline Name *name_unref(Name *name) {
         if (name)
-                c_ref_dec(&name->n_refs, name_free, NULL);
+                ref_dec(&name->n_refs, name_free, NULL);
         return NULL;
 }
 
@@ -23,10 +23,21 @@
 #include "util/error.h"
 #include "util/fdlist.h"
 #include "util/metrics.h"
+#include "util/recorder.h"
 #include "util/selinux.h"
 #include "util/sockopt.h"
 #include "util/user.h"
 
+/*
+ * Broadcasts touch a handful of fields on every receiver. Make sure they stay
+ * packed at the front of the peer, rather than being spread across the
+ * kilobytes of input buffers and caches embedded in it.
+ */
+static_assert(offsetof(Peer, connection) <= 128,
+              "Hot peer fields exceed two cache lines");
+static_assert(offsetof(Peer, connection.socket.in) <= 256,
+              "Peer output queue is not part of its hot section");
+
 static int peer_dispatch_connection(Peer *peer, uint32_t events) {
         int r;
 
@@ -48,6 +59,13 @@ static int peer_dispatch_connection(Peer *peer, uint32_t events) {
                         return error_fold(r);
                 }
 
+                recorder_record(&peer->bus->recorder,
+                                RECORDER_EVENT_DISPATCH,
+                                peer->id,
+                                m->header->type,
+                                message_read_serial(m),
+                                m->n_data);
+
                 metrics_sample_start(&peer->bus->metrics);
                 r = driver_dispatch(peer, m);
                 metrics_sample_end(&peer->bus->metrics);
@@ -182,6 +200,7 @@ int peer_new_with_fd(Peer **peerp,
 
         peer->bus = bus;
         peer->connection = (Connection)CONNECTION_NULL(peer->connection);
+        peer->message_cache = (MessageCache)MESSAGE_CACHE_INIT;
         peer->registry_node = (CRBNode)C_RBNODE_INIT(peer->registry_node);
         peer->user = user;
         user = NULL;
@@ -230,10 +249,14 @@ int peer_new_with_fd(Peer **peerp,
                 return error_fold(r);
 
         peer->id = bus->peers.ids++;
+        message_sender_init(&peer->message_sender, peer->id);
+        dispatch_file_set_name(&peer->connection.socket_file, "peer", peer->id);
         slot = c_rbtree_find_slot(&bus->peers.peer_tree, peer_compare, &peer->id, &parent);
         assert(slot); /* peer->id is guaranteed to be unique */
         c_rbtree_add(&bus->peers.peer_tree, parent, slot, &peer->registry_node);
 
+        recorder_record(&bus->recorder, RECORDER_EVENT_CONNECT, peer->id, 0, 0, ucred.pid);
+
         *peerp = peer;
         peer = NULL;
         return 0;
@@ -251,6 +274,8 @@ Peer *peer_free(Peer *peer) {
         assert(!peer->registered);
 
         c_rbtree_remove_init(&peer->bus->peers.peer_tree, &peer->registry_node);
+        if (peer->monitor)
+                --peer->bus->peers.n_monitors;
 
         fd = peer->connection.socket.fd;
 
@@ -371,12 +396,12 @@ static int peer_link_match(Peer *peer, MatchRule *rule, bool monitor) {
         Peer *sender;
         int r;
 
-        if (!rule->keys.sender) {
+        if (!rule->keys->sender) {
                 match_rule_link(rule, &peer->bus->wildcard_matches, monitor);
-        } else if (strcmp(rule->keys.sender, "org.freedesktop.DBus") == 0) {
+        } else if (strcmp(rule->keys->sender, "org.freedesktop.DBus") == 0) {
                 match_rule_link(rule, &peer->bus->driver_matches, monitor);
         } else {
-                address_from_string(&addr, rule->keys.sender);
+                address_from_string(&addr, rule->keys->sender);
                 switch (addr.type) {
                 case ADDRESS_TYPE_ID: {
                         sender = peer_registry_find_peer(&peer->bus->peers, addr.id);
@@ -391,8 +416,9 @@ static int peer_link_match(Peer *peer, MatchRule *rule, bool monitor) {
                                  * It does not perform nicely, but there is
                                  * also no reason to ever guess the ID of a
                                  * forthcoming peer.
+                                 * The keys already carry the sender ID, so
+                                 * the filter only matches that peer.
                                  */
-                                rule->keys.filter.sender = addr.id;
                                 match_rule_link(rule, &peer->bus->wildcard_matches, monitor);
                         } else {
                                 /*
@@ -417,7 +443,7 @@ static int peer_link_match(Peer *peer, MatchRule *rule, bool monitor) {
                          */
                         _c_cleanup_(name_unrefp) Name *name = NULL;
 
-                        r = name_registry_ref_name(&peer->bus->names, &name, rule->keys.sender);
+                        r = name_registry_ref_name(&peer->bus->names, &name, rule->keys->sender);
                         if (r)
                                 return error_fold(r);
 
@@ -433,11 +459,40 @@ static int peer_link_match(Peer *peer, MatchRule *rule, bool monitor) {
         return 0;
 }
 
+static void peer_precompute_match(Peer *peer, MatchRule *rule) {
+        int r;
+
+        /*
+         * If a rule pins all the fields the receive-policy can match on, the
+         * receive verdict of its owner only depends on the names of the
+         * sender. In most policies it does not even depend on those, in which
+         * case we cache it on the rule and skip the policy check on each
+         * broadcast. The snapshot of a peer never changes, so neither does
+         * the verdict.
+         */
+        if (rule->receive_verdict != MATCH_VERDICT_UNKNOWN ||
+            rule->keys->filter.type != DBUS_MESSAGE_TYPE_SIGNAL ||
+            !rule->keys->filter.interface ||
+            !rule->keys->filter.member ||
+            !rule->keys->filter.path)
+                return;
+
+        r = policy_snapshot_check_receive_any(peer->policy,
+                                              rule->keys->filter.interface,
+                                              rule->keys->filter.member,
+                                              rule->keys->filter.path,
+                                              rule->keys->filter.type);
+        if (!r)
+                rule->receive_verdict = MATCH_VERDICT_ALLOW;
+        else if (r == POLICY_E_ACCESS_DENIED)
+                rule->receive_verdict = MATCH_VERDICT_DENY;
+}
+
 int peer_add_match(Peer *peer, const char *rule_string) {
         _c_cleanup_(match_rule_user_unrefp) MatchRule *rule = NULL;
         int r;
 
-        r = match_owner_ref_rule(&peer->owned_matches, &rule, peer->user, rule_string);
+        r = match_owner_ref_rule(&peer->owned_matches, &rule, &peer->bus->match_cache, peer->user, rule_string);
         if (r) {
                 if (r == MATCH_E_QUOTA)
                         return PEER_E_QUOTA;
@@ -451,6 +506,7 @@ int peer_add_match(Peer *peer, const char *rule_string) {
         if (r)
                 return error_trace(r);
 
+        peer_precompute_match(peer, rule);
         rule = NULL;
 
         return 0;
@@ -461,7 +517,7 @@ int peer_remove_match(Peer *peer, const char *rule_string) {
         MatchRule *rule;
         int r;
 
-        r = match_owner_find_rule(&peer->owned_matches, &rule, rule_string);
+        r = match_owner_find_rule(&peer->owned_matches, &rule, &peer->bus->match_cache, rule_string);
         if (r == MATCH_E_INVALID)
                 return PEER_E_MATCH_INVALID;
         else if (r)
@@ -469,7 +525,7 @@ int peer_remove_match(Peer *peer, const char *rule_string) {
         else if (!rule)
                 return PEER_E_MATCH_NOT_FOUND;
 
-        if (rule->keys.sender && *rule->keys.sender != ':' && strcmp(rule->keys.sender, "org.freedesktop.DBus") != 0)
+        if (rule->keys->sender && *rule->keys->sender != ':' && strcmp(rule->keys->sender, "org.freedesktop.DBus") != 0)
                 name = c_container_of(rule->registry, Name, matches);
 
         match_rule_user_unref(rule);
@@ -506,6 +562,7 @@ int peer_become_monitor(Peer *peer, MatchOwner *owned_matches) {
                 return poison;
 
         peer->monitor = true;
+        ++peer->bus->peers.n_monitors;
 
         return 0;
 }
@@ -517,13 +574,82 @@ void peer_flush_matches(Peer *peer) {
                 _c_cleanup_(name_unrefp) Name *name = NULL;
                 MatchRule *rule = c_container_of(node, MatchRule, owner_node);
 
-                if (rule->keys.sender && *rule->keys.sender != ':' && strcmp(rule->keys.sender, "org.freedesktop.DBus") != 0)
+                if (rule->keys->sender && *rule->keys->sender != ':' && strcmp(rule->keys->sender, "org.freedesktop.DBus") != 0)
                         name = c_container_of(rule->registry, Name, matches);
 
                 match_rule_user_unref(rule);
         }
 }
 
+static int peer_check_direct(Peer *sender, Peer *receiver) {
+        NameSet sender_names = NAME_SET_INIT_FROM_OWNER(&sender->owned_names);
+        NameSet receiver_names = NAME_SET_INIT_FROM_OWNER(&receiver->owned_names);
+        int r;
+
+        /*
+         * A direct connection carries arbitrary traffic, so we cannot check
+         * individual messages. Instead, @sender must be allowed to send any
+         * method call to @receiver, and @receiver must be allowed to receive
+         * any method call from @sender. Rules that are restricted to certain
+         * interfaces, members, or paths never match here.
+         */
+
+        r = policy_snapshot_check_send(sender->policy,
+                                       receiver->sid,
+                                       &receiver_names,
+                                       NULL,
+                                       NULL,
+                                       NULL,
+                                       DBUS_MESSAGE_TYPE_METHOD_CALL);
+        if (r)
+                return (r == POLICY_E_ACCESS_DENIED) ? PEER_E_SEND_DENIED : error_fold(r);
+
+        r = policy_snapshot_check_receive(receiver->policy,
+                                          &sender_names,
+                                          NULL,
+                                          NULL,
+                                          NULL,
+                                          DBUS_MESSAGE_TYPE_METHOD_CALL);
+        if (r)
+                return (r == POLICY_E_ACCESS_DENIED) ? PEER_E_RECEIVE_DENIED : error_fold(r);
+
+        return 0;
+}
+
+/**
+ * peer_connect_peer() - create a direct connection between two peers
+ * @peer:               peer requesting the connection
+ * @receiver:           peer to connect to
+ * @pairp:              output argument for the socket pair
+ *
+ * This verifies that @peer and @receiver may exchange arbitrary method calls
+ * in both directions, and then creates a socket pair to be handed to them. The
+ * first socket is meant for @peer, the second for @receiver. Ownership of both
+ * is transferred to the caller.
+ *
+ * The broker loses track of the connection once it was handed out, so nothing
+ * is charged here. The caller is expected to charge the messages carrying the
+ * sockets on @peer, until they were dequeued.
+ *
+ * Return: 0 on success, PEER_E_SEND_DENIED or PEER_E_RECEIVE_DENIED if the
+ *         policy refuses the connection, PEER_E_QUOTA if no file descriptors
+ *         are left, negative error code on failure.
+ */
+int peer_connect_peer(Peer *peer, Peer *receiver, int *pairp) {
+        int r;
+
+        r = peer_check_direct(peer, receiver);
+        r = r ?: peer_check_direct(receiver, peer);
+        if (r)
+                return error_trace(r);
+
+        r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pairp);
+        if (r < 0)
+                return (errno == EMFILE || errno == ENFILE) ? PEER_E_QUOTA : error_origin(-errno);
+
+        return 0;
+}
+
 int peer_queue_call(PolicySnapshot *sender_policy, NameSet *sender_names, MatchRegistry *sender_matches, ReplyOwner *sender_replies, User *sender_user, uint64_t sender_id, Peer *receiver, Message *message) {
         _c_cleanup_(reply_slot_freep) ReplySlot *slot = NULL;
         NameSet receiver_names = NAME_SET_INIT_FROM_OWNER(&receiver->owned_names);
@@ -532,16 +658,11 @@ int peer_queue_call(PolicySnapshot *sender_policy, NameSet *sender_names, MatchR
 
         serial = message_read_serial(message);
 
-        if (sender_replies && serial) {
-                r = reply_slot_new(&slot, &receiver->replies_outgoing, sender_replies,
-                                   receiver->user, sender_user, sender_id, serial);
-                if (r == REPLY_E_EXISTS)
-                        return PEER_E_EXPECTED_REPLY_EXISTS;
-                else if (r == REPLY_E_QUOTA)
-                        return PEER_E_QUOTA;
-                else if (r)
-                        return error_fold(r);
-        }
+        /*
+         * Run the policy checks before any state is allocated. Denied calls
+         * are cheap to detect, and can be triggered at will by any peer, so
+         * they must not pay for reply tracking they will never need.
+         */
 
         r = policy_snapshot_check_receive(receiver->policy,
                                           sender_names,
@@ -550,8 +671,11 @@ int peer_queue_call(PolicySnapshot *sender_policy, NameSet *sender_names, MatchR
                                           message->metadata.fields.path,
                                           message->header->type);
         if (r) {
-                if (r == POLICY_E_ACCESS_DENIED)
+                if (r == POLICY_E_ACCESS_DENIED) {
+                        recorder_record(&receiver->bus->recorder, RECORDER_EVENT_DENIED,
+                                        sender_id, message->header->type, serial, receiver->id);
                         return PEER_E_RECEIVE_DENIED;
+                }
 
                 return error_fold(r);
         }
@@ -564,18 +688,42 @@ int peer_queue_call(PolicySnapshot *sender_policy, NameSet *sender_names, MatchR
                                        message->metadata.fields.path,
                                        message->header->type);
         if (r) {
-                if (r == POLICY_E_ACCESS_DENIED)
+                if (r == POLICY_E_ACCESS_DENIED) {
+                        recorder_record(&receiver->bus->recorder, RECORDER_EVENT_DENIED,
+                                        sender_id, message->header->type, serial, receiver->id);
                         return PEER_E_SEND_DENIED;
+                }
 
                 return error_fold(r);
         }
 
+        /*
+         * The call is permitted, so track the reply and queue the call. Only
+         * the quota charges can fail now, and if queueing does, the reply
+         * slot is released again.
+         */
+
+        if (sender_replies && serial) {
+                r = reply_slot_new(&slot, &receiver->replies_outgoing, sender_replies,
+                                   receiver->user, sender_user, sender_id, serial,
+                                   receiver->bus->reply_reserve);
+                if (r == REPLY_E_EXISTS)
+                        return PEER_E_EXPECTED_REPLY_EXISTS;
+                else if (r == REPLY_E_QUOTA)
+                        return PEER_E_QUOTA;
+                else if (r)
+                        return error_fold(r);
+        }
+
         r = connection_queue(&receiver->connection, sender_user, message);
         if (r) {
-                if (CONNECTION_E_QUOTA)
+                if (r == CONNECTION_E_QUOTA) {
+                        recorder_record(&receiver->bus->recorder, RECORDER_EVENT_QUOTA,
+                                        sender_id, message->header->type, serial, receiver->id);
                         return PEER_E_QUOTA;
-                else
-                        return error_fold(r);
+                }
+
+                return error_fold(r);
         }
 
         slot = NULL;
@@ -583,7 +731,7 @@ int peer_queue_call(PolicySnapshot *sender_policy, NameSet *sender_names, MatchR
 }
 
 int peer_queue_reply(Peer *sender, const char *destination, uint32_t reply_serial, Message *message) {
-        _c_cleanup_(reply_slot_freep) ReplySlot *slot = NULL;
+        ReplySlot *slot;
         Peer *receiver;
         Address addr;
         int r;
@@ -598,18 +746,27 @@ int peer_queue_reply(Peer *sender, const char *destination, uint32_t reply_seria
 
         receiver = c_container_of(slot->owner, Peer, owned_replies);
 
+        /*
+         * Release the slot before queueing the reply. This returns the bytes
+         * reserved for the reply to the receiver, so a reply that fits into
+         * the reservation never exceeds the receiver's quota.
+         */
+        reply_slot_free(slot);
+
         r = connection_queue(&receiver->connection, NULL, message);
         if (r) {
-                if (r == CONNECTION_E_QUOTA)
+                if (r == CONNECTION_E_QUOTA) {
+                        recorder_record(&receiver->bus->recorder, RECORDER_EVENT_QUOTA,
+                                        sender->id, message->header->type, message_read_serial(message), receiver->id);
                         connection_shutdown(&receiver->connection);
-                else
+                } else
                         return error_fold(r);
         }
 
         return 0;
 }
 
-static int peer_broadcast_to_matches(PolicySnapshot *sender_policy, NameSet *sender_names, MatchRegistry *matches, MatchFilter *filter, uint64_t transaction_id, Message *message) {
+static int peer_broadcast_to_matches(PolicySnapshot *sender_policy, NameSet *sender_names, MatchRegistry *matches, MatchFilter *filter, uint64_t transaction_id, Message *message, size_t *n_receiversp) {
         MatchRule *rule;
         int r;
 
@@ -625,6 +782,9 @@ static int peer_broadcast_to_matches(PolicySnapshot *sender_policy, NameSet *sen
 
                 receiver->transaction_id = c_max(transaction_id, receiver->transaction_id);
 
+                if (rule->receive_verdict == MATCH_VERDICT_DENY)
+                        continue;
+
                 if (sender_policy) {
                         r = policy_snapshot_check_send(sender_policy,
                                                        receiver->sid,
@@ -641,25 +801,36 @@ static int peer_broadcast_to_matches(PolicySnapshot *sender_policy, NameSet *sen
                         }
                 }
 
-                r = policy_snapshot_check_receive(receiver->policy,
-                                                  sender_names,
-                                                  message->metadata.fields.interface,
-                                                  message->metadata.fields.member,
-                                                  message->metadata.fields.path,
-                                                  message->header->type);
-                if (r) {
-                        if (r == POLICY_E_ACCESS_DENIED)
-                                continue;
+                if (rule->receive_verdict != MATCH_VERDICT_ALLOW) {
+                        r = policy_snapshot_check_receive(receiver->policy,
+                                                          sender_names,
+                                                          message->metadata.fields.interface,
+                                                          message->metadata.fields.member,
+                                                          message->metadata.fields.path,
+                                                          message->header->type);
+                        if (r) {
+                                if (r == POLICY_E_ACCESS_DENIED)
+                                        continue;
 
-                        return error_fold(r);
+                                return error_fold(r);
+                        }
                 }
 
-                r = connection_queue(&receiver->connection, NULL, message);
+                if (rule->keys->coalesce)
+                        r = connection_queue_coalesce(&receiver->connection, NULL, message);
+                else
+                        r = connection_queue(&receiver->connection, NULL, message);
                 if (r) {
-                        if (r == CONNECTION_E_QUOTA)
+                        if (r == CONNECTION_E_QUOTA) {
+                                recorder_record(&receiver->bus->recorder, RECORDER_EVENT_QUOTA,
+                                                filter->sender, message->header->type,
+                                                message_read_serial(message), receiver->id);
                                 connection_shutdown(&receiver->connection);
-                        else
+                        } else {
                                 return error_fold(r);
+                        }
+                } else {
+                        ++*n_receiversp;
                 }
         }
 
@@ -668,6 +839,7 @@ static int peer_broadcast_to_matches(PolicySnapshot *sender_policy, NameSet *sen
 
 int peer_broadcast(PolicySnapshot *sender_policy, NameSet *sender_names, MatchRegistry *sender_matches, uint64_t sender_id, Peer *destination, Bus *bus, MatchFilter *filter, Message *message) {
         MatchFilter fallback_filter = MATCH_FILTER_INIT;
+        size_t n_receivers = 0;
         int r;
 
         if (!filter) {
@@ -693,12 +865,12 @@ int peer_broadcast(PolicySnapshot *sender_policy, NameSet *sender_names, MatchRe
         /* start a new transaction, to avoid duplicates */
         ++bus->transaction_ids;
 
-        r = peer_broadcast_to_matches(sender_policy, sender_names, &bus->wildcard_matches, filter, bus->transaction_ids, message);
+        r = peer_broadcast_to_matches(sender_policy, sender_names, &bus->wildcard_matches, filter, bus->transaction_ids, message, &n_receivers);
         if (r)
                 return error_trace(r);
 
         if (sender_matches) {
-                r = peer_broadcast_to_matches(sender_policy, sender_names, sender_matches, filter, bus->transaction_ids, message);
+                r = peer_broadcast_to_matches(sender_policy, sender_names, sender_matches, filter, bus->transaction_ids, message, &n_receivers);
                 if (r)
                         return error_trace(r);
         }
@@ -716,7 +888,7 @@ int peer_broadcast(PolicySnapshot *sender_policy, NameSet *sender_names, MatchRe
                                 if (!name_ownership_is_primary(ownership))
                                         continue;
 
-                                r = peer_broadcast_to_matches(sender_policy, sender_names, &ownership->name->matches, filter, bus->transaction_ids, message);
+                                r = peer_broadcast_to_matches(sender_policy, sender_names, &ownership->name->matches, filter, bus->transaction_ids, message, &n_receivers);
                                 if (r)
                                         return error_trace(r);
                         }
@@ -725,7 +897,7 @@ int peer_broadcast(PolicySnapshot *sender_policy, NameSet *sender_names, MatchRe
                         snapshot = sender_names->snapshot;
 
                         for (size_t i = 0; i < snapshot->n_names; ++i) {
-                                r = peer_broadcast_to_matches(sender_policy, sender_names, &snapshot->names[i]->matches, filter, bus->transaction_ids, message);
+                                r = peer_broadcast_to_matches(sender_policy, sender_names, &snapshot->names[i]->matches, filter, bus->transaction_ids, message, &n_receivers);
                                 if (r)
                                         return error_trace(r);
                         }
@@ -735,11 +907,14 @@ int peer_broadcast(PolicySnapshot *sender_policy, NameSet *sender_names, MatchRe
                 }
         } else {
                 /* sent from the driver */
-                r = peer_broadcast_to_matches(NULL, NULL, &bus->driver_matches, filter, bus->transaction_ids, message);
+                r = peer_broadcast_to_matches(NULL, NULL, &bus->driver_matches, filter, bus->transaction_ids, message, &n_receivers);
                 if (r)
                         return error_trace(r);
         }
 
+        recorder_record(&bus->recorder, RECORDER_EVENT_BROADCAST,
+                        sender_id, message->header->type, message_read_serial(message), n_receivers);
+
         return 0;
 }
 
@@ -749,6 +924,7 @@ void peer_registry_init(PeerRegistry *registry) {
 
 void peer_registry_deinit(PeerRegistry *registry) {
         assert(c_rbtree_is_empty(&registry->peer_tree));
+        assert(!registry->n_monitors);
         registry->ids = 0;
 }
 
@@ -763,6 +939,28 @@ void peer_registry_flush(PeerRegistry *registry) {
         }
 }
 
+/**
+ * peer_registry_is_drained() - check whether all peers are idle
+ * @registry:           registry to operate on
+ *
+ * This checks whether any peer still has output queued in the broker, or owes
+ * a reply to a pending method call. Output already handed to the kernel is
+ * not considered, as it stays readable by the peer regardless of the broker.
+ *
+ * Return: True if no peer has any work pending, false otherwise.
+ */
+bool peer_registry_is_drained(PeerRegistry *registry) {
+        Peer *peer;
+
+        c_rbtree_for_each_entry(peer, &registry->peer_tree, registry_node) {
+                if (connection_has_output(&peer->connection) ||
+                    !c_rbtree_is_empty(&peer->replies_outgoing.reply_tree))
+                        return false;
+        }
+
+        return true;
+}
+
 Peer *peer_registry_find_peer(PeerRegistry *registry, uint64_t id) {
         Peer *peer;
 
@@ -52,34 +52,43 @@ enum {
 };
 
 struct Peer {
+        /*
+         * Hot: Everything a broadcast touches on each receiver is kept at the
+         * front, followed by the connection, whose output queue leads its
+         * socket. See the layout asserts in peer.c.
+         */
         Bus *bus;
-        User *user;
-        pid_t pid;
-        char *seclabel;
-        size_t n_seclabel;
-        BusSELinuxID *sid;
-        UserCharge charges[3];
-
         uint64_t id;
-        CRBNode registry_node;
-
-        Connection connection;
+        uint64_t transaction_id;
+        PolicySnapshot *policy;
+        BusSELinuxID *sid;
+        User *user;
         bool registered : 1;
         bool monitor : 1;
-
-        PolicySnapshot *policy;
         NameOwner owned_names;
-        MatchRegistry matches;
         MatchOwner owned_matches;
+
+        Connection connection;
+
+        /* Warm: used by messages sent by this peer. */
+        MessageCache message_cache;
+        MessageSender message_sender;
+        MatchRegistry matches;
         ReplyRegistry replies_outgoing;
         ReplyOwner owned_replies;
 
-        uint64_t transaction_id;
+        /* Cold: only used on setup, teardown and introspection. */
+        CRBNode registry_node;
+        pid_t pid;
+        char *seclabel;
+        size_t n_seclabel;
+        UserCharge charges[3];
 };
 
 struct PeerRegistry {
         CRBTree peer_tree;
         uint64_t ids;
+        size_t n_monitors;
 };
 
 #define PEER_REGISTRY_INIT {}
@@ -104,6 +113,8 @@ int peer_remove_match(Peer *peer, const char *rule_string);
 int peer_become_monitor(Peer *peer, MatchOwner *owner);
 void peer_flush_matches(Peer *peer);
 
+int peer_connect_peer(Peer *peer, Peer *receiver, int *pairp);
+
 int peer_queue_call(PolicySnapshot *sender_policy, NameSet *sender_names, MatchRegistry *sender_matches, ReplyOwner *sender_replies, User *sender_user, uint64_t sender_id, Peer *receiver, Message *message);
 int peer_queue_reply(Peer *sender, const char *destination, uint32_t reply_serial, Message *message);
 int peer_broadcast(PolicySnapshot *sender_policy, NameSet *sender_names, MatchRegistry *sender_matches, uint64_t sender_id, Peer *destination, Bus *bus, MatchFilter *filter, Message *message);
@@ -111,6 +122,7 @@ int peer_broadcast(PolicySnapshot *sender_policy, NameSet *sender_names, MatchRe
 void peer_registry_init(PeerRegistry *registry);
 void peer_registry_deinit(PeerRegistry *registry);
 void peer_registry_flush(PeerRegistry *registry);
+bool peer_registry_is_drained(PeerRegistry *registry);
 Peer *peer_registry_find_peer(PeerRegistry *registry, uint64_t id);
 
 static inline bool peer_is_registered(Peer *peer) {
@@ -123,7 +123,7 @@ int policy_batch_new(PolicyBatch **batchp) {
 }
 
 /* internal callback for policy_batch_unref() */
-void policy_batch_free(_Atomic unsigned long *n_refs, void *userdata) {
+void policy_batch_free(Ref *n_refs, void *userdata) {
         PolicyBatch *batch = c_container_of(n_refs, PolicyBatch, n_refs);
         PolicyBatchName *name, *t_name;
 
@@ -201,6 +201,21 @@ static int policy_batch_add_own_prefix(PolicyBatch *batch,
         return 0;
 }
 
+static void policy_batch_link_xmit(CList *list, PolicyXmit *xmit) {
+        CList *iter;
+
+        /*
+         * Keep the list sorted by descending priority, so lookups can stop at
+         * the first entry that cannot beat the current verdict. The launcher
+         * exports records in this order, so this usually links at the tail.
+         */
+        for (iter = list->prev; iter != list; iter = iter->prev)
+                if (c_list_entry(iter, PolicyXmit, batch_link)->verdict.priority >= xmit->verdict.priority)
+                        break;
+
+        c_list_link_after(iter, &xmit->batch_link);
+}
+
 static int policy_batch_add_send(PolicyBatch *batch,
                                  const char *name_str,
                                  PolicyVerdict verdict,
@@ -222,7 +237,7 @@ static int policy_batch_add_send(PolicyBatch *batch,
         if (r)
                 return error_trace(r);
 
-        c_list_link_tail(&name->send_unindexed, &xmit->batch_link);
+        policy_batch_link_xmit(&name->send_unindexed, xmit);
         xmit = NULL;
         return 0;
 }
@@ -248,7 +263,7 @@ static int policy_batch_add_recv(PolicyBatch *batch,
         if (r)
                 return error_trace(r);
 
-        c_list_link_tail(&name->recv_unindexed, &xmit->batch_link);
+        policy_batch_link_xmit(&name->recv_unindexed, xmit);
         xmit = NULL;
         return 0;
 }
@@ -693,27 +708,18 @@ int policy_snapshot_check_own(PolicySnapshot *snapshot, const char *name_str) {
         return verdict.verdict ? 0 : POLICY_E_ACCESS_DENIED;
 }
 
-static void policy_snapshot_check_xmit_name(PolicyBatch *batch,
-                                            bool is_send,
+static void policy_snapshot_check_xmit_list(CList *list,
                                             PolicyVerdict *verdict,
-                                            const char *name_str,
                                             const char *interface,
                                             const char *member,
                                             const char *path,
                                             unsigned int type) {
-        PolicyBatchName *name;
         PolicyXmit *xmit;
-        CList *list;
-
-        name = policy_batch_find_name(batch, name_str);
-        if (!name)
-                return;
-
-        list = is_send ? &name->send_unindexed : &name->recv_unindexed;
 
         c_list_for_each_entry(xmit, list, batch_link) {
+                /* lists are sorted by priority, nothing below can win */
                 if (verdict->priority >= xmit->verdict.priority)
-                        continue;
+                        break;
 
                 if (xmit->type)
                         if (type != xmit->type)
@@ -735,6 +741,28 @@ static void policy_snapshot_check_xmit_name(PolicyBatch *batch,
         }
 }
 
+static void policy_snapshot_check_xmit_name(PolicyBatch *batch,
+                                            bool is_send,
+                                            PolicyVerdict *verdict,
+                                            const char *name_str,
+                                            const char *interface,
+                                            const char *member,
+                                            const char *path,
+                                            unsigned int type) {
+        PolicyBatchName *name;
+
+        name = policy_batch_find_name(batch, name_str);
+        if (!name)
+                return;
+
+        policy_snapshot_check_xmit_list(is_send ? &name->send_unindexed : &name->recv_unindexed,
+                                        verdict,
+                                        interface,
+                                        member,
+                                        path,
+                                        type);
+}
+
 static void policy_snapshot_check_xmit(PolicyBatch *batch,
                                        bool is_send,
                                        PolicyVerdict *verdict,
@@ -873,3 +901,62 @@ int policy_snapshot_check_receive(PolicySnapshot *snapshot,
 
         return verdict.verdict ? 0 : POLICY_E_ACCESS_DENIED;
 }
+
+/**
+ * policy_snapshot_check_receive_any() - check receive policy for any sender
+ * @snapshot:           snapshot to operate on
+ * @interface:          interface of the message
+ * @method:             member of the message
+ * @path:               path of the message
+ * @type:               type of the message
+ *
+ * This is the same as policy_snapshot_check_receive(), but rather than
+ * checking a specific sender, it checks whether the verdict is the same for
+ * all possible senders. This is the case if no rule that is specific to a
+ * sender name could override the verdict of the catch-all rules.
+ *
+ * Snapshots are immutable, so the result can be cached for as long as the
+ * snapshot is used.
+ *
+ * Return: 0 if messages are received from any sender,
+ *         POLICY_E_ACCESS_DENIED if they are received from no sender,
+ *         POLICY_E_NAME_DEPENDENT if the verdict depends on the names owned
+ *         by the sender.
+ */
+int policy_snapshot_check_receive_any(PolicySnapshot *snapshot,
+                                      const char *interface,
+                                      const char *method,
+                                      const char *path,
+                                      unsigned int type) {
+        PolicyVerdict verdict = POLICY_VERDICT_INIT, named = POLICY_VERDICT_INIT;
+        PolicyBatchName *name;
+        size_t i;
+
+        for (i = 0; i < snapshot->n_batches; ++i) {
+                c_rbtree_for_each_entry(name, &snapshot->batches[i]->name_tree, batch_node) {
+                        if (!*name->name)
+                                policy_snapshot_check_xmit_list(&name->recv_unindexed,
+                                                                &verdict,
+                                                                interface,
+                                                                method,
+                                                                path,
+                                                                type);
+                        else
+                                policy_snapshot_check_xmit_list(&name->recv_unindexed,
+                                                                &named,
+                                                                interface,
+                                                                method,
+                                                                path,
+                                                                type);
+                }
+        }
+
+        /*
+         * Entries with equal priorities are resolved by the order of their
+         * batches, so treat a tie as dependent on the sender, too.
+         */
+        if (named.priority && named.priority >= verdict.priority)
+                return POLICY_E_NAME_DEPENDENT;
+
+        return verdict.verdict ? 0 : POLICY_E_ACCESS_DENIED;
+}
@@ -8,9 +8,9 @@
 #include <c-list.h>
 #include <c-macro.h>
 #include <c-rbtree.h>
-#include <c-ref.h>
 #include <stdlib.h>
 #include "dbus/protocol.h"
+#include "util/ref.h"
 
 typedef struct BusSELinuxID BusSELinuxID;
 typedef struct BusSELinuxRegistry BusSELinuxRegistry;
@@ -28,6 +28,7 @@ enum {
 
         POLICY_E_INVALID,
         POLICY_E_ACCESS_DENIED,
+        POLICY_E_NAME_DEPENDENT,
 };
 
 struct PolicyVerdict {
@@ -72,13 +73,13 @@ struct PolicyBatchName {
         }
 
 struct PolicyBatch {
-        _Atomic unsigned long n_refs;
+        Ref n_refs;
         PolicyVerdict connect_verdict;
         CRBTree name_tree;
 };
 
 #define POLICY_BATCH_NULL(_x) {                                                 \
-                .n_refs = C_REF_INIT,                                           \
+                .n_refs = REF_INIT,                                             \
                 .connect_verdict = POLICY_VERDICT_INIT,                         \
                 .name_tree = C_RBTREE_INIT,                                     \
         }
@@ -118,7 +119,7 @@ struct PolicySnapshot {
 /* batches */
 
 int policy_batch_new(PolicyBatch **batchp);
-void policy_batch_free(_Atomic unsigned long *n_refs, void *userdata);
+void policy_batch_free(Ref *n_refs, void *userdata);
 
 /* registry */
 
@@ -156,6 +157,11 @@ int policy_snapshot_check_receive(PolicySnapshot *snapshot,
                                   const char *method,
                                   const char *path,
                                   unsigned int type);
+int policy_snapshot_check_receive_any(PolicySnapshot *snapshot,
+                                      const char *interface,
+                                      const char *method,
+                                      const char *path,
+                                      unsigned int type);
 
 C_DEFINE_CLEANUP(PolicySnapshot *, policy_snapshot_free);
 
@@ -163,13 +169,13 @@ C_DEFINE_CLEANUP(PolicySnapshot *, policy_snapshot_free);
 
 static inline PolicyBatch *policy_batch_ref(PolicyBatch *batch) {
         if (batch)
-                c_ref_inc(&batch->n_refs);
+                ref_inc(&batch->n_refs);
         return batch;
 }
 
 static inline PolicyBatch *policy_batch_unref(PolicyBatch *batch) {
         if (batch)
-                c_ref_dec(&batch->n_refs, policy_batch_free, NULL);
+                ref_dec(&batch->n_refs, policy_batch_free, NULL);
         return NULL;
 }
 
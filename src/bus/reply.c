@@ -34,7 +34,32 @@ static int reply_slot_compare(CRBTree *tree, void *k, CRBNode *rb) {
         return 0;
 }
 
-int reply_slot_new(ReplySlot **replyp, ReplyRegistry *registry, ReplyOwner *owner, User *user, User *actor, uint64_t id, uint32_t serial) {
+/**
+ * reply_slot_new() - create reply slot
+ * @replyp:             output argument for new reply slot
+ * @registry:           registry to link the slot into
+ * @owner:              owner of the slot, expecting the reply
+ * @user:               user of the peer that is expected to reply
+ * @actor:              user of the peer that expects the reply
+ * @id:                 id of the peer that expects the reply
+ * @serial:             serial of the call
+ * @n_reserve:          number of bytes to reserve for the reply
+ *
+ * This creates a new reply slot and links it into @registry and @owner. The
+ * slot is charged as one object on @user, on behalf of @actor.
+ *
+ * Additionally, @n_reserve bytes are charged on @actor, on behalf of @user.
+ * This reserves room in the output queue of the peer expecting the reply, so
+ * once the slot is released, any reply that fits into the reservation can be
+ * queued without exceeding the quota of @actor. The reservation is accounted
+ * to @user, so a single callee can only ever pin its share of @actor's quota.
+ *
+ * Return: 0 on success, REPLY_E_EXISTS if a slot with the same id and serial
+ *         already exists, REPLY_E_QUOTA if the quota could not be charged,
+ *         negative error code on failure.
+ */
+int reply_slot_new(ReplySlot **replyp, ReplyRegistry *registry, ReplyOwner *owner, User *user, User *actor, uint64_t id, uint32_t serial, unsigned int n_reserve) {
+        UserCharge charge = USER_CHARGE_INIT, reserve = USER_CHARGE_INIT;
         ReplySlot *reply;
         CRBNode **slot, *parent;
         ReplySlotKey key = {
@@ -47,27 +72,35 @@ int reply_slot_new(ReplySlot **replyp, ReplyRegistry *registry, ReplyOwner *owne
         if (!slot)
                 return REPLY_E_EXISTS;
 
-        reply = calloc(1, sizeof(*reply));
-        if (!reply)
+        /* apply the quota before allocating anything */
+        r = user_charge(user, &charge, actor, USER_SLOT_OBJECTS, 1);
+        r = r ?: user_charge(actor, &reserve, user, USER_SLOT_BYTES, n_reserve);
+        if (r) {
+                user_charge_deinit(&reserve);
+                user_charge_deinit(&charge);
+                return (r == USER_E_QUOTA) ? REPLY_E_QUOTA : error_fold(r);
+        }
+
+        reply = malloc(sizeof(*reply));
+        if (!reply) {
+                user_charge_deinit(&reserve);
+                user_charge_deinit(&charge);
                 return error_origin(-ENOMEM);
+        }
 
         reply->registry = registry;
         reply->owner = owner;
-        reply->charge = (UserCharge)USER_CHARGE_INIT;
+        reply->charge = charge;
+        reply->reserve = reserve;
         reply->registry_node = (CRBNode)C_RBNODE_INIT(reply->registry_node);
         reply->owner_link = (CList)C_LIST_INIT(reply->owner_link);
         reply->id = id;
         reply->serial = serial;
 
-        r = user_charge(user, &reply->charge, actor, USER_SLOT_OBJECTS, 1);
-        if (r)
-                return (r == USER_E_QUOTA) ? REPLY_E_QUOTA : error_fold(r);
-
         c_rbtree_add(&registry->reply_tree, parent, slot, &reply->registry_node);
         c_list_link_tail(&owner->reply_list, &reply->owner_link);
 
         *replyp = reply;
-
         return 0;
 }
 
@@ -75,6 +108,7 @@ ReplySlot *reply_slot_free(ReplySlot *slot) {
         if (!slot)
                 return NULL;
 
+        user_charge_deinit(&slot->reserve);
         user_charge_deinit(&slot->charge);
         c_list_unlink(&slot->owner_link);
         c_rbtree_remove_init(&slot->registry->reply_tree, &slot->registry_node);
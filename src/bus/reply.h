@@ -25,6 +25,7 @@ struct ReplySlot {
         ReplyRegistry *registry;
         ReplyOwner *owner;
         UserCharge charge;
+        UserCharge reserve;
         uint64_t id;
         uint32_t serial;
         CRBNode registry_node;
@@ -47,7 +48,7 @@ struct ReplyOwner {
                 .reply_list = C_LIST_INIT((_x).reply_list),     \
         }
 
-int reply_slot_new(ReplySlot **replyp, ReplyRegistry *registry, ReplyOwner *owner, User *user, User *actor, uint64_t id, uint32_t serial);
+int reply_slot_new(ReplySlot **replyp, ReplyRegistry *registry, ReplyOwner *owner, User *user, User *actor, uint64_t id, uint32_t serial, unsigned int n_reserve);
 ReplySlot *reply_slot_free(ReplySlot *slot);
 
 ReplySlot *reply_slot_get_by_id(ReplyRegistry *registry, uint64_t id, uint32_t serial);
@@ -15,9 +15,11 @@ static void test_arg(MatchOwner *owner,
         _c_cleanup_(match_rule_user_unrefp) MatchRule *rule = NULL;
         int r;
 
-        r = match_owner_ref_rule(owner, &rule, NULL, match);
+        r = match_owner_ref_rule(owner, &rule, NULL, NULL, match);
         assert(r == 0);
-        assert(strcmp(rule->keys.filter.args[0], arg0) == 0);
+        assert(rule->keys->n_args == 1);
+        assert(rule->keys->args[0].index == 0);
+        assert(strcmp(rule->keys->args[0].value, arg0) == 0);
 }
 
 static void test_parse_key(MatchOwner *owner) {
@@ -35,12 +37,44 @@ static void test_args(MatchOwner *owner,
         _c_cleanup_(match_rule_user_unrefp) MatchRule *rule = NULL;
         int r;
 
-        r = match_owner_ref_rule(owner,  &rule, NULL, match);
+        r = match_owner_ref_rule(owner, &rule, NULL, NULL, match);
         assert(r == 0);
-        assert(strcmp(rule->keys.filter.args[0], arg0) == 0);
-        assert(strcmp(rule->keys.filter.args[1], arg1) == 0);
-        assert(strcmp(rule->keys.filter.args[2], arg2) == 0);
-        assert(strcmp(rule->keys.filter.args[3], arg3) == 0);
+        assert(rule->keys->n_args == 4);
+        for (size_t i = 0; i < rule->keys->n_args; ++i) {
+                assert(rule->keys->args[i].index == i);
+                assert(!rule->keys->args[i].path);
+        }
+        assert(strcmp(rule->keys->args[0].value, arg0) == 0);
+        assert(strcmp(rule->keys->args[1].value, arg1) == 0);
+        assert(strcmp(rule->keys->args[2].value, arg2) == 0);
+        assert(strcmp(rule->keys->args[3].value, arg3) == 0);
+}
+
+static void test_sparse_args(MatchOwner *owner) {
+        _c_cleanup_(match_rule_user_unrefp) MatchRule *rule = NULL, *rule1 = NULL, *rule2 = NULL;
+        int r;
+
+        /* only the given keys are stored, sorted by their index */
+        r = match_owner_ref_rule(owner, &rule, NULL, NULL, "arg63path=/foo,arg7=bar,interface=com.example.arg,arg2=foo");
+        assert(r == 0);
+        assert(rule->keys->n_args == 3);
+        assert(rule->keys->args[0].index == 2);
+        assert(!rule->keys->args[0].path);
+        assert(strcmp(rule->keys->args[0].value, "foo") == 0);
+        assert(rule->keys->args[1].index == 7);
+        assert(!rule->keys->args[1].path);
+        assert(strcmp(rule->keys->args[1].value, "bar") == 0);
+        assert(rule->keys->args[2].index == 63);
+        assert(rule->keys->args[2].path);
+        assert(strcmp(rule->keys->args[2].value, "/foo") == 0);
+        assert(strcmp(rule->keys->filter.interface, "com.example.arg") == 0);
+
+        /* the order of the keys is irrelevant for rule identity */
+        r = match_owner_ref_rule(owner, &rule1, NULL, NULL, "arg1=foo,arg2path=/bar");
+        assert(r == 0);
+        r = match_owner_ref_rule(owner, &rule2, NULL, NULL, "arg2path=/bar,arg1=foo");
+        assert(r == 0);
+        assert(rule1 == rule2);
 }
 
 static void test_parse_value(MatchOwner *owner) {
@@ -63,7 +97,7 @@ static bool test_validity(MatchOwner *owner, const char *match) {
         _c_cleanup_(match_rule_user_unrefp) MatchRule *rule = NULL;
         int r;
 
-        r = match_owner_ref_rule(owner, &rule, NULL, match);
+        r = match_owner_ref_rule(owner, &rule, NULL, NULL, match);
         assert(r == 0 || r == MATCH_E_INVALID);
 
         return !r;
@@ -109,9 +143,14 @@ static void test_validate_keys(MatchOwner *owner) {
         assert(!test_validity(owner, "arg64path=foo"));
         assert(!test_validity(owner, "arg0path=foo,arg0path=foo"));
         assert(!test_validity(owner, "arg0path=foo,arg0namespace=foo")); /* cannot be mixed */
+        assert(test_validity(owner, "coalesce=true"));
+        assert(test_validity(owner, "coalesce=false"));
+        assert(!test_validity(owner, "coalesce=yes"));
         assert(test_validity(owner, "arg0namespace=foo"));
         assert(!test_validity(owner, "arg1namespace=foo"));
         assert(!test_validity(owner, "arg0namespace=foo,arg0namespace=foo"));
+        assert(!test_validity(owner, "arg1=foo,arg0namespace=bar,arg0path=foo"));
+        assert(!test_validity(owner, "arg3=foo,arg1=bar,arg3path=foo"));
 }
 
 static bool test_match(const char *match_string, MatchFilter *filter) {
@@ -123,7 +162,7 @@ static bool test_match(const char *match_string, MatchFilter *filter) {
         match_registry_init(&registry);
         match_owner_init(&owner);
 
-        r = match_owner_ref_rule(&owner, &rule, NULL, match_string);
+        r = match_owner_ref_rule(&owner, &rule, NULL, NULL, match_string);
         assert(!r);
 
         match_rule_link(rule, &registry, false);
@@ -239,6 +278,18 @@ static void test_individual_matches(void) {
         assert(test_match("arg0namespace=com.example.foo.bar", &filter));
         assert(!test_match("arg0namespace=com.example.foobar", &filter));
         assert(!test_match("arg0namespace=com.example", &filter));
+
+        /* sparse args */
+        filter = (MatchFilter)MATCH_FILTER_INIT;
+        filter.args[1] = "foo";
+        filter.args[63] = "bar";
+        filter.argpaths[5] = "/com/example/";
+        assert(test_match("arg1=foo", &filter));
+        assert(test_match("arg63=bar,arg1=foo", &filter));
+        assert(test_match("arg5path=/com/example/foo,arg63=bar", &filter));
+        assert(!test_match("arg5path=/com/example/foo,arg62=bar", &filter));
+        assert(!test_match("arg1=foo,arg2=foo", &filter));
+        assert(!test_match("arg0=foo", &filter));
 }
 
 static void test_iterator(void) {
@@ -251,22 +302,22 @@ static void test_iterator(void) {
         match_owner_init(&owner1);
         match_owner_init(&owner2);
 
-        r = match_owner_ref_rule(&owner1, &rule1, NULL, "");
+        r = match_owner_ref_rule(&owner1, &rule1, NULL, NULL, "");
         assert(!r);
 
         match_rule_link(rule1, &registry, false);
 
-        r = match_owner_ref_rule(&owner1, &rule2, NULL, "");
+        r = match_owner_ref_rule(&owner1, &rule2, NULL, NULL, "");
         assert(!r);
 
         match_rule_link(rule2, &registry, false);
 
-        r = match_owner_ref_rule(&owner2, &rule3, NULL, "");
+        r = match_owner_ref_rule(&owner2, &rule3, NULL, NULL, "");
         assert(!r);
 
         match_rule_link(rule3, &registry, false);
 
-        r = match_owner_ref_rule(&owner2, &rule4, NULL, "");
+        r = match_owner_ref_rule(&owner2, &rule4, NULL, NULL, "");
         assert(!r);
 
         match_rule_link(rule4, &registry, false);
@@ -290,18 +341,157 @@ static void test_iterator(void) {
 
 }
 
+static void test_cache(void) {
+        MatchCache cache;
+        MatchOwner owner1, owner2;
+        MatchRule *rule1, *rule2, *rule3, *rule;
+        int r;
+
+        match_cache_init(&cache);
+        match_owner_init(&owner1);
+        match_owner_init(&owner2);
+
+        /* identical rule strings share their keys across owners */
+        r = match_owner_ref_rule(&owner1, &rule1, &cache, NULL, "type=signal,arg0=foo");
+        assert(!r);
+        r = match_owner_ref_rule(&owner2, &rule2, &cache, NULL, "type=signal,arg0=foo");
+        assert(!r);
+        assert(rule1 != rule2);
+        assert(rule1->keys == rule2->keys);
+        assert(match_cache_find_keys(&cache, "type=signal,arg0=foo") == rule1->keys);
+
+        /* equivalent, but different, strings get their own keys */
+        r = match_owner_ref_rule(&owner1, &rule3, &cache, NULL, "arg0=foo,type=signal");
+        assert(!r);
+        assert(rule3 == rule1);
+        match_rule_user_unref(rule3);
+        assert(!match_cache_find_keys(&cache, "arg0=foo,type=signal"));
+
+        /* invalid rules are never cached */
+        r = match_owner_ref_rule(&owner1, &rule3, &cache, NULL, "foo=bar");
+        assert(r == MATCH_E_INVALID);
+        assert(!match_cache_find_keys(&cache, "foo=bar"));
+
+        /* lookups work both with cached and uncached strings */
+        r = match_owner_find_rule(&owner1, &rule, &cache, "type=signal,arg0=foo");
+        assert(!r && rule == rule1);
+        r = match_owner_find_rule(&owner1, &rule, &cache, "arg0=foo, type=signal");
+        assert(!r && rule == rule1);
+        r = match_owner_find_rule(&owner1, &rule, &cache, "type=signal");
+        assert(!r && !rule);
+
+        /* the cache entry goes away with its last user */
+        match_rule_user_unref(rule1);
+        assert(match_cache_find_keys(&cache, "type=signal,arg0=foo") == rule2->keys);
+        match_rule_user_unref(rule2);
+        assert(!match_cache_find_keys(&cache, "type=signal,arg0=foo"));
+
+        match_owner_deinit(&owner2);
+        match_owner_deinit(&owner1);
+        match_cache_deinit(&cache);
+}
+
+static unsigned int test_cost_one(const char *match) {
+        _c_cleanup_(match_rule_user_unrefp) MatchRule *rule = NULL;
+        MatchOwner owner;
+        unsigned int cost;
+        int r;
+
+        match_owner_init(&owner);
+
+        r = match_owner_ref_rule(&owner, &rule, NULL, NULL, match);
+        assert(!r);
+
+        cost = match_keys_get_cost(rule->keys);
+
+        rule = match_rule_user_unref(rule);
+        match_owner_deinit(&owner);
+        return cost;
+}
+
+static void test_cost(void) {
+        _c_cleanup_(user_registry_deinit) UserRegistry registry = USER_REGISTRY_NULL;
+        _c_cleanup_(user_unrefp) User *user = NULL;
+        unsigned int maxima[_USER_SLOT_N] = {};
+        static const char *complex =
+                "type=signal,arg0=a,arg1=b,arg2=c,arg3=d,arg4=e,arg5=f,arg6=g,"
+                "arg7=h,arg8=i,arg9=j,arg10=k,arg11=l,arg12=m,arg13=n,arg14=o,"
+                "arg15=p,arg16=q,arg17=r,arg18=s,arg19=t";
+        MatchRule *rules[8];
+        MatchOwner owner;
+        char match[64];
+        size_t i;
+        int r;
+
+        /* common rules cost a single unit */
+        assert(test_cost_one("") == 1);
+        assert(test_cost_one("type=signal") == 1);
+        assert(test_cost_one("type=signal,sender=org.example,interface=org.example.Foo,member=Bar,path=/org/example") == 1);
+        assert(test_cost_one("type=signal,arg0=foo,arg1=bar,arg2=baz") == 1);
+
+        /* argument-heavy rules are charged by the number of comparisons */
+        assert(test_cost_one("arg0=a,arg1=b,arg2=c,arg3=d") == 2);
+        assert(test_cost_one("arg0path=/a,arg1path=/b") == 2);
+        assert(test_cost_one("path_namespace=/a,arg0namespace=a,arg1=b,arg2=c") == 2);
+        assert(test_cost_one(complex) == 6);
+
+        /*
+         * A user with a quota of 8 can install 8 simple rules, but only a
+         * single one of the complex rules.
+         */
+        maxima[USER_SLOT_BYTES] = 1024 * 1024;
+        maxima[USER_SLOT_MATCHES] = 8;
+        r = user_registry_init(&registry, _USER_SLOT_N, maxima);
+        assert(!r);
+
+        r = user_registry_ref_user(&registry, &user, 1);
+        assert(!r);
+
+        match_owner_init(&owner);
+
+        for (i = 0; i < C_ARRAY_SIZE(rules); ++i) {
+                sprintf(match, "type=signal,arg0=%zu", i);
+                r = match_owner_ref_rule(&owner, &rules[i], NULL, user, match);
+                assert(!r);
+        }
+
+        r = match_owner_ref_rule(&owner, &rules[0], NULL, user, "type=signal,arg0=foo");
+        assert(r == MATCH_E_QUOTA);
+
+        for (i = 0; i < C_ARRAY_SIZE(rules); ++i)
+                match_rule_user_unref(rules[i]);
+
+        r = match_owner_ref_rule(&owner, &rules[0], NULL, user, complex);
+        assert(!r);
+
+        r = match_owner_ref_rule(&owner, &rules[1], NULL, user, "type=signal,arg0=x,arg1=x,arg2=x,arg3=x");
+        assert(!r);
+
+        r = match_owner_ref_rule(&owner, &rules[2], NULL, user, "type=signal,arg0=y,arg1=y,arg2=y,arg3=y");
+        assert(r == MATCH_E_QUOTA);
+
+        match_rule_user_unref(rules[1]);
+        match_rule_user_unref(rules[0]);
+        assert(user->slots[USER_SLOT_MATCHES].n == 8);
+
+        match_owner_deinit(&owner);
+}
+
 int main(int argc, char **argv) {
         MatchOwner owner = {};
 
         test_splitting(&owner);
         test_parse_key(&owner);
         test_parse_value(&owner);
+        test_sparse_args(&owner);
         test_wildcard(&owner);
         test_validate_keys(&owner);
 
         test_individual_matches();
 
         test_iterator();
+        test_cache();
+        test_cost();
 
         match_owner_deinit(&owner);
         return 0;
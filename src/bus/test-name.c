@@ -219,9 +219,89 @@ static void test_queue(void) {
         name_registry_deinit(&registry);
 }
 
+static void test_scale(void) {
+        static const size_t n_owners = 8192;
+        NameRegistry registry;
+        NameOwner *owners, *o;
+        NameChange change;
+        Name *name;
+        size_t i;
+        int r;
+
+        owners = calloc(n_owners, sizeof(*owners));
+        assert(owners);
+
+        name_registry_init(&registry);
+        name_change_init(&change);
+        for (i = 0; i < n_owners; ++i)
+                name_owner_init(&owners[i]);
+
+        /* queue all owners, and verify the queue length is tracked */
+        for (i = 0; i < n_owners; ++i) {
+                r = name_registry_request_name(&registry, &owners[i], NULL, "foobar", DBUS_NAME_FLAG_ALLOW_REPLACEMENT, &change);
+                assert(r == (i ? NAME_E_IN_QUEUE : 0));
+                name_change_deinit(&change);
+        }
+
+        name = name_registry_find_name(&registry, "foobar");
+        assert(name);
+        assert(name->n_ownerships == n_owners);
+
+        /* let the tail of the queue overtake the primary owner, repeatedly */
+        for (i = n_owners - 1; i > n_owners / 2; --i) {
+                r = name_registry_request_name(&registry, &owners[i], NULL, "foobar",
+                                               DBUS_NAME_FLAG_ALLOW_REPLACEMENT | DBUS_NAME_FLAG_REPLACE_EXISTING,
+                                               &change);
+                assert(!r);
+                assert(change.new_owner == &owners[i]);
+                name_change_deinit(&change);
+
+                o = resolve_owner(&registry, "foobar");
+                assert(o == &owners[i]);
+                assert(name->n_ownerships == n_owners);
+        }
+
+        /* replacing the primary owner moves a queued owner to the front */
+        r = name_registry_request_name(&registry, &owners[0], NULL, "foobar",
+                                       DBUS_NAME_FLAG_REPLACE_EXISTING | DBUS_NAME_FLAG_DO_NOT_QUEUE,
+                                       &change);
+        assert(!r);
+        name_change_deinit(&change);
+        assert(name->n_ownerships == n_owners);
+
+        r = name_registry_request_name(&registry, &owners[1], NULL, "foobar",
+                                       DBUS_NAME_FLAG_REPLACE_EXISTING,
+                                       &change);
+        assert(r == NAME_E_IN_QUEUE);
+        assert(name->n_ownerships == n_owners);
+
+        /* release every other owner, then the rest */
+        for (i = 0; i < n_owners; i += 2) {
+                r = name_registry_release_name(&registry, &owners[i], "foobar", &change);
+                assert(!r);
+                name_change_deinit(&change);
+        }
+        assert(name->n_ownerships == n_owners / 2);
+
+        name_ref(name);
+        for (i = 1; i < n_owners; i += 2) {
+                r = name_registry_release_name(&registry, &owners[i], "foobar", &change);
+                assert(!r);
+                name_change_deinit(&change);
+                assert(name->n_ownerships == (n_owners - i - 1) / 2);
+        }
+        name_unref(name);
+
+        for (i = 0; i < n_owners; ++i)
+                name_owner_deinit(&owners[i]);
+        name_registry_deinit(&registry);
+        free(owners);
+}
+
 int main(int argc, char **argv) {
         test_setup();
         test_release();
         test_queue();
+        test_scale();
         return 0;
 }
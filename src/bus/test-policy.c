@@ -0,0 +1,193 @@
+/*
+ * Test Policy
+ */
+
+#include <c-dvar.h>
+#include <c-macro.h>
+#include <stdlib.h>
+#include "bus/policy.h"
+#include "dbus/protocol.h"
+
+typedef struct TestXmit {
+        bool verdict;
+        uint64_t priority;
+        const char *name;
+        const char *interface;
+} TestXmit;
+
+#define TEST_POLICY_T_BATCH                                                     \
+                "bt"                                                            \
+                "a(btbs)"                                                       \
+                "a(btssssub)"                                                   \
+                "a(btssssub)"
+
+#define TEST_POLICY_T                                                           \
+                "("                                                             \
+                "(" TEST_POLICY_T_BATCH ")"                                     \
+                "a(u(" TEST_POLICY_T_BATCH "))"                                 \
+                "a(u(" TEST_POLICY_T_BATCH "))"                                 \
+                "a(ss)"                                                         \
+                ")"
+
+/*
+ * Create a snapshot of a registry with a default batch holding the given
+ * receive records, in the order given. All records apply to signals on
+ * "/org/example" with member "Foo".
+ */
+static PolicySnapshot *test_new_snapshot(const TestXmit *recv, size_t n_recv) {
+        _c_cleanup_(c_dvar_deinit) CDVar w = C_DVAR_INIT, v = C_DVAR_INIT;
+        _c_cleanup_(policy_registry_freep) PolicyRegistry *registry = NULL;
+        _c_cleanup_(c_freep) void *data = NULL;
+        CDVarType type[sizeof(TEST_POLICY_T)], *t = type;
+        PolicySnapshot *snapshot;
+        size_t n_data;
+        int r;
+
+        r = c_dvar_type_new_from_signature(&t, TEST_POLICY_T, strlen(TEST_POLICY_T));
+        assert(!r);
+
+        c_dvar_begin_write(&w, c_dvar_type_v, 1);
+        c_dvar_write(&w, "<((bt[][][", type, true, 1);
+
+        for (size_t i = 0; i < n_recv; ++i)
+                c_dvar_write(&w, "(btssssub)",
+                             recv[i].verdict,
+                             recv[i].priority,
+                             recv[i].name,
+                             "/org/example",
+                             recv[i].interface,
+                             "Foo",
+                             DBUS_MESSAGE_TYPE_SIGNAL,
+                             false);
+
+        c_dvar_write(&w, "])[][][])>");
+
+        r = c_dvar_end_write(&w, &data, &n_data);
+        assert(!r);
+
+        r = policy_registry_new(&registry, NULL);
+        assert(!r);
+
+        c_dvar_begin_read(&v, c_dvar_is_big_endian(&w), c_dvar_type_v, 1, data, n_data);
+
+        r = policy_registry_import(registry, &v);
+        assert(!r);
+
+        r = c_dvar_end_read(&v);
+        assert(!r);
+
+        r = policy_snapshot_new(&snapshot, registry, NULL, 0, NULL, 0);
+        assert(!r);
+
+        return snapshot;
+}
+
+static int test_check_receive_any(const TestXmit *recv, size_t n_recv, const char *interface) {
+        _c_cleanup_(policy_snapshot_freep) PolicySnapshot *snapshot = NULL;
+
+        snapshot = test_new_snapshot(recv, n_recv);
+
+        return policy_snapshot_check_receive_any(snapshot,
+                                                 interface,
+                                                 "Foo",
+                                                 "/org/example",
+                                                 DBUS_MESSAGE_TYPE_SIGNAL);
+}
+
+static void test_receive_any_catch_all(void) {
+        int r;
+
+        /* without any records, nothing is received */
+        {
+                r = test_check_receive_any(NULL, 0, "org.example");
+                assert(r == POLICY_E_ACCESS_DENIED);
+        }
+
+        /* a catch-all allow applies to every sender */
+        {
+                const TestXmit recv[] = {
+                        { true, 1, "", "org.example" },
+                };
+
+                r = test_check_receive_any(recv, C_ARRAY_SIZE(recv), "org.example");
+                assert(!r);
+
+                r = test_check_receive_any(recv, C_ARRAY_SIZE(recv), "org.example.other");
+                assert(r == POLICY_E_ACCESS_DENIED);
+        }
+
+        /* a catch-all deny overrides a lower catch-all allow for every sender */
+        {
+                const TestXmit recv[] = {
+                        { false, 2, "", "org.example" },
+                        { true, 1, "", "" },
+                };
+
+                r = test_check_receive_any(recv, C_ARRAY_SIZE(recv), "org.example");
+                assert(r == POLICY_E_ACCESS_DENIED);
+
+                r = test_check_receive_any(recv, C_ARRAY_SIZE(recv), "org.example.other");
+                assert(!r);
+        }
+
+        /* records are sorted on import, regardless of the order they come in */
+        {
+                const TestXmit recv[] = {
+                        { true, 1, "", "" },
+                        { false, 2, "", "org.example" },
+                };
+
+                r = test_check_receive_any(recv, C_ARRAY_SIZE(recv), "org.example");
+                assert(r == POLICY_E_ACCESS_DENIED);
+
+                r = test_check_receive_any(recv, C_ARRAY_SIZE(recv), "org.example.other");
+                assert(!r);
+        }
+}
+
+static void test_receive_any_sender(void) {
+        int r;
+
+        /* a sender-specific rule above the catch-all depends on the sender */
+        {
+                const TestXmit recv[] = {
+                        { false, 2, "com.example.foo", "org.example" },
+                        { true, 1, "", "" },
+                };
+
+                r = test_check_receive_any(recv, C_ARRAY_SIZE(recv), "org.example");
+                assert(r == POLICY_E_NAME_DEPENDENT);
+
+                /* ...unless it does not apply to the message at all */
+                r = test_check_receive_any(recv, C_ARRAY_SIZE(recv), "org.example.other");
+                assert(!r);
+        }
+
+        /* a sender-specific rule below the catch-all can never win */
+        {
+                const TestXmit recv[] = {
+                        { true, 2, "", "" },
+                        { false, 1, "com.example.foo", "org.example" },
+                };
+
+                r = test_check_receive_any(recv, C_ARRAY_SIZE(recv), "org.example");
+                assert(!r);
+        }
+
+        /* on equal priority, a sender-specific rule depends on the sender */
+        {
+                const TestXmit recv[] = {
+                        { true, 1, "", "org.example" },
+                        { false, 1, "com.example.foo", "org.example" },
+                };
+
+                r = test_check_receive_any(recv, C_ARRAY_SIZE(recv), "org.example");
+                assert(r == POLICY_E_NAME_DEPENDENT);
+        }
+}
+
+int main(int argc, char **argv) {
+        test_receive_any_catch_all();
+        test_receive_any_sender();
+        return 0;
+}
@@ -7,6 +7,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include "bus/reply.h"
+#include "util/user.h"
 
 static void test_basic(void) {
         ReplyRegistry registry;
@@ -17,10 +18,10 @@ static void test_basic(void) {
         reply_registry_init(&registry);
         reply_owner_init(&owner);
 
-        r = reply_slot_new(&slot1, &registry, &owner, NULL, NULL, 1, 1);
+        r = reply_slot_new(&slot1, &registry, &owner, NULL, NULL, 1, 1, 0);
         assert(!r);
 
-        r = reply_slot_new(&slot1, &registry, &owner, NULL, NULL, 1, 1);
+        r = reply_slot_new(&slot1, &registry, &owner, NULL, NULL, 1, 1, 0);
         assert(r == REPLY_E_EXISTS);
 
         slot2 = reply_slot_get_by_id(&registry, 1, 1);
@@ -37,8 +38,62 @@ static void test_basic(void) {
         reply_registry_deinit(&registry);
 }
 
+static void test_reserve(void) {
+        UserRegistry users;
+        ReplyRegistry registry;
+        ReplyOwner owner;
+        User *callee, *caller;
+        ReplySlot *slot1, *slot2, *slot3;
+        int r;
+
+        r = user_registry_init(&users, _USER_SLOT_N, (unsigned int[]){ 4096, 1024, 1024, 1024 });
+        assert(!r);
+
+        r = user_registry_ref_user(&users, &callee, 1);
+        assert(!r);
+
+        r = user_registry_ref_user(&users, &caller, 2);
+        assert(!r);
+
+        reply_registry_init(&registry);
+        reply_owner_init(&owner);
+
+        /* the reservation is charged on the caller, on behalf of the callee */
+        r = reply_slot_new(&slot1, &registry, &owner, callee, caller, 1, 1, 1024);
+        assert(!r);
+        assert(caller->slots[USER_SLOT_BYTES].n == 3072);
+        assert(callee->slots[USER_SLOT_BYTES].n == 4096);
+        assert(callee->slots[USER_SLOT_OBJECTS].n == 1023);
+
+        r = reply_slot_new(&slot2, &registry, &owner, callee, caller, 1, 2, 1024);
+        assert(!r);
+        assert(caller->slots[USER_SLOT_BYTES].n == 2048);
+
+        /* a single callee cannot pin more than its share of the caller */
+        r = reply_slot_new(&slot3, &registry, &owner, callee, caller, 1, 3, 1024);
+        assert(r == REPLY_E_QUOTA);
+        assert(caller->slots[USER_SLOT_BYTES].n == 2048);
+        assert(callee->slots[USER_SLOT_OBJECTS].n == 1022);
+        assert(!reply_slot_get_by_id(&registry, 1, 3));
+
+        /* releasing the slot releases the reservation */
+        reply_slot_free(slot2);
+        assert(caller->slots[USER_SLOT_BYTES].n == 3072);
+
+        reply_slot_free(slot1);
+        assert(caller->slots[USER_SLOT_BYTES].n == 4096);
+        assert(callee->slots[USER_SLOT_OBJECTS].n == 1024);
+
+        reply_owner_deinit(&owner);
+        reply_registry_deinit(&registry);
+        user_unref(caller);
+        user_unref(callee);
+        user_registry_deinit(&users);
+}
+
 int main(int argc, char **argv) {
         test_basic();
+        test_reserve();
 
         return 0;
 }
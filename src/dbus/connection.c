@@ -258,3 +258,21 @@ int connection_queue(Connection *connection, User *user, Message *message) {
         dispatch_file_select(&connection->socket_file, EPOLLOUT);
         return 0;
 }
+
+/**
+ * connection_queue_coalesce() - XXX
+ */
+int connection_queue_coalesce(Connection *connection, User *user, Message *message) {
+        int r;
+
+        r = socket_queue_coalesce(&connection->socket, user, message);
+        if (r == SOCKET_E_QUOTA)
+                return CONNECTION_E_QUOTA;
+        else if (r == SOCKET_E_SHUTDOWN)
+                return 0;
+        else if (r)
+                return error_fold(r);
+
+        dispatch_file_select(&connection->socket_file, EPOLLOUT);
+        return 0;
+}
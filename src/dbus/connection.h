@@ -23,13 +23,13 @@ enum {
 };
 
 struct Connection {
-        Socket socket;
+        bool server : 1;
+        bool authenticated : 1;
+
         DispatchFile socket_file;
+        Socket socket;
         SASLServer sasl_server;
         SASLClient sasl_client;
-
-        bool server : 1;
-        bool authenticated : 1;
 };
 
 #define CONNECTION_NULL(_x) {                                           \
@@ -59,6 +59,7 @@ int connection_dispatch(Connection *connection, uint32_t events);
 
 int connection_dequeue(Connection *connection, Message **messagep);
 int connection_queue(Connection *connection, User *user, Message *message);
+int connection_queue_coalesce(Connection *connection, User *user, Message *message);
 
 C_DEFINE_CLEANUP(Connection *, connection_deinit);
 
@@ -67,3 +68,7 @@ C_DEFINE_CLEANUP(Connection *, connection_deinit);
 static inline bool connection_is_running(Connection *connection) {
         return socket_is_running(&connection->socket);
 }
+
+static inline bool connection_has_output(Connection *connection) {
+        return socket_has_output(&connection->socket);
+}
@@ -5,11 +5,11 @@
 #include <c-dvar.h>
 #include <c-dvar-type.h>
 #include <c-macro.h>
-#include <c-ref.h>
 #include <endian.h>
 #include <stdlib.h>
 #include "dbus/message.h"
 #include "dbus/protocol.h"
+#include "util/ref.h"
 #include "util/fdlist.h"
 #include "util/error.h"
 
@@ -22,7 +22,7 @@ static int message_new(Message **messagep, bool big_endian, size_t n_extra) {
         if (!message)
                 return error_origin(-ENOMEM);
 
-        message->n_refs = C_REF_INIT;
+        message->n_refs = REF_INIT;
         message->big_endian = big_endian;
         message->allocated_data = false;
         message->parsed = false;
@@ -130,7 +130,7 @@ int message_new_outgoing(Message **messagep, void *data, size_t n_data) {
 }
 
 /* internal callback for message_unref() */
-void message_free(_Atomic unsigned long *n_refs, void *userdata) {
+void message_free(Ref *n_refs, void *userdata) {
         Message *message = c_container_of(n_refs, Message, n_refs);
 
         if (message->allocated_data)
@@ -340,6 +340,130 @@ static int message_parse_header(Message *message, MessageMetadata *metadata) {
         return 0;
 }
 
+static uint64_t message_cache_hash(const uint8_t *data, size_t n_data) {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        size_t i;
+
+        /*
+         * Hash the header, but skip the body-length and serial. Those two
+         * differ between otherwise identical messages, and neither affects the
+         * validity of the header.
+         */
+        for (i = 0; i < n_data; ++i) {
+                if (i == offsetof(MessageHeader, n_body))
+                        i = offsetof(MessageHeader, n_fields);
+
+                hash ^= data[i];
+                hash *= 0x100000001b3ULL;
+        }
+
+        return hash;
+}
+
+static bool message_cache_equal(MessageCacheEntry *entry, const uint8_t *data, size_t n_data, uint64_t hash) {
+        return entry->hash == hash &&
+               entry->n_header == n_data &&
+               !memcmp(entry->data, data, offsetof(MessageHeader, n_body)) &&
+               !memcmp(entry->data + offsetof(MessageHeader, n_fields),
+                       data + offsetof(MessageHeader, n_fields),
+                       n_data - offsetof(MessageHeader, n_fields));
+}
+
+static uint32_t message_cache_offset(Message *message, const char *field) {
+        return field ? (uint32_t)(field - (const char *)message->header) : 0;
+}
+
+static const char *message_cache_pointer(Message *message, uint32_t offset) {
+        return offset ? (const char *)message->header + offset : NULL;
+}
+
+static void message_cache_store(MessageCacheEntry *entry, Message *message, MessageMetadata *metadata, uint64_t hash) {
+        entry->hash = hash;
+        entry->n_header = message->n_header;
+        memcpy(entry->data, message->header, message->n_header);
+
+        entry->header.type = metadata->header.type;
+        entry->header.flags = metadata->header.flags;
+        entry->header.version = metadata->header.version;
+
+        entry->fields.available = metadata->fields.available;
+        entry->fields.path = message_cache_offset(message, metadata->fields.path);
+        entry->fields.interface = message_cache_offset(message, metadata->fields.interface);
+        entry->fields.member = message_cache_offset(message, metadata->fields.member);
+        entry->fields.error_name = message_cache_offset(message, metadata->fields.error_name);
+        entry->fields.reply_serial = metadata->fields.reply_serial;
+        entry->fields.destination = message_cache_offset(message, metadata->fields.destination);
+        entry->fields.sender = message_cache_offset(message, metadata->fields.sender);
+        entry->fields.unix_fds = metadata->fields.unix_fds;
+
+        /* a missing signature is fixed up to a static "", see the parser */
+        if (metadata->fields.available & (1U << DBUS_MESSAGE_FIELD_SIGNATURE))
+                entry->fields.signature = message_cache_offset(message, metadata->fields.signature);
+        else
+                entry->fields.signature = 0;
+}
+
+static int message_cache_load(MessageCacheEntry *entry, Message *message, MessageMetadata *metadata) {
+        /*
+         * The header bytes are identical to a header we validated before,
+         * except for the body-length and serial. Hence, we only need to check
+         * the serial, and all properties that depend on more than the header
+         * itself (that is, the number of passed FDs).
+         */
+
+        metadata->header.type = entry->header.type;
+        metadata->header.flags = entry->header.flags;
+        metadata->header.version = entry->header.version;
+
+        if (_c_likely_(!message->big_endian))
+                metadata->header.serial = le32toh(message->header->serial);
+        else
+                metadata->header.serial = be32toh(message->header->serial);
+
+        if (!metadata->header.serial)
+                return MESSAGE_E_INVALID_HEADER;
+
+        if (entry->fields.unix_fds > fdlist_count(message->fds))
+                return MESSAGE_E_INVALID_HEADER;
+
+        metadata->fields.available = entry->fields.available;
+        metadata->fields.path = message_cache_pointer(message, entry->fields.path);
+        metadata->fields.interface = message_cache_pointer(message, entry->fields.interface);
+        metadata->fields.member = message_cache_pointer(message, entry->fields.member);
+        metadata->fields.error_name = message_cache_pointer(message, entry->fields.error_name);
+        metadata->fields.reply_serial = entry->fields.reply_serial;
+        metadata->fields.destination = message_cache_pointer(message, entry->fields.destination);
+        metadata->fields.sender = message_cache_pointer(message, entry->fields.sender);
+        metadata->fields.signature = message_cache_pointer(message, entry->fields.signature) ?: "";
+        metadata->fields.unix_fds = entry->fields.unix_fds;
+
+        message->original_sender = (void *)metadata->fields.sender;
+
+        return 0;
+}
+
+static int message_parse_header_cached(Message *message, MessageMetadata *metadata, MessageCache *cache) {
+        MessageCacheEntry *entry;
+        uint64_t hash;
+        int r;
+
+        if (!cache || message->n_header > MESSAGE_CACHE_HEADER_MAX)
+                return message_parse_header(message, metadata);
+
+        hash = message_cache_hash((const uint8_t *)message->header, message->n_header);
+        entry = &cache->entries[hash % C_ARRAY_SIZE(cache->entries)];
+
+        if (message_cache_equal(entry, (const uint8_t *)message->header, message->n_header, hash))
+                return message_cache_load(entry, message, metadata);
+
+        r = message_parse_header(message, metadata);
+        if (r)
+                return r;
+
+        message_cache_store(entry, message, metadata, hash);
+        return 0;
+}
+
 static int message_parse_body(Message *message, MessageMetadata *metadata) {
         _c_cleanup_(c_dvar_deinit) CDVar v = C_DVAR_INIT;
         const char *signature = metadata->fields.signature;
@@ -400,8 +524,14 @@ static int message_parse_body(Message *message, MessageMetadata *metadata) {
 
 /**
  * message_parse_metadata() - XXX
+ * @message:                    message to operate on
+ * @cache:                      header cache to use, or NULL
+ *
+ * If @cache is given, headers that are bitwise identical to a previously
+ * validated header (ignoring body-length and serial) skip field validation,
+ * and take the field layout from the cache instead.
  */
-int message_parse_metadata(Message *message) {
+int message_parse_metadata(Message *message, MessageCache *cache) {
         void *p;
         int r;
 
@@ -411,7 +541,7 @@ int message_parse_metadata(Message *message) {
          * As first step, parse the static header and the dynamic header
          * fields. Any error there is fatal.
          */
-        r = message_parse_header(message, &message->metadata);
+        r = message_parse_header_cached(message, &message->metadata, cache);
         if (r)
                 return error_trace(r);
 
@@ -450,9 +580,69 @@ int message_parse_metadata(Message *message) {
 }
 
 /**
- * message_stitch_sender() - stitch in new sender field
+ * message_sender_init() - prepare sender field
+ * @sender:                     sender to initialize
+ * @id:                         sender id
+ *
+ * This pre-renders the `(yv)' sender field for the unique name of @id, in
+ * both byte-orders and including its trailing padding, so it can be stitched
+ * into any number of messages via message_stitch_sender_prepared() without
+ * formatting the unique name again for each of them.
+ */
+void message_sender_init(MessageSender *sender, uint64_t id) {
+        const char *name;
+        size_t n_name;
+
+        /*
+         * Convert the sender id to a unique name. This should never fail on
+         * a valid sender id.
+         */
+        name = address_to_string(&(Address)ADDRESS_INIT_ID(id));
+
+        /*
+         * Calculate string and field lengths. A string-field needs
+         * `1 + 3 + 4 + n + 1' bytes:
+         *
+         *     - length of 'y':                 1
+         *     - length of 'v':                 3 + 4 + n + 1
+         *       - type 'g' needs:
+         *         - size field byte:           1
+         *         - type string 's':           1
+         *         - zero termination:          1
+         *       - sender string needs:
+         *         - alignment to 4:            0
+         *         - size field int:            4
+         *         - sender string:             n
+         *         - zero termination:          1
+         *
+         * The patch buffer is pre-allocated. Verify its size is sufficient to
+         * hold the stitched sender.
+         */
+        n_name = strlen(name);
+        assert(n_name <= ADDRESS_ID_STRING_MAX);
+        static_assert(1 + 3 + 4 + ADDRESS_ID_STRING_MAX + 1 <= MESSAGE_PATCH_MAX,
+                      "Message patch buffer has insufficient size");
+
+        *sender = (MessageSender)MESSAGE_SENDER_INIT;
+        sender->id = id;
+        sender->n_field = 1 + 3 + 4 + n_name + 1;
+
+        /* fill in `(yv)' with sender and padding */
+        sender->field_le[0] = DBUS_MESSAGE_FIELD_SENDER;
+        sender->field_le[1] = 1;
+        sender->field_le[2] = 's';
+        sender->field_le[3] = 0;
+        memcpy(sender->field_le + 8, name, n_name + 1);
+        memcpy(sender->field_be, sender->field_le, sizeof(sender->field_be));
+
+        memcpy(sender->field_le + 4, (uint32_t[1]){ htole32(n_name) }, sizeof(uint32_t));
+        memcpy(sender->field_be + 4, (uint32_t[1]){ htobe32(n_name) }, sizeof(uint32_t));
+}
+
+/**
+ * message_stitch_sender_prepared() - stitch in new sender field
  * @message:                    message to operate on
- * @sender_id:                  sender id to stitch in
+ * @sender:                     prepared sender field to stitch in
  *
  * When the broker forwards messages, it needs to fill in the sender-field
  * reliably. Unfortunately, this requires modifying the fields-array of the
@@ -470,9 +660,8 @@ int message_parse_metadata(Message *message) {
  * relocated nor overwritten. That is, any cached pointer stays valid, though
  * maybe no longer part of the actual message.
  */
-void message_stitch_sender(Message *message, uint64_t sender_id) {
-        size_t n, n_stitch, n_field, n_sender;
-        const char *sender;
+void message_stitch_sender_prepared(Message *message, const MessageSender *sender) {
+        size_t n, n_stitch;
         void *end, *field;
 
         /*
@@ -484,47 +673,8 @@ void message_stitch_sender(Message *message, uint64_t sender_id) {
         assert(!message->vecs[1].iov_base && !message->vecs[1].iov_len);
         assert(!message->vecs[2].iov_base && !message->vecs[2].iov_len);
 
-        /*
-         * Convert the sender id to a unique name. This should never fail on
-         * a valid sender id.
-         */
-        sender = address_to_string(&(Address)ADDRESS_INIT_ID(sender_id));
-        message->sender_id = sender_id;
-
-        /*
-         * Calculate string, field, and buffer lengths. We need to possibly cut
-         * out a `(yv)' and insert another one at the end. See the D-Bus
-         * marshalling for details, but shortly this means:
-         *
-         *     - Tuples are always 8-byte aligned. Hence, we can reliably
-         *       calculate field offsets.
-         *
-         *     - A string-field needs `1 + 3 + 4 + n + 1' bytes:
-         *
-         *         - length of 'y':                 1
-         *         - length of 'v':                 3 + 4 + n + 1
-         *           - type 'g' needs:
-         *             - size field byte:           1
-         *             - type string 's':           1
-         *             - zero termination:          1
-         *           - sender string needs:
-         *             - alignment to 4:            0
-         *             - size field int:            4
-         *             - sender string:             n
-         *             - zero termination:          1
-         */
-        n_sender = strlen(sender);
-        n_field = 1 + 3 + 4 + n_sender + 1;
-        n_stitch = c_align8(n_field);
-
-        /*
-         * The patch buffer is pre-allocated. Verify its size is sufficient to
-         * hold the stitched sender.
-         */
-        assert(n_stitch <= sizeof(message->patch));
-        assert(n_sender <= ADDRESS_ID_STRING_MAX);
-        static_assert(1 + 3 + 4 + ADDRESS_ID_STRING_MAX + 1 <= sizeof(message->patch),
-                      "Message patch buffer has insufficient size");
+        message->sender_id = sender->id;
+        n_stitch = c_align8(sender->n_field);
 
         if (message->original_sender) {
                 /*
@@ -534,7 +684,8 @@ void message_stitch_sender(Message *message, uint64_t sender_id) {
                  * @message->original_sender (pointing to the start of the
                  * sender string!). Hence, calculate the offset to its
                  * surrounding field and cut it out.
-                 * See above for size-calculations of `(yv)' fields.
+                 * See message_sender_init() for size-calculations of `(yv)'
+                 * fields.
                  */
                 n = strlen(message->original_sender);
                 end = (void *)message->header + c_align8(message->n_header);
@@ -565,24 +716,15 @@ void message_stitch_sender(Message *message, uint64_t sender_id) {
         /*
          * Now that any possible sender field was cut out, we can append the
          * new sender field at the end. The 3rd iovec is reserved for that
-         * purpose.
+         * purpose. The field was pre-rendered, including its padding, so we
+         * only have to pick the right byte-order.
          */
-
+        memcpy(message->patch,
+               message->big_endian ? sender->field_be : sender->field_le,
+               n_stitch);
         message->vecs[2].iov_base = message->patch;
         message->vecs[2].iov_len = n_stitch;
 
-        /* fill in `(yv)' with sender and padding */
-        message->patch[0] = DBUS_MESSAGE_FIELD_SENDER;
-        message->patch[1] = 1;
-        message->patch[2] = 's';
-        message->patch[3] = 0;
-        if (message->big_endian)
-                memcpy(message->patch + 4, (uint32_t[1]){ htobe32(n_sender) }, sizeof(uint32_t));
-        else
-                memcpy(message->patch + 4, (uint32_t[1]){ htole32(n_sender) }, sizeof(uint32_t));
-        memcpy(message->patch + 8, sender, n_sender + 1);
-        memset(message->patch + 8 + n_sender + 1, 0, n_stitch - n_field);
-
         /*
          * After we cut the previous sender field and inserted the new, adjust
          * all the size-counters in the message again.
@@ -590,7 +732,7 @@ void message_stitch_sender(Message *message, uint64_t sender_id) {
 
         message->n_header = message->vecs[0].iov_len +
                             message->vecs[1].iov_len +
-                            n_field;
+                            sender->n_field;
         message->n_data = c_align8(message->n_header) + message->n_body;
 
         if (message->big_endian)
@@ -598,3 +740,19 @@ void message_stitch_sender(Message *message, uint64_t sender_id) {
         else
                 message->header->n_fields = htole32(message->n_header - sizeof(*message->header));
 }
+
+/**
+ * message_stitch_sender() - stitch in new sender field
+ * @message:                    message to operate on
+ * @sender_id:                  sender id to stitch in
+ *
+ * This is a shortcut for message_sender_init() followed by
+ * message_stitch_sender_prepared(), for callers that do not keep the sender
+ * field around.
+ */
+void message_stitch_sender(Message *message, uint64_t sender_id) {
+        MessageSender sender;
+
+        message_sender_init(&sender, sender_id);
+        message_stitch_sender_prepared(message, &sender);
+}
@@ -5,19 +5,26 @@
  */
 
 #include <c-macro.h>
-#include <c-ref.h>
 #include <stdlib.h>
 #include "dbus/address.h"
 #include "dbus/protocol.h"
+#include "util/ref.h"
 
 typedef struct FDList FDList;
 typedef struct Message Message;
+typedef struct MessageCache MessageCache;
+typedef struct MessageCacheEntry MessageCacheEntry;
 typedef struct MessageHeader MessageHeader;
 typedef struct MessageMetadata MessageMetadata;
+typedef struct MessageSender MessageSender;
 
 /* max message size; taken from spec */
 #define MESSAGE_SIZE_MAX (128UL * 1024UL * 1024UL)
 
+/* header cache dimensions; see message_parse_metadata() */
+#define MESSAGE_CACHE_N (4)
+#define MESSAGE_CACHE_HEADER_MAX (256)
+
 /* max patch buffer size; see message_stitch_sender() */
 #define MESSAGE_PATCH_MAX (C_ALIGN_TO(1 + 3 + 4 + ADDRESS_ID_STRING_MAX + 1, 8))
 
@@ -58,7 +65,7 @@ struct MessageMetadata {
 };
 
 struct Message {
-        _Atomic unsigned long n_refs;
+        Ref n_refs;
 
         bool big_endian : 1;
         bool allocated_data : 1;
@@ -93,12 +100,56 @@ struct MessageHeader {
         uint32_t n_fields;
 } _c_packed_;
 
+struct MessageCacheEntry {
+        uint64_t hash;
+        size_t n_header;
+
+        struct {
+                uint8_t type;
+                uint8_t flags;
+                uint8_t version;
+        } header;
+
+        struct {
+                unsigned int available;
+                uint32_t path;
+                uint32_t interface;
+                uint32_t member;
+                uint32_t error_name;
+                uint32_t reply_serial;
+                uint32_t destination;
+                uint32_t sender;
+                uint32_t signature;
+                uint32_t unix_fds;
+        } fields;
+
+        uint8_t data[MESSAGE_CACHE_HEADER_MAX];
+};
+
+struct MessageCache {
+        MessageCacheEntry entries[MESSAGE_CACHE_N];
+};
+
+#define MESSAGE_CACHE_INIT {}
+
+struct MessageSender {
+        uint64_t id;
+        size_t n_field;
+        uint8_t field_le[MESSAGE_PATCH_MAX];
+        uint8_t field_be[MESSAGE_PATCH_MAX];
+};
+
+#define MESSAGE_SENDER_INIT {}
+
 int message_new_incoming(Message **messagep, MessageHeader header);
 int message_new_outgoing(Message **messagep, void *data, size_t n_data);
-void message_free(_Atomic unsigned long *n_refs, void *userdata);
+void message_free(Ref *n_refs, void *userdata);
 
-int message_parse_metadata(Message *message);
+int message_parse_metadata(Message *message, MessageCache *cache);
 void message_stitch_sender(Message *message, uint64_t sender_id);
+void message_stitch_sender_prepared(Message *message, const MessageSender *sender);
+
+void message_sender_init(MessageSender *sender, uint64_t id);
 
 /* inline helpers */
 
@@ -107,7 +158,7 @@ void message_stitch_sender(Message *message, uint64_t sender_id);
  */
 static inline Message *message_ref(Message *message) {
         if (message)
-                c_ref_inc(&message->n_refs);
+                ref_inc(&message->n_refs);
         return message;
 }
 
@@ -116,7 +167,7 @@ static inline Message *message_ref(Message *message) {
  */
 static inline Message *message_unref(Message *message) {
         if (message)
-                c_ref_dec(&message->n_refs, message_free, NULL);
+                ref_dec(&message->n_refs, message_free, NULL);
         return NULL;
 }
 
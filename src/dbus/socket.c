@@ -13,6 +13,8 @@
 
 #include <c-list.h>
 #include <c-macro.h>
+#include <c-rbtree.h>
+#include <c-string.h>
 #include <linux/sockios.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
@@ -27,8 +29,13 @@
 #include "util/fdlist.h"
 #include "util/user.h"
 
+static_assert(offsetof(Socket, in) <= 64,
+              "Socket output queue exceeds the first cache line");
+
 struct SocketBuffer {
         CList link;
+        CRBTree *coalesce_tree;
+        CRBNode coalesce_node;
         UserCharge charges[2];
 
         size_t n_total;
@@ -49,6 +56,8 @@ static SocketBuffer *socket_buffer_free(SocketBuffer *buffer) {
 
         user_charge_deinit(&buffer->charges[1]);
         user_charge_deinit(&buffer->charges[0]);
+        if (buffer->coalesce_tree)
+                c_rbtree_remove_init(buffer->coalesce_tree, &buffer->coalesce_node);
         c_list_unlink_init(&buffer->link);
         message_unref(buffer->message);
         free(buffer);
@@ -66,6 +75,8 @@ static int socket_buffer_new_internal(SocketBuffer **bufferp, size_t n_vecs, siz
                 return error_origin(-ENOMEM);
 
         buffer->link = (CList)C_LIST_INIT(buffer->link);
+        buffer->coalesce_tree = NULL;
+        buffer->coalesce_node = (CRBNode)C_RBNODE_INIT(buffer->coalesce_node);
         user_charge_init(&buffer->charges[0]);
         user_charge_init(&buffer->charges[1]);
         buffer->n_total = n_line;
@@ -138,6 +149,38 @@ static int socket_buffer_new_message(SocketBuffer **bufferp,
         return 0;
 }
 
+static int socket_buffer_replace_message(SocketBuffer *buffer,
+                                         Socket *socket,
+                                         User *user,
+                                         Message *message) {
+        UserCharge charge;
+        int r;
+
+        assert(buffer->message);
+        assert(!buffer->writer);
+        assert(!fdlist_count(buffer->message->fds));
+        assert(!fdlist_count(message->fds));
+
+        user_charge_init(&charge);
+
+        r = user_charge(socket->user,
+                        &charge,
+                        user,
+                        USER_SLOT_BYTES,
+                        sizeof(SocketBuffer) + sizeof(Message) + message->n_data);
+        if (r)
+                return (r == USER_E_QUOTA) ? SOCKET_E_QUOTA : error_fold(r);
+
+        user_charge_deinit(&buffer->charges[0]);
+        buffer->charges[0] = charge;
+
+        message_unref(buffer->message);
+        buffer->message = message_ref(message);
+        memcpy(buffer->vecs, message->vecs, sizeof(message->vecs));
+
+        return 0;
+}
+
 static size_t socket_buffer_get_line_space(SocketBuffer *buffer) {
         size_t n_remaining;
 
@@ -507,6 +550,87 @@ int socket_queue(Socket *socket, User *user, Message *message) {
         return 0;
 }
 
+static int socket_coalesce_compare(CRBTree *tree, void *k, CRBNode *rb) {
+        SocketBuffer *buffer = c_container_of(rb, SocketBuffer, coalesce_node);
+        Message *message1 = k, *message2 = buffer->message;
+        int r;
+
+        if (message1->sender_id > message2->sender_id)
+                return 1;
+        if (message1->sender_id < message2->sender_id)
+                return -1;
+
+        if ((r = c_string_compare(message1->metadata.fields.path, message2->metadata.fields.path)) ||
+            (r = c_string_compare(message1->metadata.fields.interface, message2->metadata.fields.interface)) ||
+            (r = c_string_compare(message1->metadata.fields.member, message2->metadata.fields.member)))
+                return r;
+
+        if (message1->metadata.args[0].element > message2->metadata.args[0].element)
+                return 1;
+        if (message1->metadata.args[0].element < message2->metadata.args[0].element)
+                return -1;
+
+        return c_string_compare(message1->metadata.args[0].value, message2->metadata.args[0].value);
+}
+
+/**
+ * socket_queue_coalesce() - queue message, replacing superseded signals
+ * @socket:             socket to operate on
+ * @user:               user to charge as
+ * @message:            message to queue
+ *
+ * This works like socket_queue(), but if @message is a signal and an older
+ * signal with the same sender, path, interface, member and first argument is
+ * still queued and entirely unsent, the older one is replaced in place with
+ * @message. This allows slow receivers to catch up with the latest state,
+ * rather than replaying all intermediate signals.
+ *
+ * Messages with file-descriptors, and messages without parsed metadata, are
+ * never coalesced.
+ *
+ * Return: 0 on success, SOCKET_E_QUOTA if quota failed, SOCKET_E_SHUTDOWN if
+ *         write-side end is already shutdown, negative error code on failure.
+ */
+int socket_queue_coalesce(Socket *socket, User *user, Message *message) {
+        _c_cleanup_(socket_buffer_freep) SocketBuffer *buffer = NULL;
+        CRBNode *parent, **slot;
+        SocketBuffer *old;
+        int r;
+
+        if (!message->parsed ||
+            message->metadata.header.type != DBUS_MESSAGE_TYPE_SIGNAL ||
+            fdlist_count(message->fds))
+                return socket_queue(socket, user, message);
+
+        if (_c_unlikely_(socket->hup_out || socket->shutdown))
+                return SOCKET_E_SHUTDOWN;
+
+        slot = c_rbtree_find_slot(&socket->out.coalesce_tree, socket_coalesce_compare, message, &parent);
+        if (!slot) {
+                old = c_container_of(parent, SocketBuffer, coalesce_node);
+
+                if (socket_buffer_is_uncomsumed(old))
+                        return socket_buffer_replace_message(old, socket, user, message);
+
+                /* partially written buffers cannot be replaced, drop them from the index */
+                c_rbtree_remove_init(&socket->out.coalesce_tree, &old->coalesce_node);
+                old->coalesce_tree = NULL;
+
+                slot = c_rbtree_find_slot(&socket->out.coalesce_tree, socket_coalesce_compare, message, &parent);
+                assert(slot);
+        }
+
+        r = socket_buffer_new_message(&buffer, socket, user, message);
+        if (r)
+                return error_trace(r);
+
+        c_list_link_tail(&socket->out.queue, &buffer->link);
+        c_rbtree_add(&socket->out.coalesce_tree, parent, slot, &buffer->coalesce_node);
+        buffer->coalesce_tree = &socket->out.coalesce_tree;
+        buffer = NULL;
+        return 0;
+}
+
 static int socket_recvmsg(Socket *socket,
                           void *buffer,
                           size_t *from,
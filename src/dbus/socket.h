@@ -6,6 +6,7 @@
 
 #include <c-list.h>
 #include <c-macro.h>
+#include <c-rbtree.h>
 #include <stdlib.h>
 #include "dbus/message.h"
 #include "dbus/queue.h"
@@ -43,16 +44,18 @@ struct Socket {
         bool hup_in : 1;
         bool hup_out : 1;
 
+        /* queued on for every message sent to the peer, keep it up front */
+        struct SocketOut {
+                CList queue;
+                CList pending;
+                CRBTree coalesce_tree;
+        } out;
+
         struct {
                 IQueue queue;
                 MessageHeader header;
                 Message *message;
         } in;
-
-        struct SocketOut {
-                CList queue;
-                CList pending;
-        } out;
 };
 
 #define SOCKET_NULL(_x) {                                               \
@@ -60,6 +63,7 @@ struct Socket {
                 .in.queue = IQUEUE_NULL((_x).in.queue),                 \
                 .out.queue = C_LIST_INIT((_x).out.queue),               \
                 .out.pending = C_LIST_INIT((_x).out.pending),           \
+                .out.coalesce_tree = C_RBTREE_INIT,                     \
         }
 
 void socket_init(Socket *socket, User *user, int fd);
@@ -70,6 +74,7 @@ int socket_dequeue(Socket *socket, Message **messagep);
 
 int socket_queue_line(Socket *socket, User *user, const char *line, size_t n);
 int socket_queue(Socket *socket, User *user, Message *message);
+int socket_queue_coalesce(Socket *socket, User *user, Message *message);
 
 int socket_dispatch(Socket *socket, uint32_t event);
 void socket_shutdown(Socket *socket);
@@ -82,3 +87,7 @@ C_DEFINE_CLEANUP(Socket *, socket_deinit);
 static inline bool socket_is_running(Socket *socket) {
         return !socket->reset;
 }
+
+static inline bool socket_has_output(Socket *socket) {
+        return !c_list_is_empty(&socket->out.queue);
+}
@@ -3,8 +3,11 @@
  */
 
 #include <c-macro.h>
+#include <endian.h>
 #include <stdlib.h>
+#include <string.h>
 #include "dbus/message.h"
+#include "dbus/protocol.h"
 
 static void test_setup(void) {
         _c_cleanup_(message_unrefp) Message *m1 = NULL, *m2, *m3;
@@ -61,8 +64,89 @@ static void test_size(void) {
         assert(r == MESSAGE_E_TOO_LARGE);
 }
 
+static Message *test_new_call(uint32_t serial, const char *member) {
+        Message *message;
+        uint8_t *data;
+        int r;
+
+        /*
+         * Hand-craft a method call with a path "/a" and a 1-byte member. The
+         * fields are `(yv)' tuples, hence 8-byte aligned.
+         */
+
+        data = calloc(1, 48);
+        assert(data);
+
+        *(MessageHeader *)data = (MessageHeader){
+                .endian = 'l',
+                .type = DBUS_MESSAGE_TYPE_METHOD_CALL,
+                .version = 1,
+                .serial = htole32(serial),
+                .n_fields = htole32(42 - 16),
+        };
+
+        memcpy(data + 16, (uint8_t[]){ DBUS_MESSAGE_FIELD_PATH, 1, 'o', 0, 2, 0, 0, 0, '/', 'a', 0 }, 11);
+        memcpy(data + 32, (uint8_t[]){ DBUS_MESSAGE_FIELD_MEMBER, 1, 's', 0, 1, 0, 0, 0, member[0], 0 }, 10);
+
+        r = message_new_outgoing(&message, data, 48);
+        assert(!r);
+
+        return message;
+}
+
+static void test_cache(void) {
+        MessageCache cache = MESSAGE_CACHE_INIT;
+        Message *m1, *m2, *m3, *m4;
+        size_t i, n;
+        int r;
+
+        /* parse a message and populate the cache */
+
+        m1 = test_new_call(1, "b");
+        r = message_parse_metadata(m1, &cache);
+        assert(!r);
+        assert(m1->metadata.header.serial == 1);
+        assert(!strcmp(m1->metadata.fields.path, "/a"));
+        assert(!strcmp(m1->metadata.fields.member, "b"));
+        assert(!strcmp(m1->metadata.fields.signature, ""));
+
+        for (n = 0, i = 0; i < C_ARRAY_SIZE(cache.entries); ++i)
+                if (cache.entries[i].n_header)
+                        ++n;
+        assert(n == 1);
+
+        /* same header with a different serial hits the cache */
+
+        m2 = test_new_call(2, "b");
+        r = message_parse_metadata(m2, &cache);
+        assert(!r);
+        assert(m2->metadata.header.serial == 2);
+        assert(m2->metadata.fields.path == (const char *)m2->header + 24);
+        assert(m2->metadata.fields.member == (const char *)m2->header + 40);
+        assert(!strcmp(m2->metadata.fields.signature, ""));
+
+        /* the serial is still validated on a hit */
+
+        m3 = test_new_call(0, "b");
+        r = message_parse_metadata(m3, &cache);
+        assert(r == MESSAGE_E_INVALID_HEADER);
+
+        /* a different header is parsed on its own */
+
+        m4 = test_new_call(3, "c");
+        r = message_parse_metadata(m4, &cache);
+        assert(!r);
+        assert(!strcmp(m4->metadata.fields.member, "c"));
+
+        message_unref(m4);
+        message_unref(m3);
+        message_unref(m2);
+        message_unref(m1);
+}
+
 int main(int argc, char **argv) {
         test_setup();
         test_size();
+        test_cache();
         return 0;
 }
@@ -91,9 +91,94 @@ static void test_message(void) {
         assert(memcmp(message1->header, message2->header, sizeof(header)) == 0);
 }
 
+static void test_coalesce_new(Message **messagep, uint32_t serial, const char *member) {
+        MessageHeader header = {
+                .endian = 'l',
+                .type = DBUS_MESSAGE_TYPE_SIGNAL,
+                .serial = serial,
+        };
+        int r;
+
+        r = message_new_incoming(messagep, header);
+        assert(r == 0);
+
+        (*messagep)->parsed = true;
+        (*messagep)->sender_id = 1;
+        (*messagep)->metadata.header.type = DBUS_MESSAGE_TYPE_SIGNAL;
+        (*messagep)->metadata.fields.path = "/org/example";
+        (*messagep)->metadata.fields.interface = "org.example";
+        (*messagep)->metadata.fields.member = member;
+}
+
+static void test_coalesce(void) {
+        _c_cleanup_(socket_deinit) Socket client = SOCKET_NULL(client), server = SOCKET_NULL(server);
+        _c_cleanup_(message_unrefp) Message *message1 = NULL, *message2 = NULL, *message3 = NULL;
+        Message *message;
+        int pair[2], r;
+
+        r = socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+        assert(r >= 0);
+
+        socket_init(&client, NULL, pair[0]);
+        socket_init(&server, NULL, pair[1]);
+
+        test_coalesce_new(&message1, 1, "Changed");
+        test_coalesce_new(&message2, 2, "Other");
+        test_coalesce_new(&message3, 3, "Changed");
+
+        /* the third signal supersedes the first one, but keeps its position */
+        r = socket_queue_coalesce(&client, NULL, message1);
+        assert(!r);
+        r = socket_queue_coalesce(&client, NULL, message2);
+        assert(!r);
+        r = socket_queue_coalesce(&client, NULL, message3);
+        assert(!r);
+
+        r = socket_dispatch(&client, EPOLLOUT);
+        assert(r == SOCKET_E_LOST_INTEREST);
+        r = socket_dispatch(&server, EPOLLIN);
+        assert(!r || r == SOCKET_E_PREEMPTED);
+
+        r = socket_dequeue(&server, &message);
+        assert(!r && message);
+        assert(message->header->serial == 3);
+        message_unref(message);
+
+        r = socket_dequeue(&server, &message);
+        assert(!r && message);
+        assert(message->header->serial == 2);
+        message_unref(message);
+
+        r = socket_dequeue(&server, &message);
+        assert(!r && !message);
+
+        /* once written, a signal is no longer replaced */
+        r = socket_queue_coalesce(&client, NULL, message1);
+        assert(!r);
+        r = socket_dispatch(&client, EPOLLOUT);
+        assert(r == SOCKET_E_LOST_INTEREST);
+        r = socket_queue_coalesce(&client, NULL, message3);
+        assert(!r);
+        r = socket_dispatch(&client, EPOLLOUT);
+        assert(r == SOCKET_E_LOST_INTEREST);
+        r = socket_dispatch(&server, EPOLLIN);
+        assert(!r || r == SOCKET_E_PREEMPTED);
+
+        r = socket_dequeue(&server, &message);
+        assert(!r && message);
+        assert(message->header->serial == 1);
+        message_unref(message);
+
+        r = socket_dequeue(&server, &message);
+        assert(!r && message);
+        assert(message->header->serial == 3);
+        message_unref(message);
+}
+
 int main(int argc, char **argv) {
         test_setup();
         test_line();
         test_message();
+        test_coalesce();
         return 0;
 }
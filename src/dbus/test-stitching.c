@@ -106,7 +106,7 @@ static Message *test_new_message(size_t before, const char *sender_early, size_t
         r = message_new_outgoing(&message, data, n_data);
         assert(!r);
 
-        r = message_parse_metadata(message);
+        r = message_parse_metadata(message, NULL);
         assert(!r);
 
         return message;
@@ -135,9 +135,10 @@ static void test_assert_message(Message *message, size_t before, const char *sen
 }
 
 static void test_stitching(void) {
+        MessageSender sender;
         Message *message;
         Address addr;
-        size_t i, n;
+        size_t i, j, n;
         char *from, *to;
 
         /*
@@ -177,6 +178,15 @@ static void test_stitching(void) {
                 test_assert_message(message, i % 13, to, i / 17);
                 message_unref(message);
 
+                /* a prepared sender field must be reusable across messages */
+                message_sender_init(&sender, addr.id);
+                for (j = 0; j < 2; ++j) {
+                        message = test_new_message((i + j) % 13, from, i / 17, NULL);
+                        message_stitch_sender_prepared(message, &sender);
+                        test_assert_message(message, (i + j) % 13, to, i / 17);
+                        message_unref(message);
+                }
+
                 free(to);
                 free(from);
         }
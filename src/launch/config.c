@@ -6,8 +6,11 @@
 #include <c-macro.h>
 #include <expat.h>
 #include <grp.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "dbus/protocol.h"
 #include "launch/config.h"
 #include "util/error.h"
@@ -218,6 +221,36 @@ ConfigRoot *config_root_free(ConfigRoot *root) {
         return NULL;
 }
 
+/*
+ * Included files are parsed in parallel, but getpwnam(3) and getgrnam(3)
+ * return static storage. Serialize all lookups through this lock.
+ */
+static pthread_mutex_t config_nss_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool config_lookup_user(const char *name, uint32_t *uidp) {
+        struct passwd *pw;
+
+        pthread_mutex_lock(&config_nss_lock);
+        pw = getpwnam(name);
+        if (pw)
+                *uidp = pw->pw_uid;
+        pthread_mutex_unlock(&config_nss_lock);
+
+        return pw;
+}
+
+static bool config_lookup_group(const char *name, uint32_t *gidp) {
+        struct group *gr;
+
+        pthread_mutex_lock(&config_nss_lock);
+        gr = getgrnam(name);
+        if (gr)
+                *gidp = gr->gr_gid;
+        pthread_mutex_unlock(&config_nss_lock);
+
+        return gr;
+}
+
 static int config_parser_attrs_include(ConfigState *state, ConfigNode *node, const XML_Char **attrs) {
         const char *k, *v;
 
@@ -262,33 +295,31 @@ static int config_parser_attrs_policy(ConfigState *state, ConfigNode *node, cons
                 v = *(attrs++);
 
                 if (!strcmp(k, "user")) {
-                        struct passwd *pw;
+                        uint32_t uid;
 
                         if (node->policy.context)
                                 CONFIG_ERR(state, "Conflicting attributes", "");
 
-                        pw = getpwnam(v);
-                        if (!pw) {
+                        if (!config_lookup_user(v, &uid)) {
                                 CONFIG_ERR(state, "Invalid user-name", ": %s=\"%s\"", k, v);
                                 continue;
                         }
 
                         node->policy.context = CONFIG_POLICY_USER;
-                        node->policy.id = pw->pw_uid;
+                        node->policy.id = uid;
                 } else if (!strcmp(k, "group")) {
-                        struct group *gr;
+                        uint32_t gid;
 
                         if (node->policy.context)
                                 CONFIG_ERR(state, "Conflicting attributes", "");
 
-                        gr = getgrnam(v);
-                        if (!gr) {
+                        if (!config_lookup_group(v, &gid)) {
                                 CONFIG_ERR(state, "Invalid group-name", ": %s=\"%s\"", k, v);
                                 continue;
                         }
 
                         node->policy.context = CONFIG_POLICY_GROUP;
-                        node->policy.id = gr->gr_gid;
+                        node->policy.id = gid;
                 } else if (!strcmp(k, "context")) {
                         if (node->policy.context)
                                 CONFIG_ERR(state, "Conflicting attributes", "");
@@ -335,6 +366,13 @@ static int config_parser_attrs_limit(ConfigState *state, ConfigNode *node, const
 
                         free(node->limit.name);
                         node->limit.name = t;
+                } else if (!strcmp(k, "user")) {
+                        if (!config_lookup_user(v, &node->limit.uid)) {
+                                CONFIG_ERR(state, "Invalid user-name", ": %s=\"%s\"", k, v);
+                                continue;
+                        }
+
+                        node->limit.user = true;
                 } else {
                         CONFIG_ERR(state, "Unknown attribute", ": %s=\"%s\"", k, v);
                 }
@@ -485,35 +523,27 @@ static int config_parser_attrs_allow_deny(ConfigState *state, ConfigNode *node,
                         free(node->allow_deny.own_prefix);
                         node->allow_deny.own_prefix = t;
                 } else if (!strcmp(k, "user")) {
-                        struct passwd *pw;
-
                         if (!strcmp(v, "*")) {
                                 node->allow_deny.uid = -1;
                                 node->allow_deny.user = true;
                         } else {
-                                pw = getpwnam(v);
-                                if (!pw) {
+                                if (!config_lookup_user(v, &node->allow_deny.uid)) {
                                         CONFIG_ERR(state, "Invalid user-name", ": %s=\"%s\"", k, v);
                                         continue;
                                 }
 
-                                node->allow_deny.uid = pw->pw_uid;
                                 node->allow_deny.user = true;
                         }
                 } else if (!strcmp(k, "group")) {
-                        struct group *gr;
-
                         if (!strcmp(v, "*")) {
                                 node->allow_deny.gid = -1;
                                 node->allow_deny.group = true;
                         } else {
-                                gr = getgrnam(v);
-                                if (!gr) {
+                                if (!config_lookup_group(v, &node->allow_deny.gid)) {
                                         CONFIG_ERR(state, "Invalid group-name", ": %s=\"%s\"", k, v);
                                         continue;
                                 }
 
-                                node->allow_deny.gid = gr->gr_gid;
                                 node->allow_deny.group = true;
                         }
                 } else if (!strcmp(k, "send_requested_reply")) {
@@ -914,9 +944,9 @@ static void config_parser_begin_fn(void *userdata, const XML_Char *name, const X
         assert(node);
         assert(node->parent);
 
-        c_list_link_after(&state->last->root_link, &node->root_link);
+        c_list_link_after(state->last, &node->root_link);
         state->current = node;
-        state->last = node;
+        state->last = &node->root_link;
         ++state->n_depth;
 
         node->path = config_path_ref(state->file);
@@ -1003,9 +1033,9 @@ static void config_parser_end_fn(void *userdata, const XML_Char *name) {
                                 return;
                         }
 
-                        c_list_link_after(&state->last->root_link, &node->root_link);
+                        c_list_link_after(state->last, &node->root_link);
                         c_list_link_tail(&state->root->include_list, &node->include_link);
-                        state->last = node;
+                        state->last = &node->root_link;
                         node = NULL;
                 }
 
@@ -1035,10 +1065,25 @@ static void config_parser_end_fn(void *userdata, const XML_Char *name) {
         case CONFIG_NODE_SERVICEDIR:
         case CONFIG_NODE_SERVICEHELPER:
         case CONFIG_NODE_AUTH:
-        case CONFIG_NODE_LIMIT:
                 /* XXX: Not yet implemented. */
                 break;
 
+        case CONFIG_NODE_LIMIT: {
+                const char *cdata = state->current->cdata ?: "";
+                unsigned long v;
+                char *end;
+
+                errno = 0;
+                v = strtoul(cdata, &end, 10);
+                if (errno != 0 || end == cdata || v > UINT32_MAX || end[strspn(end, " \r\t\n")]) {
+                        CONFIG_ERR(state, "Invalid limit", ": <%s>%s</%s>", name, cdata, name);
+                        break;
+                }
+
+                state->current->limit.value = v;
+                break;
+        }
+
         case CONFIG_NODE_BUSCONFIG:
         case CONFIG_NODE_FORK:
         case CONFIG_NODE_SYSLOG:
@@ -1117,9 +1162,9 @@ void config_parser_deinit(ConfigParser *parser) {
 
 static int config_parser_include(ConfigParser *parser, ConfigRoot *root, ConfigNode *node) {
         _c_cleanup_(c_closep) int fd = -1;
-        char buffer[CONFIG_PARSER_BUFFER_MAX];
         ConfigPath *i_file;
         ssize_t len;
+        void *buffer;
         int r;
 
         assert(node->type == CONFIG_NODE_INCLUDE);
@@ -1129,7 +1174,7 @@ static int config_parser_include(ConfigParser *parser, ConfigRoot *root, ConfigN
         parser->state.file = node->include.file;
         parser->state.root = root;
         parser->state.current = node;
-        parser->state.last = node;
+        parser->state.last = &root->node_list;
 
         /* ignore selinux files if selinux is disabled */
         if (node->include.if_selinux_enabled && !bus_selinux_is_enabled())
@@ -1143,6 +1188,9 @@ static int config_parser_include(ConfigParser *parser, ConfigRoot *root, ConfigN
                 }
         }
 
+        if (!parser->xml)
+                return error_origin(-ENOMEM);
+
         XML_ParserReset(parser->xml, NULL);
         XML_SetUserData(parser->xml, &parser->state);
         XML_SetElementHandler(parser->xml, config_parser_begin_fn, config_parser_end_fn);
@@ -1158,11 +1206,16 @@ static int config_parser_include(ConfigParser *parser, ConfigRoot *root, ConfigN
         fd = r;
 
         do {
-                len = read(fd, buffer, sizeof(buffer));
+                /* read straight into the parser buffer, avoiding a copy */
+                buffer = XML_GetBuffer(parser->xml, CONFIG_PARSER_BUFFER_MAX);
+                if (!buffer)
+                        return error_origin(-ENOMEM);
+
+                len = read(fd, buffer, CONFIG_PARSER_BUFFER_MAX);
                 if (len < 0)
                         return error_origin(-errno);
 
-                r = XML_Parse(parser->xml, buffer, len, len ? XML_FALSE : XML_TRUE);
+                r = XML_ParseBuffer(parser->xml, len, len ? XML_FALSE : XML_TRUE);
                 if (r != XML_STATUS_OK) {
                         CONFIG_ERR(&parser->state, "Invalid XML", ": %s",
                                    XML_ErrorString(XML_GetErrorCode(parser->xml)));
@@ -1179,6 +1232,113 @@ static int config_parser_include(ConfigParser *parser, ConfigRoot *root, ConfigN
         return 0;
 }
 
+typedef struct ConfigJob ConfigJob;
+typedef struct ConfigPool ConfigPool;
+
+struct ConfigJob {
+        ConfigNode *node;
+        ConfigRoot *root;
+        int error;
+};
+
+struct ConfigPool {
+        ConfigJob *jobs;
+        size_t n_jobs;
+        _Atomic size_t i_job;
+};
+
+static void config_parser_run(ConfigParser *parser, ConfigPool *pool) {
+        ConfigJob *job;
+        size_t i;
+
+        while ((i = atomic_fetch_add(&pool->i_job, 1)) < pool->n_jobs) {
+                job = &pool->jobs[i];
+                job->error = config_parser_include(parser, job->root, job->node);
+        }
+}
+
+static void *config_parser_thread_fn(void *userdata) {
+        _c_cleanup_(config_parser_deinit) ConfigParser parser = CONFIG_PARSER_NULL(parser);
+
+        config_parser_init(&parser);
+        config_parser_run(&parser, userdata);
+
+        return NULL;
+}
+
+static int config_parser_include_all(ConfigParser *parser, ConfigRoot *root) {
+        pthread_t threads[CONFIG_PARSER_THREADS_MAX - 1];
+        ConfigPool pool = {};
+        ConfigNode *node;
+        size_t i, n_threads = 0;
+        long n_cpus;
+        int r = 0;
+
+        /*
+         * Take all pending includes and parse each of them into its own
+         * temporary root. Included files are independent of each other, so
+         * they are parsed concurrently, each worker with its own expat
+         * parser. The calling thread takes part in the work with @parser.
+         *
+         * ConfigPath references are not atomic. This is fine, since a worker
+         * only ever references the path of the file it parses, and paths it
+         * created itself.
+         */
+        c_list_for_each_entry(node, &root->include_list, include_link)
+                ++pool.n_jobs;
+
+        pool.jobs = calloc(pool.n_jobs, sizeof(*pool.jobs));
+        if (!pool.jobs)
+                return error_origin(-ENOMEM);
+
+        for (i = 0; i < pool.n_jobs; ++i) {
+                node = c_list_first_entry(&root->include_list, ConfigNode, include_link);
+                c_list_unlink_init(&node->include_link);
+
+                pool.jobs[i].node = node;
+                r = config_root_new(&pool.jobs[i].root);
+                if (r) {
+                        r = error_trace(r);
+                        goto exit;
+                }
+        }
+
+        n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        while (n_threads + 1 < pool.n_jobs &&
+               n_threads + 1 < CONFIG_PARSER_THREADS_MAX &&
+               (long)n_threads + 1 < n_cpus) {
+                /* if we cannot spawn more threads, go on with what we have */
+                if (pthread_create(&threads[n_threads], NULL, config_parser_thread_fn, &pool))
+                        break;
+
+                ++n_threads;
+        }
+
+        config_parser_run(parser, &pool);
+
+        for (i = 0; i < n_threads; ++i)
+                pthread_join(threads[i], NULL);
+
+        /*
+         * Splice the parsed nodes right behind their include-node, and queue
+         * any nested includes. This yields exactly the document order of a
+         * sequential parse, so policy priorities are not affected.
+         */
+        for (i = 0; i < pool.n_jobs; ++i) {
+                c_list_splice(pool.jobs[i].node->root_link.next, &pool.jobs[i].root->node_list);
+                c_list_splice(&root->include_list, &pool.jobs[i].root->include_list);
+
+                if (!r && pool.jobs[i].error)
+                        r = error_trace(pool.jobs[i].error);
+        }
+
+exit:
+        for (i = 0; i < pool.n_jobs; ++i)
+                config_root_free(pool.jobs[i].root);
+        free(pool.jobs);
+        return r;
+}
+
 /**
  * config_parser_read() - XXX
  */
@@ -1214,13 +1374,12 @@ int config_parser_read(ConfigParser *parser, ConfigRoot **rootp, const char *pat
 
         /*
          * Now for as long as we find include-nodes linked on
-         * @root->include_list, we call into config_parser_include(). This will
-         * fill in all the contents of the include.
+         * @root->include_list, we call into config_parser_include_all(). This
+         * will fill in all the contents of the pending includes, and queue
+         * any includes found in them.
          */
-        while ((node = c_list_first_entry(&root->include_list, ConfigNode, include_link))) {
-                c_list_unlink_init(&node->include_link);
-
-                r = config_parser_include(parser, root, node);
+        while (!c_list_is_empty(&root->include_list)) {
+                r = config_parser_include_all(parser, root);
                 if (r)
                         return error_trace(r);
         }
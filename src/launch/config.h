@@ -16,6 +16,7 @@ typedef struct ConfigRoot ConfigRoot;
 typedef struct ConfigState ConfigState;
 
 #define CONFIG_PARSER_BUFFER_MAX 4096
+#define CONFIG_PARSER_THREADS_MAX 8
 
 enum {
         _CONFIG_E_SUCCESS,
@@ -122,6 +123,9 @@ struct ConfigNode {
 
                 struct {
                         char *name;
+                        uint32_t uid;
+                        uint32_t value;
+                        bool user : 1;
                 } limit;
 
                 struct {
@@ -184,7 +188,7 @@ struct ConfigParser {
                 ConfigPath *file;
                 ConfigRoot *root;
                 ConfigNode *current;
-                ConfigNode *last;
+                CList *last;
                 size_t n_depth;
                 size_t n_failed;
                 int error;
@@ -14,6 +14,7 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <time.h>
 #include <systemd/sd-bus.h>
 #include <systemd/sd-daemon.h>
 #include <systemd/sd-event.h>
@@ -33,6 +34,8 @@ enum {
 struct Service {
         Manager *manager;
         CRBNode rb;
+        CRBNode rb_unit;
+        sd_bus_slot *slot_start;
         char *name;
         char *unit;
         char **exec;
@@ -46,7 +49,9 @@ struct Manager {
         sd_bus *bus_regular;
         int fd_listen;
         CRBTree services;
+        CRBTree units;
         uint64_t service_ids;
+        bool draining : 1;
 };
 
 static const char *     main_arg_broker = "/usr/bin/dbus-broker";
@@ -84,11 +89,25 @@ static int service_compare(CRBTree *t, void *k, CRBNode *n) {
         return strcmp(k, service->id);
 }
 
+static int service_compare_unit(CRBTree *t, void *k, CRBNode *n) {
+        Service *key = k, *service = c_container_of(n, Service, rb_unit);
+        int r;
+
+        /* several names can share a unit, order them by id */
+        r = strcmp(key->unit, service->unit);
+        if (r)
+                return r;
+
+        return strcmp(key->id, service->id);
+}
+
 static Service *service_free(Service *service) {
         if (!service)
                 return NULL;
 
+        c_rbtree_remove_init(&service->manager->units, &service->rb_unit);
         c_rbtree_remove_init(&service->manager->services, &service->rb);
+        sd_bus_slot_unref(service->slot_start);
         for (size_t i = 0; i < service->n_exec; ++i)
                 free(service->exec[i]);
         free(service->exec);
@@ -111,6 +130,7 @@ static int service_new(Service **servicep, Manager *manager, const char *name, c
 
         service->manager = manager;
         service->rb = (CRBNode)C_RBNODE_INIT(service->rb);
+        service->rb_unit = (CRBNode)C_RBNODE_INIT(service->rb_unit);
         sprintf(service->id, "%" PRIu64, ++manager->service_ids);
 
         service->name = strdup(name);
@@ -141,6 +161,12 @@ static int service_new(Service **servicep, Manager *manager, const char *name, c
         assert(slot);
         c_rbtree_add(&manager->services, parent, slot, &service->rb);
 
+        if (service->unit) {
+                slot = c_rbtree_find_slot(&manager->units, service_compare_unit, service, &parent);
+                assert(slot);
+                c_rbtree_add(&manager->units, parent, slot, &service->rb_unit);
+        }
+
         *servicep = service;
         service = NULL;
         return 0;
@@ -166,6 +192,39 @@ static Manager *manager_free(Manager *manager) {
 
 C_DEFINE_CLEANUP(Manager *, manager_free);
 
+static int manager_on_sigterm(sd_event_source *source, const struct signalfd_siginfo *si, void *userdata) {
+        _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+        Manager *manager = userdata;
+        int r;
+
+        /*
+         * Rather than tearing down the broker, ask it to deliver everything
+         * it has queued, and wait for it to exit on its own. If this is
+         * requested again, or the broker cannot be reached, exit right away.
+         */
+        if (manager->draining)
+                return sd_event_exit(sd_event_source_get_event(source), 0);
+
+        if (main_arg_verbose)
+                fprintf(stderr, "Caught SIGTERM, draining broker\n");
+
+        r = sd_bus_message_new_method_call(manager->bus_controller,
+                                           &m,
+                                           NULL,
+                                           "/org/bus1/DBus/Broker",
+                                           "org.bus1.DBus.Broker",
+                                           "Drain");
+        if (r >= 0)
+                r = sd_bus_message_set_expect_reply(m, false);
+        if (r >= 0)
+                r = sd_bus_send(manager->bus_controller, m, NULL);
+        if (r < 0)
+                return sd_event_exit(sd_event_source_get_event(source), 0);
+
+        manager->draining = true;
+        return 0;
+}
+
 static int manager_new(Manager **managerp) {
         _c_cleanup_(manager_freep) Manager *manager = NULL;
         int r;
@@ -180,7 +239,7 @@ static int manager_new(Manager **managerp) {
         if (r < 0)
                 return error_origin(r);
 
-        r = sd_event_add_signal(manager->event, NULL, SIGTERM, NULL, NULL);
+        r = sd_event_add_signal(manager->event, NULL, SIGTERM, manager_on_sigterm, manager);
         if (r < 0)
                 return error_origin(r);
 
@@ -332,18 +391,78 @@ static int manager_fork(Manager *manager, int fd_controller) {
         return 0;
 }
 
-static int manager_request_activation(Manager *manager, const char *name, const char *unit) {
+static int service_fail(Service *service) {
+        _c_cleanup_(c_freep) char *object_path = NULL;
+        int r;
+
+        if (main_arg_verbose)
+                fprintf(stderr, "Activation of '%s' failed\n", service->name);
+
+        r = asprintf(&object_path, "/org/bus1/DBus/Name/%s", service->id);
+        if (r < 0)
+                return error_origin(-ENOMEM);
+
+        /*
+         * This must not block the event loop, so the call is sent without
+         * waiting for the reply. The broker only refuses it if the name is
+         * gone, in which case there is nothing left to fail.
+         */
+        r = sd_bus_call_method_async(service->manager->bus_controller,
+                                     NULL,
+                                     NULL,
+                                     object_path,
+                                     "org.bus1.DBus.Name",
+                                     "FailActivation",
+                                     NULL,
+                                     NULL,
+                                     "s",
+                                     "failed");
+        if (r < 0)
+                return error_origin(r);
+
+        return 0;
+}
+
+static int service_on_start_reply(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        Service *service = userdata;
+        const sd_bus_error *e;
+
+        service->slot_start = sd_bus_slot_unref(service->slot_start);
+
+        /*
+         * If the unit was started, the service is expected to claim its name.
+         * If it never does, the broker times the activation out on its own.
+         */
+        e = sd_bus_message_get_error(m);
+        if (!e)
+                return 0;
+
+        if (main_arg_verbose)
+                fprintf(stderr, "Cannot start unit for '%s': %s\n", service->name, e->message);
+
+        return error_trace(service_fail(service));
+}
+
+static int service_start_unit(Service *service) {
         _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *signal = NULL;
+        Manager *manager = service->manager;
         int r;
 
         if (main_arg_verbose)
-                fprintf(stderr, "Activation request for '%s' -> '%s'\n", name, unit);
+                fprintf(stderr, "Activation request for '%s' -> '%s'\n", service->name, service->unit);
 
+        /*
+         * Use the activation interface of systemd, rather than StartUnit, so
+         * units are activated exactly like with dbus-daemon(1). That is, they
+         * are not subject to RefuseManualStart=, and need no authorization of
+         * the launcher. If systemd cannot enqueue the start job, it answers
+         * with an ActivationFailure signal, which the broker forwards to us.
+         */
         r = sd_bus_message_new_signal(manager->bus_regular, &signal, "/org/freedesktop/DBus", "org.freedesktop.systemd1.Activator", "ActivationRequest");
         if (r < 0)
                 return error_origin(r);
 
-        r = sd_bus_message_append(signal, "s", unit);
+        r = sd_bus_message_append(signal, "s", service->unit);
         if (r < 0)
                 return error_origin(r);
 
@@ -358,14 +477,20 @@ static int manager_request_activation(Manager *manager, const char *name, const
         return 0;
 }
 
-static int manager_start_transient_unit(Manager *manager, const char *name, char **exec, size_t n_exec) {
+static int service_start_transient_unit(Service *service) {
         _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *method_call = NULL;
         _c_cleanup_(c_freep) char *unit = NULL;
+        Manager *manager = service->manager;
+        const char *name = service->name;
+        char **exec = service->exec;
+        size_t n_exec = service->n_exec;
         int r;
 
         if (main_arg_verbose)
                 fprintf(stderr, "Activation request for '%s'\n", name);
 
+        service->slot_start = sd_bus_slot_unref(service->slot_start);
+
         r = asprintf(&unit, "dbus-%s.service", name);
         if (r < 0)
                 return error_origin(-errno);
@@ -375,6 +500,8 @@ static int manager_start_transient_unit(Manager *manager, const char *name, char
                                            "/org/freedesktop/systemd1",
                                            "org.freedesktop.systemd1.Manager",
                                            "StartTransientUnit");
+        if (r < 0)
+                return error_origin(r);
 
         r = sd_bus_message_append(method_call, "ss", unit, "fail");
         if (r < 0)
@@ -462,7 +589,7 @@ static int manager_start_transient_unit(Manager *manager, const char *name, char
         if (r < 0)
                 return error_origin(r);
 
-        r = sd_bus_send(manager->bus_regular, method_call, NULL);
+        r = sd_bus_call_async(manager->bus_regular, &service->slot_start, method_call, service_on_start_reply, service, 0);
         if (r < 0)
                 return error_origin(r);
 
@@ -487,11 +614,11 @@ static int manager_on_name_activate(Manager *manager, sd_bus_message *m, const c
         }
 
         if (service->unit) {
-                r = manager_request_activation(manager, service->name, service->unit);
+                r = service_start_unit(service);
                 if (r)
                         return error_trace(r);
         } else {
-                r = manager_start_transient_unit(manager, service->name, service->exec, service->n_exec);
+                r = service_start_transient_unit(service);
                 if (r)
                         return error_trace(r);
         }
@@ -499,6 +626,42 @@ static int manager_on_name_activate(Manager *manager, sd_bus_message *m, const c
         return 0;
 }
 
+static int manager_on_activation_failure(Manager *manager, sd_bus_message *m) {
+        const char *unit, *error_name, *error_message;
+        Service *service = NULL, *entry;
+        CRBNode *node;
+        int r;
+
+        r = sd_bus_message_read(m, "sss", &unit, &error_name, &error_message);
+        if (r < 0)
+                return error_origin(r);
+
+        if (main_arg_verbose)
+                fprintf(stderr, "Activation of '%s' failed: %s\n", unit, error_message);
+
+        /* find the first service of the unit, and fail all of them */
+        node = manager->units.root;
+        while (node) {
+                entry = c_container_of(node, Service, rb_unit);
+                if (strcmp(unit, entry->unit) <= 0) {
+                        service = entry;
+                        node = node->left;
+                } else {
+                        node = node->right;
+                }
+        }
+
+        while (service && !strcmp(service->unit, unit)) {
+                r = service_fail(service);
+                if (r)
+                        return error_trace(r);
+
+                service = c_rbnode_entry(c_rbnode_next(&service->rb_unit), Service, rb_unit);
+        }
+
+        return 0;
+}
+
 static int manager_on_set_activation_environment(Manager *manager, sd_bus_message *m) {
         _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *method_call = NULL;
         int r;
@@ -567,14 +730,57 @@ static int manager_on_message(sd_bus_message *m, void *userdata, sd_bus_error *e
         } else if (strcmp(path, "/org/bus1/DBus/Broker") == 0) {
                 if (sd_bus_message_is_signal(m, "org.bus1.DBus.Broker", "SetActivationEnvironment"))
                         r = manager_on_set_activation_environment(manager, m);
+                else if (sd_bus_message_is_signal(m, "org.bus1.DBus.Broker", "ActivationFailure"))
+                        r = manager_on_activation_failure(manager, m);
         }
 
         return error_trace(r);
 }
 
+static int manager_append_service_limits(sd_bus_message *m, GKeyFile *f, const char *path) {
+        static const struct {
+                const char *name;
+                const char *key;
+        } map[] = {
+                { "ActivationMaxBytes",         "Bytes" },
+                { "ActivationMaxFDs",           "FDs" },
+                { "ActivationMaxMessages",      "Messages" },
+        };
+        GError *error = NULL;
+        guint64 value;
+        int r;
+
+        r = sd_bus_message_open_container(m, 'a', "{su}");
+        if (r < 0)
+                return error_origin(r);
+
+        for (size_t i = 0; i < C_ARRAY_SIZE(map); ++i) {
+                if (!g_key_file_has_key(f, "D-BUS Service", map[i].name, NULL))
+                        continue;
+
+                value = g_key_file_get_uint64(f, "D-BUS Service", map[i].name, &error);
+                if (error || value > UINT32_MAX) {
+                        fprintf(stderr, "Invalid %s in service file '%s'\n", map[i].name, path);
+                        g_clear_error(&error);
+                        continue;
+                }
+
+                r = sd_bus_message_append(m, "{su}", map[i].key, (uint32_t)value);
+                if (r < 0)
+                        return error_origin(r);
+        }
+
+        r = sd_bus_message_close_container(m);
+        if (r < 0)
+                return error_origin(r);
+
+        return 0;
+}
+
 static int manager_load_service(Manager *manager, const char *path) {
         gchar *name = NULL, *user = NULL, *unit = NULL, **exec = NULL;
         gsize n_exec = 0;
+        _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
         _c_cleanup_(service_freep) Service *service = NULL;
         _c_cleanup_(c_freep) char *object_path = NULL;
         GKeyFile *f;
@@ -638,17 +844,30 @@ static int manager_load_service(Manager *manager, const char *path) {
                 goto exit;
         }
 
-        r = sd_bus_call_method(manager->bus_controller,
-                               NULL,
-                               "/org/bus1/DBus/Broker",
-                               "org.bus1.DBus.Broker",
-                               "AddName",
-                               NULL,
-                               NULL,
-                               "osu",
-                               object_path,
-                               service->name,
-                               0);
+        r = sd_bus_message_new_method_call(manager->bus_controller,
+                                           &m,
+                                           NULL,
+                                           "/org/bus1/DBus/Broker",
+                                           "org.bus1.DBus.Broker",
+                                           "AddName");
+        if (r < 0) {
+                r = error_origin(r);
+                goto exit;
+        }
+
+        r = sd_bus_message_append(m, "osu", object_path, service->name, 0);
+        if (r < 0) {
+                r = error_origin(r);
+                goto exit;
+        }
+
+        r = manager_append_service_limits(m, f, path);
+        if (r) {
+                r = error_trace(r);
+                goto exit;
+        }
+
+        r = sd_bus_call(manager->bus_controller, m, 0, NULL, NULL);
         if (r < 0) {
                 r = error_origin(r);
                 goto exit;
@@ -719,12 +938,117 @@ static int manager_load_services(Manager *manager) {
         return 0;
 }
 
+static uint64_t manager_now_usec(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        assert(r >= 0);
+
+        return ts.tv_sec * UINT64_C(1000000) + ts.tv_nsec / UINT64_C(1000);
+}
+
+static const char *manager_map_limit(const char *name) {
+        static const struct {
+                const char *name;
+                const char *key;
+        } map[] = {
+                { "max_bytes",          "Bytes" },
+                { "max_fds",            "FDs" },
+                { "max_matches",        "Matches" },
+                { "max_objects",        "Objects" },
+        };
+
+        for (size_t i = 0; i < C_ARRAY_SIZE(map); ++i)
+                if (!strcmp(name, map[i].name))
+                        return map[i].key;
+
+        return NULL;
+}
+
+static int manager_set_user_limits(Manager *manager, ConfigRoot *root, uint32_t uid) {
+        _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+        ConfigNode *node;
+        const char *key;
+        int r;
+
+        r = sd_bus_message_new_method_call(manager->bus_controller,
+                                           &m,
+                                           NULL,
+                                           "/org/bus1/DBus/Broker",
+                                           "org.bus1.DBus.Broker",
+                                           "SetUserLimits");
+        if (r < 0)
+                return error_origin(r);
+
+        r = sd_bus_message_append(m, "u", uid);
+        if (r < 0)
+                return error_origin(r);
+
+        r = sd_bus_message_open_container(m, 'a', "{su}");
+        if (r < 0)
+                return error_origin(r);
+
+        c_list_for_each_entry(node, &root->node_list, root_link) {
+                if (node->type != CONFIG_NODE_LIMIT || !node->limit.user || node->limit.uid != uid)
+                        continue;
+
+                key = manager_map_limit(node->limit.name);
+                if (!key) {
+                        if (main_arg_verbose)
+                                fprintf(stderr, "Ignoring unsupported per-user limit '%s'\n", node->limit.name);
+                        continue;
+                }
+
+                r = sd_bus_message_append(m, "{su}", key, node->limit.value);
+                if (r < 0)
+                        return error_origin(r);
+        }
+
+        r = sd_bus_message_close_container(m);
+        if (r < 0)
+                return error_origin(r);
+
+        r = sd_bus_call(manager->bus_controller, m, 0, NULL, NULL);
+        if (r < 0)
+                return error_origin(r);
+
+        return 0;
+}
+
+static int manager_add_user_limits(Manager *manager, ConfigRoot *root) {
+        ConfigNode *node, *prev;
+        int r;
+
+        c_list_for_each_entry(node, &root->node_list, root_link) {
+                if (node->type != CONFIG_NODE_LIMIT || !node->limit.user)
+                        continue;
+
+                /* send one set of limits per user, on its first occurrence */
+                c_list_for_each_entry(prev, &root->node_list, root_link) {
+                        if (prev == node ||
+                            (prev->type == CONFIG_NODE_LIMIT && prev->limit.user && prev->limit.uid == node->limit.uid))
+                                break;
+                }
+                if (prev != node)
+                        continue;
+
+                r = manager_set_user_limits(manager, root, node->limit.uid);
+                if (r)
+                        return error_trace(r);
+        }
+
+        return 0;
+}
+
 static int manager_add_listener(Manager *manager) {
         _c_cleanup_(config_parser_deinit) ConfigParser parser = CONFIG_PARSER_NULL(parser);
         _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
         _c_cleanup_(config_root_freep) ConfigRoot *root = NULL;
         _c_cleanup_(policy_deinit) Policy policy = POLICY_INIT(policy);
         const char *policypath;
+        uint64_t start_usec;
+        size_t n_records;
         int r;
 
         if (main_arg_policypath)
@@ -738,15 +1062,23 @@ static int manager_add_listener(Manager *manager) {
 
         config_parser_init(&parser);
 
+        start_usec = manager_now_usec();
+
         r = config_parser_read(&parser, &root, policypath);
         if (r)
                 return error_fold(r);
 
+        if (main_arg_verbose)
+                fprintf(stderr, "Parsed configuration in %" PRIu64 " us\n", manager_now_usec() - start_usec);
+
         r = policy_import(&policy, root);
         if (r)
                 return error_fold(r);
 
+        n_records = policy_count(&policy);
         policy_optimize(&policy);
+        if (main_arg_verbose)
+                fprintf(stderr, "Optimized policy from %zu to %zu records\n", n_records, policy_count(&policy));
 
         r = sd_bus_message_new_method_call(manager->bus_controller,
                                            &m,
@@ -772,6 +1104,10 @@ static int manager_add_listener(Manager *manager) {
         if (r < 0)
                 return error_origin(r);
 
+        r = manager_add_user_limits(manager, root);
+        if (r)
+                return error_trace(r);
+
         return 0;
 }
 
@@ -889,6 +1225,9 @@ static void help(void) {
                "     --listen PATH      Specify path of listener socket\n"
                "  -f --force            Ignore existing listener sockets\n"
                "     --scope SCOPE      Scope of message bus\n"
+               "     --broker PATH      Path of the broker executable\n"
+               "     --config-file PATH Path of the bus configuration file\n"
+               "     --service-dir PATH Directory to load activatable services from\n"
                , program_invocation_short_name);
 }
 
@@ -897,6 +1236,9 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_VERSION = 0x100,
                 ARG_LISTEN,
                 ARG_SCOPE,
+                ARG_BROKER,
+                ARG_CONFIG_FILE,
+                ARG_SERVICE_DIR,
         };
         static const struct option options[] = {
                 { "help",               no_argument,            NULL,   'h'                     },
@@ -905,6 +1247,9 @@ static int parse_argv(int argc, char *argv[]) {
                 { "listen",             required_argument,      NULL,   ARG_LISTEN              },
                 { "force",              no_argument,            NULL,   'f'                     },
                 { "scope",              required_argument,      NULL,   ARG_SCOPE               },
+                { "broker",             required_argument,      NULL,   ARG_BROKER              },
+                { "config-file",        required_argument,      NULL,   ARG_CONFIG_FILE         },
+                { "service-dir",        required_argument,      NULL,   ARG_SERVICE_DIR         },
                 {}
         };
         int c;
@@ -941,6 +1286,18 @@ static int parse_argv(int argc, char *argv[]) {
                         main_arg_scope = optarg;
                         break;
 
+                case ARG_BROKER:
+                        main_arg_broker = optarg;
+                        break;
+
+                case ARG_CONFIG_FILE:
+                        main_arg_policypath = optarg;
+                        break;
+
+                case ARG_SERVICE_DIR:
+                        main_arg_servicedir = optarg;
+                        break;
+
                 case '?':
                         /* getopt_long() prints warning */
                         return MAIN_FAILED;
@@ -216,7 +216,7 @@ static int policy_at_uid(Policy *policy, PolicyNode **nodep, uint32_t uidgid) {
 }
 
 static int policy_at_gid(Policy *policy, PolicyNode **nodep, uint32_t uidgid) {
-        return policy_at_uidgid(&policy->uid_tree, nodep, uidgid);
+        return policy_at_uidgid(&policy->gid_tree, nodep, uidgid);
 }
 
 static void policy_import_verdict(Policy *policy,
@@ -698,6 +698,123 @@ static void policy_optimize_connect(Policy *policy) {
         }
 }
 
+static void policy_list_sort(CList *list) {
+        PolicyRecord *i_record, *t_record, *pos;
+        CList unsorted = C_LIST_INIT(unsorted);
+
+        /*
+         * Sort @list by descending priority. Records are imported in
+         * ascending priority order, so we insert from the front and
+         * usually stop at the first comparison.
+         */
+
+        c_list_splice(&unsorted, list);
+
+        c_list_for_each_entry_safe(i_record, t_record, &unsorted, link) {
+                c_list_unlink(&i_record->link);
+
+                c_list_for_each_entry(pos, list, link)
+                        if (pos->priority < i_record->priority)
+                                break;
+
+                c_list_link_before(&pos->link, &i_record->link);
+        }
+}
+
+static bool policy_string_covers(const char *broad, const char *narrow) {
+        return !broad || (narrow && !strcmp(broad, narrow));
+}
+
+static bool policy_record_own_covers(PolicyRecord *broad, PolicyRecord *narrow) {
+        size_t n;
+
+        if (!broad->own.prefix)
+                return !narrow->own.prefix && !strcmp(broad->own.name, narrow->own.name);
+
+        /*
+         * A prefix covers any name below it, including the name itself. The
+         * empty prefix covers everything.
+         */
+        n = strlen(broad->own.name);
+        return !n ||
+               (!strncmp(broad->own.name, narrow->own.name, n) &&
+                (narrow->own.name[n] == '.' || !narrow->own.name[n]));
+}
+
+static bool policy_record_xmit_covers(PolicyRecord *broad, PolicyRecord *narrow) {
+        return (!broad->xmit.type || broad->xmit.type == narrow->xmit.type) &&
+               broad->xmit.eavesdrop == narrow->xmit.eavesdrop &&
+               policy_string_covers(broad->xmit.name, narrow->xmit.name) &&
+               policy_string_covers(broad->xmit.path, narrow->xmit.path) &&
+               policy_string_covers(broad->xmit.interface, narrow->xmit.interface) &&
+               policy_string_covers(broad->xmit.member, narrow->xmit.member);
+}
+
+static bool policy_list_shadows(CList *list,
+                                PolicyRecord *record,
+                                bool (*covers)(PolicyRecord *broad, PolicyRecord *narrow)) {
+        PolicyRecord *i_record;
+
+        /* @list is sorted, so only the records in front of @record can win */
+        c_list_for_each_entry(i_record, list, link) {
+                if (i_record == record || i_record->priority <= record->priority)
+                        break;
+                if (covers(i_record, record))
+                        return true;
+        }
+
+        return false;
+}
+
+static void policy_list_prune(CList *list,
+                              CList *default_list,
+                              bool (*covers)(PolicyRecord *broad, PolicyRecord *narrow)) {
+        PolicyRecord *i_record, *t_record;
+
+        policy_list_sort(list);
+
+        /*
+         * A record can only ever be the deciding one, if no record with a
+         * higher priority matches a superset of its messages. Equivalent
+         * records are a special case of this, and are merged into the one
+         * with the highest priority. Since a batch is always evaluated
+         * together with the default records, those can shadow records in a
+         * uid or gid list as well.
+         */
+        c_list_for_each_entry_safe(i_record, t_record, list, link)
+                if (policy_list_shadows(list, i_record, covers) ||
+                    (default_list && policy_list_shadows(default_list, i_record, covers)))
+                        policy_record_free(i_record);
+}
+
+static void policy_optimize_own(Policy *policy) {
+        PolicyNode *i_node;
+
+        policy_list_prune(&policy->own_default, NULL, policy_record_own_covers);
+
+        c_rbtree_for_each_entry(i_node, &policy->uid_tree, policy_node)
+                policy_list_prune(&i_node->own_list, &policy->own_default, policy_record_own_covers);
+        c_rbtree_for_each_entry(i_node, &policy->gid_tree, policy_node)
+                policy_list_prune(&i_node->own_list, &policy->own_default, policy_record_own_covers);
+}
+
+static void policy_optimize_xmit(Policy *policy) {
+        PolicyNode *i_node;
+
+        policy_list_prune(&policy->send_default, NULL, policy_record_xmit_covers);
+        policy_list_prune(&policy->recv_default, NULL, policy_record_xmit_covers);
+
+        c_rbtree_for_each_entry(i_node, &policy->uid_tree, policy_node) {
+                policy_list_prune(&i_node->send_list, &policy->send_default, policy_record_xmit_covers);
+                policy_list_prune(&i_node->recv_list, &policy->recv_default, policy_record_xmit_covers);
+        }
+
+        c_rbtree_for_each_entry(i_node, &policy->gid_tree, policy_node) {
+                policy_list_prune(&i_node->send_list, &policy->send_default, policy_record_xmit_covers);
+                policy_list_prune(&i_node->recv_list, &policy->recv_default, policy_record_xmit_covers);
+        }
+}
+
 static void policy_optimize_trim(Policy *policy) {
         PolicyNode *node, *t_node;
 
@@ -722,16 +839,50 @@ static void policy_optimize_trim(Policy *policy) {
                         policy_node_free(node);
 }
 
+static size_t policy_list_count(CList *list) {
+        CList *iter;
+        size_t n = 0;
+
+        c_list_for_each(iter, list)
+                ++n;
+
+        return n;
+}
+
+/**
+ * policy_count() - XXX
+ */
+size_t policy_count(Policy *policy) {
+        PolicyNode *i_node;
+        size_t n;
+
+        n = policy_list_count(&policy->connect_default) +
+            policy_list_count(&policy->own_default) +
+            policy_list_count(&policy->send_default) +
+            policy_list_count(&policy->recv_default);
+
+        c_rbtree_for_each_entry(i_node, &policy->uid_tree, policy_node)
+                n += policy_list_count(&i_node->connect_list) +
+                     policy_list_count(&i_node->own_list) +
+                     policy_list_count(&i_node->send_list) +
+                     policy_list_count(&i_node->recv_list);
+
+        c_rbtree_for_each_entry(i_node, &policy->gid_tree, policy_node)
+                n += policy_list_count(&i_node->connect_list) +
+                     policy_list_count(&i_node->own_list) +
+                     policy_list_count(&i_node->send_list) +
+                     policy_list_count(&i_node->recv_list);
+
+        return n;
+}
+
 /**
  * policy_optimize() - XXX
  */
 void policy_optimize(Policy *policy) {
-        /*
-         * XXX: There are many more optimizations possible. Lets figure out
-         *      which of those are worth it, and then implement them.
-         */
-
         policy_optimize_connect(policy);
+        policy_optimize_own(policy);
+        policy_optimize_xmit(policy);
         policy_optimize_trim(policy);
 }
 
@@ -761,7 +912,32 @@ static int policy_export_connect(Policy *policy, CList *default_list, CList *spe
         return 0;
 }
 
+static PolicyRecord *policy_list_merge_next(CList *list1, CList **iter1, CList *list2, CList **iter2) {
+        PolicyRecord *record1 = NULL, *record2 = NULL;
+
+        /*
+         * Both lists are sorted by descending priority. Pick the next record
+         * of the two, so the exported batch is sorted as a whole.
+         */
+
+        if (list1 && *iter1 != list1)
+                record1 = c_list_entry(*iter1, PolicyRecord, link);
+        if (list2 && *iter2 != list2)
+                record2 = c_list_entry(*iter2, PolicyRecord, link);
+
+        if (record1 && (!record2 || record1->priority > record2->priority)) {
+                *iter1 = (*iter1)->next;
+                return record1;
+        } else if (record2) {
+                *iter2 = (*iter2)->next;
+                return record2;
+        }
+
+        return NULL;
+}
+
 static int policy_export_own(Policy *policy, CList *list1, CList *list2, sd_bus_message *m) {
+        CList *iter1 = list1 ? list1->next : NULL, *iter2 = list2 ? list2->next : NULL;
         PolicyRecord *i_record;
         int r;
 
@@ -769,30 +945,15 @@ static int policy_export_own(Policy *policy, CList *list1, CList *list2, sd_bus_
         if (r < 0)
                 return error_origin(r);
 
-        if (list1) {
-                c_list_for_each_entry(i_record, list1, link) {
-                        r = sd_bus_message_append(m,
-                                                  "(btbs)",
-                                                  i_record->verdict,
-                                                  i_record->priority,
-                                                  i_record->own.prefix,
-                                                  i_record->own.name);
-                        if (r < 0)
-                                return error_origin(r);
-                }
-        }
-
-        if (list2) {
-                c_list_for_each_entry(i_record, list2, link) {
-                        r = sd_bus_message_append(m,
-                                                  "(btbs)",
-                                                  i_record->verdict,
-                                                  i_record->priority,
-                                                  i_record->own.prefix,
-                                                  i_record->own.name);
-                        if (r < 0)
-                                return error_origin(r);
-                }
+        while ((i_record = policy_list_merge_next(list1, &iter1, list2, &iter2))) {
+                r = sd_bus_message_append(m,
+                                          "(btbs)",
+                                          i_record->verdict,
+                                          i_record->priority,
+                                          i_record->own.prefix,
+                                          i_record->own.name);
+                if (r < 0)
+                        return error_origin(r);
         }
 
         r = sd_bus_message_close_container(m);
@@ -803,6 +964,7 @@ static int policy_export_own(Policy *policy, CList *list1, CList *list2, sd_bus_
 }
 
 static int policy_export_xmit(Policy *policy, CList *list1, CList *list2, sd_bus_message *m) {
+        CList *iter1 = list1 ? list1->next : NULL, *iter2 = list2 ? list2->next : NULL;
         PolicyRecord *i_record;
         int r;
 
@@ -810,38 +972,19 @@ static int policy_export_xmit(Policy *policy, CList *list1, CList *list2, sd_bus
         if (r < 0)
                 return error_origin(r);
 
-        if (list1) {
-                c_list_for_each_entry(i_record, list1, link) {
-                        r = sd_bus_message_append(m,
-                                                  "(btssssub)",
-                                                  i_record->verdict,
-                                                  i_record->priority,
-                                                  i_record->xmit.name,
-                                                  i_record->xmit.path,
-                                                  i_record->xmit.interface,
-                                                  i_record->xmit.member,
-                                                  i_record->xmit.type,
-                                                  i_record->xmit.eavesdrop);
-                        if (r < 0)
-                                return error_origin(r);
-                }
-        }
-
-        if (list2) {
-                c_list_for_each_entry(i_record, list2, link) {
-                        r = sd_bus_message_append(m,
-                                                  "(btssssub)",
-                                                  i_record->verdict,
-                                                  i_record->priority,
-                                                  i_record->xmit.name,
-                                                  i_record->xmit.path,
-                                                  i_record->xmit.interface,
-                                                  i_record->xmit.member,
-                                                  i_record->xmit.type,
-                                                  i_record->xmit.eavesdrop);
-                        if (r < 0)
-                                return error_origin(r);
-                }
+        while ((i_record = policy_list_merge_next(list1, &iter1, list2, &iter2))) {
+                r = sd_bus_message_append(m,
+                                          "(btssssub)",
+                                          i_record->verdict,
+                                          i_record->priority,
+                                          i_record->xmit.name,
+                                          i_record->xmit.path,
+                                          i_record->xmit.interface,
+                                          i_record->xmit.member,
+                                          i_record->xmit.type,
+                                          i_record->xmit.eavesdrop);
+                if (r < 0)
+                        return error_origin(r);
         }
 
         r = sd_bus_message_close_container(m);
@@ -119,6 +119,7 @@ void policy_init(Policy *policy);
 void policy_deinit(Policy *policy);
 
 int policy_import(Policy *policy, ConfigRoot *root);
+size_t policy_count(Policy *policy);
 void policy_optimize(Policy *policy);
 int policy_export(Policy *policy, sd_bus_message *m);
 
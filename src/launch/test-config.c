@@ -4,7 +4,12 @@
 
 #include <c-list.h>
 #include <c-macro.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "launch/config.h"
 
 static const char *test_type2str[_CONFIG_NODE_N] = {
@@ -55,11 +60,101 @@ static void test_config(void) {
         config_parser_deinit(&parser);
 }
 
+static void test_write(const char *dir, const char *name, const char *content) {
+        char path[PATH_MAX];
+        FILE *f;
+        int r;
+
+        r = snprintf(path, sizeof(path), "%s/%s", dir, name);
+        assert(r > 0 && r < (int)sizeof(path));
+
+        f = fopen(path, "we");
+        assert(f);
+        fputs(content, f);
+        r = fclose(f);
+        assert(!r);
+}
+
+static void test_include(void) {
+        _c_cleanup_(config_parser_deinit) ConfigParser parser = CONFIG_PARSER_NULL(parser);
+        _c_cleanup_(config_root_freep) ConfigRoot *root = NULL;
+        const char *includes[64], *allows[64];
+        char dir[] = "/tmp/test-config-XXXXXX", subdir[64], path[PATH_MAX], name[64], content[256];
+        size_t i, n_includes = 0, n_allows = 0;
+        ConfigNode *i_node;
+        int r;
+
+        /*
+         * Parse a config with a directory of included files, and verify their
+         * contents end up right behind the respective include-node, in the
+         * same order as the include-nodes themselves.
+         */
+
+        assert(mkdtemp(dir));
+        snprintf(subdir, sizeof(subdir), "%s/d", dir);
+        r = mkdir(subdir, 0700);
+        assert(!r);
+
+        snprintf(content, sizeof(content),
+                 "<busconfig>"
+                 "<includedir>d</includedir>"
+                 "<include>%s/last.conf</include>"
+                 "</busconfig>",
+                 dir);
+        test_write(dir, "main.conf", content);
+        test_write(dir, "last.conf",
+                   "<busconfig><policy context=\"default\"><allow own=\"last\"/></policy></busconfig>");
+
+        for (i = 0; i < 32; ++i) {
+                snprintf(name, sizeof(name), "%02zu.conf", i);
+                snprintf(content, sizeof(content),
+                         "<busconfig><policy context=\"default\"><allow own=\"name.%zu\"/></policy></busconfig>",
+                         i);
+                test_write(subdir, name, content);
+        }
+
+        snprintf(path, sizeof(path), "%s/main.conf", dir);
+
+        config_parser_init(&parser);
+
+        r = config_parser_read(&parser, &root, path);
+        assert(!r);
+
+        c_list_for_each_entry(i_node, &root->node_list, root_link) {
+                if (i_node->type == CONFIG_NODE_INCLUDE && i_node->parent) {
+                        assert(n_includes < C_ARRAY_SIZE(includes));
+                        includes[n_includes++] = i_node->include.file->path;
+                } else if (i_node->type == CONFIG_NODE_ALLOW) {
+                        assert(n_allows < C_ARRAY_SIZE(allows));
+                        allows[n_allows++] = i_node->file;
+                }
+        }
+
+        assert(n_includes == 33);
+        assert(n_allows == 33);
+        for (i = 0; i < n_includes; ++i)
+                assert(!strcmp(includes[i], allows[i]));
+        assert(strstr(allows[32], "/last.conf"));
+
+        for (i = 0; i < 32; ++i) {
+                snprintf(path, sizeof(path), "%s/%02zu.conf", subdir, i);
+                unlink(path);
+        }
+        rmdir(subdir);
+        snprintf(path, sizeof(path), "%s/last.conf", dir);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/main.conf", dir);
+        unlink(path);
+        rmdir(dir);
+}
+
 int main(int argc, char **argv) {
-        if (argc < 2)
+        if (argc < 2) {
                 test_config();
-        else
+                test_include();
+        } else {
                 print_config(argv[1]);
+        }
 
         return 0;
 }
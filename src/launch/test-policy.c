@@ -0,0 +1,278 @@
+/*
+ * Test Policy Converter
+ */
+
+#include <c-list.h>
+#include <c-macro.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <systemd/sd-bus.h>
+#include <unistd.h>
+#include "launch/config.h"
+#include "launch/policy.h"
+
+#define TEST_POLICY_T_BATCH                                                     \
+                "bt"                                                            \
+                "a(btbs)"                                                       \
+                "a(btssssub)"                                                   \
+                "a(btssssub)"
+
+#define TEST_POLICY_T                                                           \
+                "(" TEST_POLICY_T_BATCH ")"                                     \
+                "a(u(" TEST_POLICY_T_BATCH "))"                                 \
+                "a(u(" TEST_POLICY_T_BATCH "))"                                 \
+                "a(ss)"
+
+static void test_import(Policy *policy, ConfigRoot **rootp, const char *content) {
+        _c_cleanup_(config_parser_deinit) ConfigParser parser = CONFIG_PARSER_NULL(parser);
+        char path[] = "/tmp/test-policy-XXXXXX";
+        ssize_t n;
+        int r, fd;
+
+        fd = mkstemp(path);
+        assert(fd >= 0);
+        n = write(fd, content, strlen(content));
+        assert(n == (ssize_t)strlen(content));
+        close(fd);
+
+        config_parser_init(&parser);
+
+        r = config_parser_read(&parser, rootp, path);
+        assert(!r);
+
+        unlink(path);
+
+        r = policy_import(policy, *rootp);
+        assert(!r);
+}
+
+static const char *test_interface(PolicyRecord *record) {
+        return record->xmit.interface ?: "*";
+}
+
+static void test_optimize_xmit(void) {
+        _c_cleanup_(config_root_freep) ConfigRoot *root = NULL;
+        _c_cleanup_(policy_deinit) Policy policy = POLICY_INIT(policy);
+        const char *expected[] = { "org.example.Baz", "org.example.Bar", "*" };
+        PolicyRecord *record, *previous = NULL;
+        size_t i = 0;
+
+        /*
+         * Import a default send policy, where records are shadowed by a broad
+         * record of higher priority, or are duplicates of a later record.
+         * Verify only the deciding records survive, sorted by descending
+         * priority.
+         */
+        test_import(&policy, &root,
+                    "<busconfig>"
+                    "<policy context=\"default\">"
+                    "<deny send_interface=\"org.example.Foo\"/>"
+                    "<allow send_destination=\"*\"/>"
+                    "<deny send_interface=\"org.example.Bar\"/>"
+                    "<deny send_interface=\"org.example.Baz\" send_member=\"Qux\"/>"
+                    "<deny send_interface=\"org.example.Baz\" send_member=\"Qux\"/>"
+                    "</policy>"
+                    "</busconfig>");
+
+        assert(policy_count(&policy) == 6);
+        policy_optimize(&policy);
+        assert(policy_count(&policy) == 4);
+
+        c_list_for_each_entry(record, &policy.send_default, link) {
+                assert(i < C_ARRAY_SIZE(expected));
+                assert(!strcmp(test_interface(record), expected[i++]));
+                assert(!previous || previous->priority > record->priority);
+                previous = record;
+        }
+        assert(i == C_ARRAY_SIZE(expected));
+}
+
+static void test_optimize_own(void) {
+        _c_cleanup_(config_root_freep) ConfigRoot *root = NULL;
+        _c_cleanup_(policy_deinit) Policy policy = POLICY_INIT(policy);
+        PolicyRecord *record;
+        size_t n = 0;
+
+        /*
+         * A prefix covers all names below it, but not names that merely
+         * share its characters. A plain name only covers itself.
+         */
+        test_import(&policy, &root,
+                    "<busconfig>"
+                    "<policy context=\"default\">"
+                    "<deny own=\"org.example.Foo\"/>"
+                    "<deny own=\"org.example.FooBar\"/>"
+                    "<allow own_prefix=\"org.example.Foo\"/>"
+                    "<deny own=\"org.example\"/>"
+                    "</policy>"
+                    "</busconfig>");
+
+        policy_optimize(&policy);
+
+        c_list_for_each_entry(record, &policy.own_default, link) {
+                assert(strcmp(record->own.name, "org.example.Foo") || record->own.prefix);
+                ++n;
+        }
+        assert(n == 3);
+}
+
+static void test_optimize_default(void) {
+        _c_cleanup_(config_root_freep) ConfigRoot *root = NULL;
+        _c_cleanup_(policy_deinit) Policy policy = POLICY_INIT(policy);
+        PolicyRecord *record;
+
+        /*
+         * Default records are part of every batch, so a broad mandatory
+         * record shadows group records, as well as default records of lower
+         * priority. Groups left without records are dropped entirely.
+         */
+        test_import(&policy, &root,
+                    "<busconfig>"
+                    "<policy group=\"root\">"
+                    "<deny send_interface=\"org.example.Foo\"/>"
+                    "</policy>"
+                    "<policy context=\"default\">"
+                    "<allow send_destination=\"*\"/>"
+                    "</policy>"
+                    "<policy context=\"mandatory\">"
+                    "<deny send_interface=\"*\"/>"
+                    "</policy>"
+                    "</busconfig>");
+
+        assert(!c_rbtree_is_empty(&policy.gid_tree));
+        policy_optimize(&policy);
+        assert(c_rbtree_is_empty(&policy.gid_tree));
+
+        record = c_list_first_entry(&policy.send_default, PolicyRecord, link);
+        assert(record);
+        assert(record == c_list_last_entry(&policy.send_default, PolicyRecord, link));
+        assert(!record->verdict);
+}
+
+static void test_export_batch(sd_bus_message *m, const char **expected, size_t n_expected) {
+        const char *name, *path, *interface, *member;
+        uint64_t priority, previous;
+        unsigned int type;
+        size_t i = 0;
+        int r, verdict, eavesdrop;
+
+        r = sd_bus_message_enter_container(m, 'r', TEST_POLICY_T_BATCH);
+        assert(r > 0);
+
+        r = sd_bus_message_skip(m, "bta(btbs)");
+        assert(r >= 0);
+
+        r = sd_bus_message_enter_container(m, 'a', "(btssssub)");
+        assert(r > 0);
+
+        previous = UINT64_MAX;
+        while ((r = sd_bus_message_read(m, "(btssssub)", &verdict, &priority, &name, &path, &interface, &member, &type, &eavesdrop)) > 0) {
+                assert(priority < previous);
+                previous = priority;
+
+                if (expected) {
+                        assert(i < n_expected);
+                        assert(!strcmp(*interface ? interface : "*", expected[i]));
+                }
+                ++i;
+        }
+        assert(r >= 0);
+        assert(!expected || i == n_expected);
+
+        r = sd_bus_message_exit_container(m);
+        assert(r >= 0);
+
+        r = sd_bus_message_skip(m, "a(btssssub)");
+        assert(r >= 0);
+
+        r = sd_bus_message_exit_container(m);
+        assert(r >= 0);
+}
+
+static void test_export(void) {
+        _c_cleanup_(config_root_freep) ConfigRoot *root = NULL;
+        _c_cleanup_(policy_deinit) Policy policy = POLICY_INIT(policy);
+        _c_cleanup_(sd_bus_unrefp) sd_bus *bus = NULL;
+        _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+        _c_cleanup_(c_closep) int fd = -1;
+        const char *expected_default[] = { "org.example.Bar", "*" };
+        const char *expected_root[] = { "org.example.Baz", "org.example.Bar", "*" };
+        uint32_t uid;
+        int r, pair[2];
+
+        /*
+         * Export a policy and verify the send records of each batch are sorted
+         * by descending priority. The batch of a user contains the default
+         * records as well, behind its own records, which always have higher
+         * priority.
+         */
+        test_import(&policy, &root,
+                    "<busconfig>"
+                    "<policy context=\"default\">"
+                    "<allow send_destination=\"*\"/>"
+                    "<deny send_interface=\"org.example.Bar\"/>"
+                    "</policy>"
+                    "<policy user=\"root\">"
+                    "<deny send_interface=\"org.example.Baz\"/>"
+                    "</policy>"
+                    "</busconfig>");
+
+        policy_optimize(&policy);
+
+        r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, pair);
+        assert(r >= 0);
+        fd = pair[1];
+
+        r = sd_bus_new(&bus);
+        assert(r >= 0);
+        r = sd_bus_set_fd(bus, pair[0], pair[0]);
+        assert(r >= 0);
+        r = sd_bus_start(bus);
+        assert(r >= 0);
+
+        r = sd_bus_message_new_method_call(bus, &m, NULL, "/org/bus1/DBus/Listener/0", NULL, "Test");
+        assert(r >= 0);
+
+        r = policy_export(&policy, m);
+        assert(!r);
+
+        r = sd_bus_message_seal(m, 1, 0);
+        assert(r >= 0);
+        r = sd_bus_message_rewind(m, true);
+        assert(r >= 0);
+
+        r = sd_bus_message_enter_container(m, 'v', "(" TEST_POLICY_T ")");
+        assert(r > 0);
+        r = sd_bus_message_enter_container(m, 'r', TEST_POLICY_T);
+        assert(r > 0);
+
+        test_export_batch(m, expected_default, C_ARRAY_SIZE(expected_default));
+
+        r = sd_bus_message_enter_container(m, 'a', "(u(" TEST_POLICY_T_BATCH "))");
+        assert(r > 0);
+
+        while ((r = sd_bus_message_enter_container(m, 'r', "u(" TEST_POLICY_T_BATCH ")")) > 0) {
+                r = sd_bus_message_read(m, "u", &uid);
+                assert(r > 0);
+
+                if (uid == 0)
+                        test_export_batch(m, expected_root, C_ARRAY_SIZE(expected_root));
+                else
+                        test_export_batch(m, NULL, 0);
+
+                r = sd_bus_message_exit_container(m);
+                assert(r >= 0);
+        }
+        assert(r >= 0);
+}
+
+int main(int argc, char **argv) {
+        test_optimize_xmit();
+        test_optimize_own();
+        test_optimize_default();
+        test_export();
+        return 0;
+}
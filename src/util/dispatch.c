@@ -49,6 +49,7 @@
 #include <sys/epoll.h>
 #include "util/dispatch.h"
 #include "util/error.h"
+#include "util/recorder.h"
 
 /**
  * dispatch_file_init() - initialize dispatch file
@@ -100,6 +101,8 @@ int dispatch_file_init(DispatchFile *file,
         file->context = ctx;
         file->ready_link = (CList)C_LIST_INIT(file->ready_link);
         file->fn = fn;
+        file->name = NULL;
+        file->id = 0;
         file->fd = fd;
         file->user_mask = 0;
         file->kernel_mask = mask;
@@ -299,6 +302,55 @@ int dispatch_context_poll(DispatchContext *ctx, int timeout) {
         return 0;
 }
 
+static size_t dispatch_stats_bucket(uint64_t duration) {
+        uint64_t usec = duration / 1000;
+
+        /*
+         * Bucket 0 covers everything below one micro second, bucket @i covers
+         * [2^(i-1), 2^i) micro seconds. The last bucket collects everything
+         * beyond.
+         */
+        if (!usec)
+                return 0;
+
+        return c_min((size_t)(64 - __builtin_clzll(usec)), (size_t)DISPATCH_HISTOGRAM_N - 1);
+}
+
+static void dispatch_stats_add_callback(DispatchContext *ctx,
+                                        uint64_t timestamp,
+                                        uint64_t duration,
+                                        const char *name,
+                                        uint64_t id,
+                                        uint32_t events) {
+        DispatchStats *stats = &ctx->stats;
+        DispatchStall *stall;
+
+        ++stats->n_callbacks;
+        ++stats->callback_histogram[dispatch_stats_bucket(duration)];
+        stats->callback_max = c_max(stats->callback_max, duration);
+
+        if (duration < stats->threshold)
+                return;
+
+        stall = &stats->stalls[stats->n_stalls++ & (DISPATCH_STALLS_N - 1)];
+        stall->timestamp = timestamp;
+        stall->duration = duration;
+        stall->name = name;
+        stall->id = id;
+        stall->events = events;
+
+        if (ctx->recorder)
+                recorder_record(ctx->recorder, RECORDER_EVENT_STALL, id, 0, events, duration);
+}
+
+static void dispatch_stats_add_round(DispatchContext *ctx, uint64_t duration) {
+        DispatchStats *stats = &ctx->stats;
+
+        ++stats->n_rounds;
+        ++stats->round_histogram[dispatch_stats_bucket(duration)];
+        stats->round_max = c_max(stats->round_max, duration);
+}
+
 /**
  * dispatch_context_dispatch() - dispatch pending events
  * @ctx:                dispatch context
@@ -307,6 +359,11 @@ int dispatch_context_poll(DispatchContext *ctx, int timeout) {
  * dispatches all pending events and calls into the callbacks of the respective
  * dispatch-file.
  *
+ * The duration of the round, excluding the time spent polling, as well as the
+ * duration of each callback are accounted in @ctx->stats. Any callback that
+ * took longer than the configured threshold is recorded as stall, together
+ * with the identity of its file and the events it was dispatched for.
+ *
  * The first non-zero return code of any dispatch-file callback will break the
  * loop and cause a propagation of that error code to the caller.
  *
@@ -316,12 +373,17 @@ int dispatch_context_poll(DispatchContext *ctx, int timeout) {
 int dispatch_context_dispatch(DispatchContext *ctx) {
         CList todo = (CList)C_LIST_INIT(todo);
         DispatchFile *file;
+        uint64_t start, before, after, id;
+        uint32_t n_dispatched = 0, events;
+        const char *name;
         int r;
 
         r = dispatch_context_poll(ctx, c_list_is_empty(&ctx->ready_list) ? -1 : 0);
         if (r)
                 return error_fold(r);
 
+        start = after = recorder_get_time();
+
         /*
          * We want to dispatch @ctx->ready_list exactly once here. The trivial
          * approach would be to iterate it via c_list_for_each(). However, we
@@ -341,13 +403,33 @@ int dispatch_context_dispatch(DispatchContext *ctx) {
                 c_list_unlink(&file->ready_link);
                 c_list_link_tail(&ctx->ready_list, &file->ready_link);
 
+                /*
+                 * The callback might destroy @file, so remember its identity
+                 * beforehand. The end of the previous callback serves as
+                 * start of this one, to avoid querying the clock twice.
+                 */
+                name = file->name;
+                id = file->id;
+                events = dispatch_file_events(file);
+                before = after;
+
+                ++n_dispatched;
                 r = file->fn(file);
+
+                after = recorder_get_time();
+                dispatch_stats_add_callback(ctx, before, after - before, name, id, events);
+
                 if (error_trace(r)) {
                         c_list_splice(&ctx->ready_list, &todo);
                         break;
                 }
         }
 
+        dispatch_stats_add_round(ctx, after - start);
+
+        if (ctx->recorder)
+                recorder_record(ctx->recorder, RECORDER_EVENT_LOOP, 0, 0, n_dispatched, after - start);
+
         assert(c_list_is_empty(&todo));
         return r;
 }
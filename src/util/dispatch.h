@@ -18,6 +18,9 @@ enum {
 
 typedef struct DispatchContext DispatchContext;
 typedef struct DispatchFile DispatchFile;
+typedef struct DispatchStall DispatchStall;
+typedef struct DispatchStats DispatchStats;
+typedef struct Recorder Recorder;
 typedef int (*DispatchFn) (DispatchFile *file);
 
 /* files */
@@ -26,6 +29,8 @@ struct DispatchFile {
         DispatchContext *context;
         CList ready_link;
         DispatchFn fn;
+        const char *name;
+        uint64_t id;
 
         int fd;
         uint32_t user_mask;
@@ -50,17 +55,53 @@ void dispatch_file_select(DispatchFile *file, uint32_t mask);
 void dispatch_file_deselect(DispatchFile *file, uint32_t mask);
 void dispatch_file_clear(DispatchFile *file, uint32_t mask);
 
+/* statistics */
+
+#define DISPATCH_HISTOGRAM_N (24)
+#define DISPATCH_STALLS_N (16U) /* must be a power of 2 */
+#define DISPATCH_STALL_THRESHOLD_DEFAULT (UINT64_C(10) * 1000 * 1000) /* 10ms */
+
+struct DispatchStall {
+        uint64_t timestamp;
+        uint64_t duration;
+        const char *name;
+        uint64_t id;
+        uint32_t events;
+};
+
+struct DispatchStats {
+        uint64_t threshold;
+
+        uint64_t n_rounds;
+        uint64_t round_max;
+        uint64_t round_histogram[DISPATCH_HISTOGRAM_N];
+
+        uint64_t n_callbacks;
+        uint64_t callback_max;
+        uint64_t callback_histogram[DISPATCH_HISTOGRAM_N];
+
+        uint64_t n_stalls;
+        DispatchStall stalls[DISPATCH_STALLS_N];
+};
+
+#define DISPATCH_STATS_INIT {                                   \
+                .threshold = DISPATCH_STALL_THRESHOLD_DEFAULT,  \
+        }
+
 /* contexts */
 
 struct DispatchContext {
         CList ready_list;
         int epoll_fd;
         size_t n_files;
+        Recorder *recorder;
+        DispatchStats stats;
 };
 
 #define DISPATCH_CONTEXT_NULL(_x) {                             \
                 .ready_list = C_LIST_INIT((_x).ready_list),     \
                 .epoll_fd = -1,                                 \
+                .stats = DISPATCH_STATS_INIT,                   \
         }
 
 int dispatch_context_init(DispatchContext *ctx);
@@ -74,3 +115,31 @@ int dispatch_context_dispatch(DispatchContext *ctx);
 static inline uint32_t dispatch_file_events(DispatchFile *file) {
         return file->events & file->user_mask;
 }
+
+/**
+ * dispatch_file_set_name() - set identity of dispatch file
+ * @file:               dispatch file
+ * @name:               static name describing the owner of @file
+ * @id:                 owner specific id
+ *
+ * This sets the identity reported for @file when one of its callbacks stalls
+ * the dispatcher. @name must be a static string, it is not copied.
+ */
+static inline void dispatch_file_set_name(DispatchFile *file, const char *name, uint64_t id) {
+        file->name = name;
+        file->id = id;
+}
+
+/**
+ * dispatch_stats_get_stall() - fetch recorded stall
+ * @stats:              statistics to query
+ * @i:                  index of the stall, 0 being the most recent one
+ *
+ * Return: The @i-th most recent stall, or NULL if there is none.
+ */
+static inline DispatchStall *dispatch_stats_get_stall(DispatchStats *stats, size_t i) {
+        if (i >= c_min(stats->n_stalls, (uint64_t)DISPATCH_STALLS_N))
+                return NULL;
+
+        return &stats->stalls[(stats->n_stalls - 1 - i) & (DISPATCH_STALLS_N - 1)];
+}
@@ -7,6 +7,11 @@
  *
  * Furthermore, the FDList object is meant as supplement for AF_UNIX sockets.
  * Hence, it stores FDs as a cmsghdr entry, ready to be used with sendmsg(2).
+ *
+ * Most messages that carry FDs only carry a handful of them. To avoid hitting
+ * the allocator for each of those, small lists are allocated with a fixed
+ * capacity of their size class, and cached in a per-thread pool when freed.
+ * Lists that exceed all size classes are allocated and freed directly.
  */
 
 #include <c-macro.h>
@@ -15,6 +20,67 @@
 #include "util/error.h"
 #include "util/fdlist.h"
 
+static const size_t fdlist_pool_capacity[_FDLIST_POOL_N] = {
+        [FDLIST_POOL_SMALL] = 4,
+        [FDLIST_POOL_MEDIUM] = 16,
+};
+
+static _Thread_local struct {
+        FDList *lists[_FDLIST_POOL_N][FDLIST_POOL_MAX];
+        size_t n_lists[_FDLIST_POOL_N];
+        FDListStats stats;
+} fdlist_pool;
+
+static size_t fdlist_size(size_t n_fds) {
+        return sizeof(FDList) + CMSG_SPACE(n_fds * sizeof(int));
+}
+
+static FDList *fdlist_alloc(size_t n_fds) {
+        FDList *list;
+        size_t i;
+
+        for (i = 0; i < _FDLIST_POOL_N; ++i) {
+                if (n_fds > fdlist_pool_capacity[i])
+                        continue;
+
+                if (fdlist_pool.n_lists[i]) {
+                        list = fdlist_pool.lists[i][--fdlist_pool.n_lists[i]];
+                        ++fdlist_pool.stats.n_recycled;
+                } else {
+                        list = malloc(fdlist_size(fdlist_pool_capacity[i]));
+                        if (!list)
+                                return NULL;
+
+                        ++fdlist_pool.stats.n_allocs;
+                }
+
+                list->pool = i + 1;
+                return list;
+        }
+
+        list = malloc(fdlist_size(n_fds));
+        if (!list)
+                return NULL;
+
+        ++fdlist_pool.stats.n_allocs;
+        list->pool = 0;
+        return list;
+}
+
+static void fdlist_release(FDList *list) {
+        size_t i;
+
+        if (list->pool) {
+                i = list->pool - 1;
+                if (fdlist_pool.n_lists[i] < FDLIST_POOL_MAX) {
+                        fdlist_pool.lists[i][fdlist_pool.n_lists[i]++] = list;
+                        return;
+                }
+        }
+
+        free(list);
+}
+
 /**
  * fdlist_new_with_fds() - create fdlist with a set of FDs
  * @listp:              output for new fdlist
@@ -29,7 +95,7 @@
 int fdlist_new_with_fds(FDList **listp, const int *fds, size_t n_fds) {
         FDList *list;
 
-        list = malloc(sizeof(*list) + CMSG_SPACE(n_fds * sizeof(int)));
+        list = fdlist_alloc(n_fds);
         if (!list)
                 return error_origin(-ENOMEM);
 
@@ -88,7 +154,7 @@ FDList *fdlist_free(FDList *list) {
                         for (i = 0; i < n; ++i)
                                 c_close(p[i]);
 
-                free(list);
+                fdlist_release(list);
         }
 
         return NULL;
@@ -146,3 +212,28 @@ int fdlist_steal(FDList *list, size_t index) {
 
         return fd;
 }
+
+/**
+ * fdlist_get_stats() - query allocation statistics
+ * @stats:              output for the statistics
+ *
+ * This returns the number of fdlists allocated from the heap, and the number
+ * of fdlists recycled from the pool, by the calling thread.
+ */
+void fdlist_get_stats(FDListStats *stats) {
+        *stats = fdlist_pool.stats;
+}
+
+/**
+ * fdlist_flush() - release pooled fdlists
+ *
+ * This frees all fdlists cached in the pool of the calling thread. Threads
+ * that created fdlists should call this before exiting.
+ */
+void fdlist_flush(void) {
+        size_t i;
+
+        for (i = 0; i < _FDLIST_POOL_N; ++i)
+                while (fdlist_pool.n_lists[i])
+                        free(fdlist_pool.lists[i][--fdlist_pool.n_lists[i]]);
+}
@@ -5,22 +5,41 @@
  */
 
 #include <c-macro.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 
 typedef struct FDList FDList;
+typedef struct FDListStats FDListStats;
+
+enum {
+        FDLIST_POOL_SMALL,
+        FDLIST_POOL_MEDIUM,
+        _FDLIST_POOL_N,
+};
+
+#define FDLIST_POOL_MAX (16)
 
 struct FDList {
         bool consumed : 1;
+        unsigned int pool : 2;
         struct cmsghdr cmsg[];
 };
 
+struct FDListStats {
+        uint64_t n_allocs;
+        uint64_t n_recycled;
+};
+
 int fdlist_new_with_fds(FDList **listp, const int *fds, size_t n_fds);
 int fdlist_new_consume_fds(FDList **listp, const int *fds, size_t n_fds);
 FDList *fdlist_free(FDList *list);
 void fdlist_truncate(FDList *list, size_t n_fds);
 int fdlist_steal(FDList *list, size_t index);
 
+void fdlist_get_stats(FDListStats *stats);
+void fdlist_flush(void);
+
 C_DEFINE_CLEANUP(FDList *, fdlist_free);
 
 /* inline helpers */
@@ -0,0 +1,113 @@
+/*
+ * Flight Recorder
+ *
+ * The flight recorder keeps the most recent events of the broker in a
+ * fixed-size ring buffer, so they can be inspected after the fact, for
+ * instance when the bus stalled. Recording an event is a matter of filling in
+ * a slot of the ring, it never allocates and never fails. As the broker is
+ * single-threaded, no locking is needed either.
+ *
+ * The ring can be dumped to a file-descriptor at any time. The dump consists
+ * of a RecorderFileHeader, followed by the recorded events, oldest first. All
+ * values are in native byte-order.
+ */
+
+#include <c-macro.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "util/error.h"
+#include "util/recorder.h"
+
+static_assert(!(RECORDER_N_EVENTS & (RECORDER_N_EVENTS - 1)),
+              "Recorder size must be a power of 2");
+static_assert(sizeof(RecorderEvent) == 32,
+              "Unexpected padding in recorder events");
+
+void recorder_init(Recorder *recorder) {
+        *recorder = (Recorder)RECORDER_INIT;
+}
+
+void recorder_deinit(Recorder *recorder) {
+        recorder_init(recorder);
+}
+
+/**
+ * recorder_get_time() - get the current monotonic time
+ *
+ * Return: the timestamp in nano seconds.
+ */
+uint64_t recorder_get_time(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        assert(r >= 0);
+
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static int recorder_write(int fd, const void *data, size_t n_data) {
+        ssize_t l;
+
+        while (n_data) {
+                l = write(fd, data, n_data);
+                if (l < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        return RECORDER_E_IO;
+                }
+
+                data = (const char *)data + l;
+                n_data -= l;
+        }
+
+        return 0;
+}
+
+/**
+ * recorder_dump() - write recorded events to a file
+ * @recorder:           recorder to operate on
+ * @fd:                 file-descriptor to write to
+ *
+ * This writes a file header, followed by all events currently stored in
+ * @recorder, oldest first, to @fd. The recorder itself is not modified.
+ *
+ * Return: 0 on success, RECORDER_E_IO if writing to @fd failed, negative
+ *         error code on failure.
+ */
+int recorder_dump(Recorder *recorder, int fd) {
+        RecorderFileHeader header = {
+                .version = RECORDER_FILE_VERSION,
+                .timestamp = recorder_get_time(),
+                .n_total = recorder->n_total,
+        };
+        size_t head, n_head;
+        int r;
+
+        memcpy(header.magic, RECORDER_FILE_MAGIC, sizeof(header.magic));
+        header.n_events = c_min(recorder->n_total, (uint64_t)RECORDER_N_EVENTS);
+
+        r = recorder_write(fd, &header, sizeof(header));
+        if (r)
+                return error_trace(r);
+
+        /*
+         * If the ring wrapped, the oldest event is at the head position, so
+         * write the tail of the array first, then the front.
+         */
+        head = recorder->n_total & (RECORDER_N_EVENTS - 1);
+        n_head = (recorder->n_total > RECORDER_N_EVENTS) ? RECORDER_N_EVENTS - head : 0;
+
+        r = recorder_write(fd, recorder->events + head, n_head * sizeof(RecorderEvent));
+        if (r)
+                return error_trace(r);
+
+        r = recorder_write(fd, recorder->events, (header.n_events - n_head) * sizeof(RecorderEvent));
+        if (r)
+                return error_trace(r);
+
+        return 0;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+/*
+ * Flight Recorder
+ */
+
+#include <c-macro.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct Recorder Recorder;
+typedef struct RecorderEvent RecorderEvent;
+typedef struct RecorderFileHeader RecorderFileHeader;
+
+#define RECORDER_N_EVENTS (4096U) /* must be a power of 2 */
+#define RECORDER_FILE_MAGIC "DBRECORD"
+#define RECORDER_FILE_VERSION (1U)
+
+enum {
+        _RECORDER_E_SUCCESS,
+
+        RECORDER_E_IO,
+};
+
+enum {
+        RECORDER_EVENT_INVALID,
+        RECORDER_EVENT_CONNECT,
+        RECORDER_EVENT_GOODBYE,
+        RECORDER_EVENT_DISPATCH,
+        RECORDER_EVENT_BROADCAST,
+        RECORDER_EVENT_QUOTA,
+        RECORDER_EVENT_DENIED,
+        RECORDER_EVENT_LOOP,
+        RECORDER_EVENT_STALL,
+        _RECORDER_EVENT_N,
+};
+
+struct RecorderEvent {
+        uint64_t timestamp;
+        uint64_t id;
+        uint64_t value;
+        uint32_t serial;
+        uint8_t type;
+        uint8_t message_type;
+        uint16_t reserved;
+};
+
+struct RecorderFileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t n_events;
+        uint64_t timestamp;
+        uint64_t n_total;
+};
+
+struct Recorder {
+        uint64_t n_total;
+        RecorderEvent events[RECORDER_N_EVENTS];
+};
+
+#define RECORDER_INIT {}
+
+void recorder_init(Recorder *recorder);
+void recorder_deinit(Recorder *recorder);
+
+uint64_t recorder_get_time(void);
+int recorder_dump(Recorder *recorder, int fd);
+
+/* inline helpers */
+
+/**
+ * recorder_record() - record an event
+ * @recorder:           recorder to operate on
+ * @type:               event type
+ * @id:                 peer id the event belongs to
+ * @message_type:       message type, or 0
+ * @serial:             message serial, or 0
+ * @value:              type specific value
+ *
+ * This stores a new event in the ring buffer of @recorder, overwriting the
+ * oldest event if the buffer is full. This never fails and never allocates,
+ * so it is suitable to be called from hot paths.
+ */
+static inline void recorder_record(Recorder *recorder,
+                                   unsigned int type,
+                                   uint64_t id,
+                                   unsigned int message_type,
+                                   uint32_t serial,
+                                   uint64_t value) {
+        RecorderEvent *event = &recorder->events[recorder->n_total++ & (RECORDER_N_EVENTS - 1)];
+
+        event->timestamp = recorder_get_time();
+        event->id = id;
+        event->value = value;
+        event->serial = serial;
+        event->type = type;
+        event->message_type = message_type;
+        event->reserved = 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+/*
+ * Reference Counting
+ *
+ * The broker runs all of its objects on a single thread, so there is no need
+ * to pay for atomic operations whenever a reference is taken or dropped. This
+ * is most noticeable on broadcasts, where every receiver takes a reference to
+ * the message when it is queued, and drops it once it was written.
+ *
+ * Hence, this provides a reference counter with the same semantics as c-ref,
+ * but it compiles to plain increments and decrements. If objects are ever
+ * shared across threads, build with REF_ATOMIC to get the c-ref behavior.
+ */
+
+#include <c-macro.h>
+#include <c-ref.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#if defined(REF_ATOMIC)
+typedef _Atomic unsigned long Ref;
+#else
+typedef unsigned long Ref;
+#endif
+
+typedef void (*RefFn) (Ref *ref, void *userdata);
+
+#define REF_INIT (1UL)
+
+/**
+ * ref_inc() - acquire reference
+ * @ref:                reference counter to operate on
+ *
+ * Return: @ref is returned.
+ */
+static inline Ref *ref_inc(Ref *ref) {
+#if defined(REF_ATOMIC)
+        return c_ref_inc(ref);
+#else
+        assert(*ref > 0 && *ref < ULONG_MAX);
+        ++*ref;
+        return ref;
+#endif
+}
+
+/**
+ * ref_dec() - release reference
+ * @ref:                reference counter to operate on
+ * @fn:                 function to call when the last reference is dropped
+ * @userdata:           userdata to pass to @fn
+ *
+ * Return: NULL is returned.
+ */
+static inline Ref *ref_dec(Ref *ref, RefFn fn, void *userdata) {
+#if defined(REF_ATOMIC)
+        return c_ref_dec(ref, fn, userdata);
+#else
+        assert(*ref > 0);
+        if (!--*ref && fn)
+                fn(ref, userdata);
+        return NULL;
+#endif
+}
@@ -5,9 +5,11 @@
 #include <c-macro.h>
 #include <linux/sockios.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <time.h>
 #include "util/dispatch.h"
 
 static void q_assert(int s, bool has_in, bool has_out) {
@@ -206,8 +208,111 @@ static void test_uds_edge(unsigned int run) {
         c_close(s[0]);
 }
 
+static int test_stats_fn(DispatchFile *file) {
+        struct timespec ts = { .tv_nsec = 2 * DISPATCH_STALL_THRESHOLD_DEFAULT };
+        char b;
+        int r;
+
+        r = recv(file->fd, &b, sizeof(b), MSG_DONTWAIT);
+        assert(r == sizeof(b));
+
+        /* the 'slow' file stalls the dispatcher */
+        if (b == 's')
+                nanosleep(&ts, NULL);
+
+        dispatch_file_clear(file, EPOLLIN);
+        return 0;
+}
+
+/*
+ * This test verifies that dispatch rounds and callbacks are accounted, and
+ * callbacks exceeding the threshold are recorded as stalls with the identity
+ * of their file.
+ */
+static void test_stats(void) {
+        _c_cleanup_(dispatch_context_deinit) DispatchContext c = DISPATCH_CONTEXT_NULL(c);
+        DispatchFile fast = DISPATCH_FILE_NULL(fast), slow = DISPATCH_FILE_NULL(slow);
+        DispatchStall *stall;
+        uint64_t n;
+        int r, s1[2], s2[2];
+
+        r = dispatch_context_init(&c);
+        assert(!r);
+        assert(c.stats.threshold == DISPATCH_STALL_THRESHOLD_DEFAULT);
+
+        r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, s1);
+        assert(!r);
+        r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, s2);
+        assert(!r);
+
+        r = dispatch_file_init(&fast, &c, test_stats_fn, s1[0], EPOLLIN, 0);
+        assert(!r);
+        r = dispatch_file_init(&slow, &c, test_stats_fn, s2[0], EPOLLIN, 0);
+        assert(!r);
+
+        dispatch_file_set_name(&fast, "fast", 7);
+        dispatch_file_set_name(&slow, "slow", 71);
+        dispatch_file_select(&fast, EPOLLIN);
+        dispatch_file_select(&slow, EPOLLIN);
+
+        /* dispatch the fast file only, nothing must be recorded as stall */
+
+        r = send(s1[1], "f", 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+        assert(r == 1);
+
+        r = dispatch_context_dispatch(&c);
+        assert(!r);
+        assert(c.stats.n_rounds == 1);
+        assert(c.stats.n_callbacks == 1);
+        assert(!c.stats.n_stalls);
+        assert(!dispatch_stats_get_stall(&c.stats, 0));
+
+        /* dispatch both, only the slow one must be recorded */
+
+        r = send(s1[1], "f", 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+        assert(r == 1);
+        r = send(s2[1], "s", 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+        assert(r == 1);
+
+        r = dispatch_context_dispatch(&c);
+        assert(!r);
+        assert(c.stats.n_rounds == 2);
+        assert(c.stats.n_callbacks == 3);
+        assert(c.stats.n_stalls == 1);
+        assert(c.stats.callback_max >= 2 * DISPATCH_STALL_THRESHOLD_DEFAULT);
+        assert(c.stats.round_max >= c.stats.callback_max);
+
+        stall = dispatch_stats_get_stall(&c.stats, 0);
+        assert(stall);
+        assert(!strcmp(stall->name, "slow"));
+        assert(stall->id == 71);
+        assert(stall->events == EPOLLIN);
+        assert(stall->duration >= 2 * DISPATCH_STALL_THRESHOLD_DEFAULT);
+        assert(!dispatch_stats_get_stall(&c.stats, 1));
+
+        /* the histograms must account for every round and callback */
+
+        n = 0;
+        for (size_t i = 0; i < DISPATCH_HISTOGRAM_N; ++i)
+                n += c.stats.round_histogram[i];
+        assert(n == c.stats.n_rounds);
+
+        n = 0;
+        for (size_t i = 0; i < DISPATCH_HISTOGRAM_N; ++i)
+                n += c.stats.callback_histogram[i];
+        assert(n == c.stats.n_callbacks);
+
+        dispatch_file_deinit(&slow);
+        dispatch_file_deinit(&fast);
+        c_close(s2[1]);
+        c_close(s2[0]);
+        c_close(s1[1]);
+        c_close(s1[0]);
+}
+
 int main(int argc, char **argv) {
         test_uds_edge(0);
         test_uds_edge(1);
+        test_stats();
         return 0;
 }
@@ -84,9 +84,58 @@ static void test_consumer(void) {
         l = fdlist_free(l);
 }
 
+static void test_pool(void) {
+        FDList *lists[FDLIST_POOL_MAX + 1];
+        FDListStats base, stats;
+        int r, dummies[64] = {};
+        size_t i;
+
+        /*
+         * Verify that small fdlists are recycled through the pool, rather
+         * than allocated anew, and that the pool is bounded. Lists exceeding
+         * all size classes are never pooled.
+         */
+
+        fdlist_flush();
+        fdlist_get_stats(&base);
+
+        for (i = 0; i < 128; ++i) {
+                r = fdlist_new_with_fds(&lists[0], dummies, i % 4);
+                assert(!r);
+                fdlist_free(lists[0]);
+        }
+
+        fdlist_get_stats(&stats);
+        assert(stats.n_allocs - base.n_allocs == 1);
+        assert(stats.n_recycled - base.n_recycled == 127);
+
+        for (i = 0; i < C_ARRAY_SIZE(lists); ++i) {
+                r = fdlist_new_with_fds(&lists[i], dummies, 1);
+                assert(!r);
+        }
+        for (i = 0; i < C_ARRAY_SIZE(lists); ++i)
+                fdlist_free(lists[i]);
+
+        fdlist_get_stats(&stats);
+        assert(stats.n_allocs - base.n_allocs == FDLIST_POOL_MAX + 1);
+
+        for (i = 0; i < 4; ++i) {
+                r = fdlist_new_with_fds(&lists[0], dummies, C_ARRAY_SIZE(dummies));
+                assert(!r);
+                assert(fdlist_count(lists[0]) == C_ARRAY_SIZE(dummies));
+                fdlist_free(lists[0]);
+        }
+
+        fdlist_get_stats(&stats);
+        assert(stats.n_allocs - base.n_allocs == FDLIST_POOL_MAX + 5);
+
+        fdlist_flush();
+}
+
 int main(int argc, char **argv) {
         test_setup();
         test_dummy();
         test_consumer();
+        test_pool();
         return 0;
 }
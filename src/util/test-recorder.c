@@ -0,0 +1,100 @@
+/*
+ * Test Flight Recorder
+ */
+
+#include <c-macro.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "util/recorder.h"
+
+static void test_read(int fd, RecorderFileHeader *header, RecorderEvent *events, size_t n_events) {
+        ssize_t l;
+
+        l = pread(fd, header, sizeof(*header), 0);
+        assert(l == sizeof(*header));
+        assert(!memcmp(header->magic, RECORDER_FILE_MAGIC, sizeof(header->magic)));
+        assert(header->version == RECORDER_FILE_VERSION);
+        assert(header->n_events <= n_events);
+
+        l = pread(fd, events, header->n_events * sizeof(*events), sizeof(*header));
+        assert(l == (ssize_t)(header->n_events * sizeof(*events)));
+
+        l = pread(fd, header, 1, sizeof(*header) + header->n_events * sizeof(*events));
+        assert(l == 0);
+}
+
+static void test_dump(size_t n_recorded) {
+        static RecorderEvent events[RECORDER_N_EVENTS];
+        static Recorder recorder;
+        RecorderFileHeader header;
+        size_t n_expected;
+        FILE *f;
+        int r;
+
+        recorder_init(&recorder);
+
+        for (size_t i = 0; i < n_recorded; ++i)
+                recorder_record(&recorder, RECORDER_EVENT_DISPATCH, i, 1, i, i * 2);
+
+        f = tmpfile();
+        assert(f);
+
+        r = recorder_dump(&recorder, fileno(f));
+        assert(!r);
+
+        test_read(fileno(f), &header, events, C_ARRAY_SIZE(events));
+
+        n_expected = c_min(n_recorded, (size_t)RECORDER_N_EVENTS);
+        assert(header.n_events == n_expected);
+        assert(header.n_total == n_recorded);
+
+        /* events must be ordered from oldest to newest, with the oldest dropped */
+        for (size_t i = 0; i < n_expected; ++i) {
+                uint64_t id = n_recorded - n_expected + i;
+
+                assert(events[i].type == RECORDER_EVENT_DISPATCH);
+                assert(events[i].message_type == 1);
+                assert(events[i].id == id);
+                assert(events[i].serial == (uint32_t)id);
+                assert(events[i].value == id * 2);
+                assert(events[i].timestamp <= header.timestamp);
+                assert(!i || events[i - 1].timestamp <= events[i].timestamp);
+        }
+
+        fclose(f);
+        recorder_deinit(&recorder);
+}
+
+static void test_error(void) {
+        static Recorder recorder;
+        int r, fds[2];
+
+        recorder_init(&recorder);
+        recorder_record(&recorder, RECORDER_EVENT_LOOP, 0, 0, 0, 0);
+
+        signal(SIGPIPE, SIG_IGN);
+
+        r = pipe(fds);
+        assert(r >= 0);
+        close(fds[0]);
+
+        r = recorder_dump(&recorder, fds[1]);
+        assert(r == RECORDER_E_IO);
+
+        close(fds[1]);
+        recorder_deinit(&recorder);
+}
+
+int main(int argc, char **argv) {
+        test_dump(0);
+        test_dump(1);
+        test_dump(RECORDER_N_EVENTS - 1);
+        test_dump(RECORDER_N_EVENTS);
+        test_dump(RECORDER_N_EVENTS + 1);
+        test_dump(RECORDER_N_EVENTS * 2 + 7);
+        test_error();
+        return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * Test Timer
+ */
+
+#include <c-macro.h>
+#include <stdlib.h>
+#include "util/dispatch.h"
+#include "util/timer.h"
+
+typedef struct TestTimeout TestTimeout;
+
+struct TestTimeout {
+        Timeout timeout;
+        unsigned int *order;
+        unsigned int index;
+};
+
+static int test_timeout_fn(Timeout *timeout) {
+        TestTimeout *t = c_container_of(timeout, TestTimeout, timeout);
+
+        assert(!timeout_is_scheduled(timeout));
+        assert(timeout->deadline <= timer_now());
+
+        t->index = ++*t->order;
+        return 0;
+}
+
+static void test_setup(void) {
+        _c_cleanup_(dispatch_context_deinit) DispatchContext c = DISPATCH_CONTEXT_NULL(c);
+        _c_cleanup_(timer_deinit) Timer t = TIMER_NULL(t);
+        int r;
+
+        r = dispatch_context_init(&c);
+        assert(!r);
+
+        r = timer_init(&t, &c);
+        assert(!r);
+
+        timer_deinit(&t);
+        timer_deinit(&t);
+}
+
+/*
+ * This schedules timeouts out of order, cancels and reschedules some of them,
+ * and verifies they fire in order of their deadlines, and only once.
+ */
+static void test_order(void) {
+        _c_cleanup_(dispatch_context_deinit) DispatchContext c = DISPATCH_CONTEXT_NULL(c);
+        _c_cleanup_(timer_deinit) Timer t = TIMER_NULL(t);
+        TestTimeout timeouts[4];
+        unsigned int order = 0;
+        uint64_t now;
+        int r;
+
+        r = dispatch_context_init(&c);
+        assert(!r);
+
+        r = timer_init(&t, &c);
+        assert(!r);
+
+        for (size_t i = 0; i < C_ARRAY_SIZE(timeouts); ++i)
+                timeouts[i] = (TestTimeout){
+                        .timeout = TIMEOUT_NULL(timeouts[i].timeout),
+                        .order = &order,
+                };
+
+        now = timer_now();
+
+        r = timeout_schedule(&timeouts[0].timeout, &t, test_timeout_fn, now + 3 * 1000 * 1000);
+        assert(!r);
+        r = timeout_schedule(&timeouts[1].timeout, &t, test_timeout_fn, now + 1 * 1000 * 1000);
+        assert(!r);
+        r = timeout_schedule(&timeouts[2].timeout, &t, test_timeout_fn, now + 1 * 1000 * 1000);
+        assert(!r);
+        r = timeout_schedule(&timeouts[3].timeout, &t, test_timeout_fn, now + 2 * 1000 * 1000);
+        assert(!r);
+
+        /* cancel the earliest, and move one behind all others */
+        timeout_cancel(&timeouts[1].timeout);
+        assert(!timeout_is_scheduled(&timeouts[1].timeout));
+        r = timeout_schedule(&timeouts[2].timeout, &t, test_timeout_fn, now + 4 * 1000 * 1000);
+        assert(!r);
+
+        while (order < 3) {
+                r = dispatch_context_dispatch(&c);
+                assert(!r);
+        }
+
+        assert(timeouts[0].index == 2);
+        assert(timeouts[1].index == 0);
+        assert(timeouts[2].index == 3);
+        assert(timeouts[3].index == 1);
+
+        /* verify nothing fires anymore, as the timer is disarmed */
+        r = dispatch_context_poll(&c, 10);
+        assert(!r);
+        assert(c_list_is_empty(&c.ready_list));
+}
+
+int main(int argc, char **argv) {
+        test_setup();
+        test_order();
+        return 0;
+}
@@ -90,8 +90,85 @@ static void test_quota(void) {
         user_registry_deinit(&registry);
 }
 
+static void test_profile(void) {
+        UserRegistry registry;
+        User *entry1, *entry2;
+        UserCharge charge1, charge2;
+        int r;
+
+        r = user_registry_init(&registry, _USER_SLOT_N, (unsigned int[]){ 1024, 1024, 1024, 1024, 1024 });
+        assert(!r);
+
+        /* profiles apply to users created later on */
+        r = user_registry_set_maxima(&registry, 1, (unsigned int[]){ 256, 256, 256, 256 });
+        assert(!r);
+        assert(user_registry_get_maxima(&registry, 1)[USER_SLOT_BYTES] == 256);
+        assert(user_registry_get_maxima(&registry, 2)[USER_SLOT_BYTES] == 1024);
+
+        r = user_registry_ref_user(&registry, &entry1, 1);
+        assert(r == 0);
+        assert(entry1->slots[USER_SLOT_BYTES].max == 256);
+
+        r = user_registry_ref_user(&registry, &entry2, 2);
+        assert(r == 0);
+        assert(entry2->slots[USER_SLOT_BYTES].max == 1024);
+
+        user_charge_init(&charge1);
+        user_charge_init(&charge2);
+
+        r = user_charge(entry1, &charge1, NULL, USER_SLOT_BYTES, 200);
+        assert(!r);
+        r = user_charge(entry1, &charge2, entry2, USER_SLOT_BYTES, 10);
+        assert(!r);
+
+        /* shrinking below the current usage turns the excess into debt */
+        r = user_registry_set_maxima(&registry, 1, (unsigned int[]){ 128, 128, 128, 128 });
+        assert(!r);
+        assert(entry1->slots[USER_SLOT_BYTES].max == 128);
+        assert(entry1->slots[USER_SLOT_BYTES].n == 0);
+        assert(entry1->slots[USER_SLOT_BYTES].debt == 82);
+
+        r = user_charge(entry1, &charge1, NULL, USER_SLOT_BYTES, 1);
+        assert(r == USER_E_QUOTA);
+        r = user_charge(entry1, &charge2, entry2, USER_SLOT_BYTES, 1);
+        assert(r == USER_E_QUOTA);
+
+        /* releasing charges pays off the debt first */
+        user_charge_deinit(&charge2);
+        assert(entry1->slots[USER_SLOT_BYTES].n == 0);
+        assert(entry1->slots[USER_SLOT_BYTES].debt == 72);
+
+        r = user_charge(entry1, &charge2, entry2, USER_SLOT_BYTES, 1);
+        assert(r == USER_E_QUOTA);
+
+        /* growing the limits again makes room right away */
+        r = user_registry_set_maxima(&registry, 1, NULL);
+        assert(!r);
+        assert(entry1->slots[USER_SLOT_BYTES].max == 1024);
+        assert(entry1->slots[USER_SLOT_BYTES].n == 824);
+        assert(entry1->slots[USER_SLOT_BYTES].debt == 0);
+        assert(user_registry_get_maxima(&registry, 1)[USER_SLOT_BYTES] == 1024);
+
+        r = user_charge(entry1, &charge1, NULL, USER_SLOT_BYTES, 24);
+        assert(!r);
+
+        /* shrink once more, and verify the user is balanced once released */
+        r = user_registry_set_maxima(&registry, 1, (unsigned int[]){ 64, 64, 64, 64 });
+        assert(!r);
+        assert(entry1->slots[USER_SLOT_BYTES].debt == 160);
+
+        user_charge_deinit(&charge1);
+        assert(entry1->slots[USER_SLOT_BYTES].n == 64);
+        assert(entry1->slots[USER_SLOT_BYTES].debt == 0);
+
+        user_unref(entry2);
+        user_unref(entry1);
+        user_registry_deinit(&registry);
+}
+
 int main(int argc, char **argv) {
         test_setup();
         test_quota();
+        test_profile();
         return 0;
 }
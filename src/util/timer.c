@@ -0,0 +1,231 @@
+/*
+ * Timer
+ *
+ * A timer multiplexes any number of timeouts onto a single timerfd, which is
+ * hooked into a dispatch-context. Timeouts are kept in a tree ordered by
+ * their deadline, and the timerfd is always armed for the earliest of them.
+ *
+ * Cancelling a timeout never touches the timerfd. Instead, the timer might
+ * get woken up for a deadline that is no longer scheduled, in which case it
+ * simply re-arms itself for the next one. As timeouts are usually cancelled
+ * long before they fire, this saves a syscall in the common case.
+ *
+ * All deadlines are absolute timestamps of CLOCK_MONOTONIC in nano seconds.
+ */
+
+#include <c-macro.h>
+#include <c-rbtree.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include "util/dispatch.h"
+#include "util/error.h"
+#include "util/timer.h"
+
+static int timeout_compare(CRBTree *t, void *k, CRBNode *rb) {
+        Timeout *timeout = c_container_of(rb, Timeout, timer_node);
+        Timeout *key = k;
+
+        /* order by deadline, but allow duplicate deadlines */
+        if (key->deadline < timeout->deadline)
+                return -1;
+        else if (key->deadline > timeout->deadline)
+                return 1;
+        else if (key < timeout)
+                return -1;
+        else if (key > timeout)
+                return 1;
+
+        return 0;
+}
+
+static Timeout *timer_first(Timer *timer) {
+        return c_rbnode_entry(c_rbtree_first(&timer->timeout_tree), Timeout, timer_node);
+}
+
+static int timer_rearm(Timer *timer) {
+        struct itimerspec spec = {};
+        Timeout *timeout;
+        uint64_t deadline;
+        int r;
+
+        timeout = timer_first(timer);
+        deadline = timeout ? timeout->deadline : 0;
+
+        if (deadline == timer->armed)
+                return 0;
+
+        /* a zero deadline disarms the timer */
+        spec.it_value.tv_sec = deadline / UINT64_C(1000000000);
+        spec.it_value.tv_nsec = deadline % UINT64_C(1000000000);
+
+        r = timerfd_settime(timer->fd, TFD_TIMER_ABSTIME, &spec, NULL);
+        if (r < 0)
+                return error_origin(-errno);
+
+        timer->armed = deadline;
+        return 0;
+}
+
+/**
+ * timeout_schedule() - schedule timeout
+ * @timeout:            timeout to schedule
+ * @timer:              timer to schedule on
+ * @fn:                 callback to invoke
+ * @deadline:           absolute deadline in nano seconds
+ *
+ * This schedules @timeout on @timer, such that @fn is invoked once @deadline
+ * has passed. If @timeout was already scheduled, it is rescheduled. A timeout
+ * is always cancelled before its callback is invoked.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int timeout_schedule(Timeout *timeout, Timer *timer, TimeoutFn fn, uint64_t deadline) {
+        CRBNode **slot, *parent;
+        int r;
+
+        assert(deadline);
+
+        timeout_cancel(timeout);
+
+        timeout->timer = timer;
+        timeout->fn = fn;
+        timeout->deadline = deadline;
+
+        slot = c_rbtree_find_slot(&timer->timeout_tree, timeout_compare, timeout, &parent);
+        assert(slot);
+        c_rbtree_add(&timer->timeout_tree, parent, slot, &timeout->timer_node);
+
+        /*
+         * Only re-arm if this is now the earliest timeout. If the timer is
+         * armed for an earlier deadline that was cancelled meanwhile, we get
+         * woken up spuriously and re-arm then.
+         */
+        if (!timer->armed || deadline < timer->armed) {
+                r = timer_rearm(timer);
+                if (r) {
+                        timeout_cancel(timeout);
+                        return error_trace(r);
+                }
+        }
+
+        return 0;
+}
+
+/**
+ * timeout_cancel() - cancel timeout
+ * @timeout:            timeout to cancel
+ *
+ * This cancels @timeout, if it is scheduled. Otherwise, this is a no-op.
+ */
+void timeout_cancel(Timeout *timeout) {
+        if (!timeout->timer)
+                return;
+
+        c_rbtree_remove_init(&timeout->timer->timeout_tree, &timeout->timer_node);
+        timeout->timer = NULL;
+}
+
+static int timer_dispatch(DispatchFile *file) {
+        Timer *timer = c_container_of(file, Timer, file);
+        Timeout *timeout;
+        uint64_t now, n_expirations;
+        ssize_t l;
+        int r;
+
+        l = read(timer->fd, &n_expirations, sizeof(n_expirations));
+        if (l < 0) {
+                if (errno != EAGAIN)
+                        return error_origin(-errno);
+        } else {
+                assert(l == sizeof(n_expirations));
+
+                /* the timerfd is one-shot, so it is disarmed now */
+                timer->armed = 0;
+        }
+
+        dispatch_file_clear(file, EPOLLIN);
+
+        now = timer_now();
+
+        while ((timeout = timer_first(timer)) && timeout->deadline <= now) {
+                timeout_cancel(timeout);
+
+                r = timeout->fn(timeout);
+                if (r)
+                        return error_trace(r);
+        }
+
+        r = timer_rearm(timer);
+        if (r)
+                return error_trace(r);
+
+        return 0;
+}
+
+/**
+ * timer_init() - initialize timer
+ * @timer:              timer to operate on
+ * @dispatcher:         dispatch context to hook into
+ *
+ * This initializes a new timer, without any timeouts scheduled.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int timer_init(Timer *timer, DispatchContext *dispatcher) {
+        _c_cleanup_(timer_deinitp) Timer *t = timer;
+        int r;
+
+        *t = (Timer)TIMER_NULL(*t);
+
+        t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (t->fd < 0)
+                return error_origin(-errno);
+
+        r = dispatch_file_init(&t->file,
+                               dispatcher,
+                               timer_dispatch,
+                               t->fd,
+                               EPOLLIN,
+                               0);
+        if (r)
+                return error_fold(r);
+
+        dispatch_file_set_name(&t->file, "timer", 0);
+        dispatch_file_select(&t->file, EPOLLIN);
+
+        t = NULL;
+        return 0;
+}
+
+/**
+ * timer_deinit() - deinitialize timer
+ * @timer:              timer to operate on
+ *
+ * This deinitializes @timer. The caller must make sure no timeout is
+ * scheduled on it anymore.
+ */
+void timer_deinit(Timer *timer) {
+        assert(c_rbtree_is_empty(&timer->timeout_tree));
+
+        dispatch_file_deinit(&timer->file);
+        timer->fd = c_close(timer->fd);
+        timer->armed = 0;
+}
+
+/**
+ * timer_now() - get the current time
+ *
+ * Return: the current time of CLOCK_MONOTONIC in nano seconds.
+ */
+uint64_t timer_now(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        assert(r >= 0);
+
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
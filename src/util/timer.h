@@ -0,0 +1,58 @@
+#pragma once
+
+/*
+ * Timer
+ */
+
+#include <c-macro.h>
+#include <c-rbtree.h>
+#include <stdlib.h>
+#include "util/dispatch.h"
+
+typedef struct Timeout Timeout;
+typedef struct Timer Timer;
+typedef int (*TimeoutFn) (Timeout *timeout);
+
+/* timeouts */
+
+struct Timeout {
+        Timer *timer;
+        CRBNode timer_node;
+        TimeoutFn fn;
+        uint64_t deadline;
+};
+
+#define TIMEOUT_NULL(_x) {                                              \
+                .timer_node = C_RBNODE_INIT((_x).timer_node),           \
+        }
+
+int timeout_schedule(Timeout *timeout, Timer *timer, TimeoutFn fn, uint64_t deadline);
+void timeout_cancel(Timeout *timeout);
+
+/* timers */
+
+struct Timer {
+        int fd;
+        DispatchFile file;
+        CRBTree timeout_tree;
+        uint64_t armed;
+};
+
+#define TIMER_NULL(_x) {                                                \
+                .fd = -1,                                               \
+                .file = DISPATCH_FILE_NULL((_x).file),                  \
+                .timeout_tree = C_RBTREE_INIT,                          \
+        }
+
+int timer_init(Timer *timer, DispatchContext *dispatcher);
+void timer_deinit(Timer *timer);
+
+uint64_t timer_now(void);
+
+C_DEFINE_CLEANUP(Timer *, timer_deinit);
+
+/* inline helpers */
+
+static inline bool timeout_is_scheduled(Timeout *timeout) {
+        return !!timeout->timer;
+}
@@ -20,17 +20,32 @@
  * each remote UID is between 1/n and 1/n^2 of the total amount of resources
  * available to the local UID, where n is the number of UIDs consuming a share
  * of the local UID's resources at the time of accounting.
+ *
+ * The global per-user limits default to the maxima of the registry, but can be
+ * overridden for individual UIDs by registering a profile. Profiles can be
+ * changed at any time. Existing charges are never revoked. If a limit shrinks
+ * below what a user currently consumes, the excess is recorded as debt on the
+ * user, and further charges fail until enough resources were released to pay
+ * off the debt.
  */
 
 #include <c-macro.h>
-#include <c-ref.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include "util/error.h"
+#include "util/ref.h"
 #include "util/user.h"
 
+struct UserProfile {
+        uid_t uid;
+        CRBNode registry_node;
+
+        unsigned int maxima[];
+};
+
 struct UserUsage {
-        _Atomic unsigned long n_refs;
+        Ref n_refs;
         User *user;
         uid_t uid;
         CRBNode user_node;
@@ -55,7 +70,7 @@ static int user_usage_new(UserUsage **usagep, User *user, uid_t uid) {
         if (!usage)
                 return error_origin(-ENOMEM);
 
-        usage->n_refs = C_REF_INIT;
+        usage->n_refs = REF_INIT;
         usage->user = user;
         usage->uid = uid;
         usage->user_node = (CRBNode)C_RBNODE_INIT(usage->user_node);
@@ -64,7 +79,7 @@ static int user_usage_new(UserUsage **usagep, User *user, uid_t uid) {
         return 0;
 }
 
-static void user_usage_free(_Atomic unsigned long *n_refs, void *userdata) {
+static void user_usage_free(Ref *n_refs, void *userdata) {
         UserUsage *usage = c_container_of(n_refs, UserUsage, n_refs);
         size_t i;
 
@@ -77,13 +92,13 @@ static void user_usage_free(_Atomic unsigned long *n_refs, void *userdata) {
 
 static UserUsage *user_usage_ref(UserUsage *usage) {
         if (usage)
-                c_ref_inc(&usage->n_refs);
+                ref_inc(&usage->n_refs);
         return usage;
 }
 
 static UserUsage *user_usage_unref(UserUsage *usage) {
         if (usage)
-                c_ref_dec(&usage->n_refs, user_usage_free, NULL);
+                ref_dec(&usage->n_refs, user_usage_free, NULL);
         return NULL;
 }
 
@@ -101,6 +116,30 @@ static int user_usage_compare(CRBTree *tree, void *k, CRBNode *rb) {
         return 0;
 }
 
+static void user_release(User *user, size_t slot, unsigned int amount) {
+        unsigned int debt;
+
+        /* pay off any debt from shrunk limits, before making room again */
+        debt = c_min(user->slots[slot].debt, amount);
+        user->slots[slot].debt -= debt;
+        user->slots[slot].n += amount - debt;
+}
+
+static void user_set_max(User *user, size_t slot, unsigned int max) {
+        unsigned int used;
+
+        used = user->slots[slot].max - user->slots[slot].n + user->slots[slot].debt;
+
+        user->slots[slot].max = max;
+        if (used > max) {
+                user->slots[slot].n = 0;
+                user->slots[slot].debt = used - max;
+        } else {
+                user->slots[slot].n = max - used;
+                user->slots[slot].debt = 0;
+        }
+}
+
 /**
  * user_charge_init() - initialize charge object
  * @charge:     charge object to initialize
@@ -121,7 +160,7 @@ void user_charge_init(UserCharge *charge) {
  */
 void user_charge_deinit(UserCharge *charge) {
         if (charge->usage) {
-                charge->usage->user->slots[charge->slot].n += charge->charge;
+                user_release(charge->usage->user, charge->slot, charge->charge);
                 charge->usage->slots[charge->slot] -= charge->charge;
 
                 charge->usage = user_usage_unref(charge->usage);
@@ -136,7 +175,7 @@ static int user_charge_check(unsigned int remaining,
                              unsigned int users,
                              unsigned int share,
                              unsigned int charge) {
-        if (remaining - charge < (share + charge) * users)
+        if (charge > remaining || remaining - charge < (share + charge) * users)
                 return USER_E_QUOTA;
 
         return 0;
@@ -151,6 +190,7 @@ static void user_unlink(User *user) {
 }
 
 static int user_new(User **userp, UserRegistry *registry, uid_t uid) {
+        const unsigned int *maxima;
         User *user;
         size_t i;
 
@@ -158,30 +198,34 @@ static int user_new(User **userp, UserRegistry *registry, uid_t uid) {
         if (!user)
                 return error_origin(-ENOMEM);
 
-        user->n_refs = C_REF_INIT;
+        user->n_refs = REF_INIT;
         user->registry = registry;
         user->uid = uid;
         user->registry_node = (CRBNode)C_RBNODE_INIT(user->registry_node);
         user->usage_tree = (CRBTree)C_RBTREE_INIT;
 
+        maxima = user_registry_get_maxima(registry, uid);
         for (i = 0; i < registry->n_slots; ++i) {
-                user->slots[i].max = registry->maxima[i];
+                user->slots[i].max = maxima[i];
                 user->slots[i].n = user->slots[i].max;
+                user->slots[i].debt = 0;
         }
 
         *userp = user;
         return 0;
 }
 
-void user_free(_Atomic unsigned long *n_refs, void *userdata) {
+void user_free(Ref *n_refs, void *userdata) {
         User *user = c_container_of(n_refs, User, n_refs);
         size_t i;
 
         assert(c_rbtree_is_empty(&user->usage_tree));
         assert(user->n_usages == 0);
 
-        for (i = 0; i < user->registry->n_slots; ++i)
+        for (i = 0; i < user->registry->n_slots; ++i) {
                 assert(user->slots[i].n == user->slots[i].max);
+                assert(!user->slots[i].debt);
+        }
 
         user_unlink(user);
         free(user);
@@ -338,8 +382,13 @@ int user_registry_init(UserRegistry *registry,
  * have been destroyed before the registry is deinitialized.
  */
 void user_registry_deinit(UserRegistry *registry) {
+        UserProfile *profile, *safe;
+
         assert(c_rbtree_is_empty(&registry->user_tree));
 
+        c_rbtree_for_each_entry_unlink(profile, safe, &registry->profile_tree, registry_node)
+                free(profile);
+
         free(registry->maxima);
         *registry = (UserRegistry)USER_REGISTRY_NULL;
 }
@@ -375,3 +424,87 @@ int user_registry_ref_user(UserRegistry *registry, User **userp, uid_t uid) {
         *userp = user;
         return 0;
 }
+
+static int user_profile_compare(CRBTree *tree, void *k, CRBNode *rb) {
+        UserProfile *profile = c_container_of(rb, UserProfile, registry_node);
+        uid_t uid = *(uid_t*)k;
+
+        if (uid < profile->uid)
+                return -1;
+        if (uid > profile->uid)
+                return 1;
+
+        return 0;
+}
+
+/**
+ * user_registry_set_maxima() - set per-user limits
+ * @registry:           registry to operate on
+ * @uid:                uid of user to set limits for
+ * @maxima:             maxima for each slot, or NULL
+ *
+ * This registers a profile with @maxima as the limits for the user with UID
+ * @uid, replacing any profile that was registered before. If @maxima is NULL,
+ * the profile is dropped and the user falls back to the maxima of @registry.
+ *
+ * If the user currently exists, its limits are updated right away. Existing
+ * charges are retained, even if they exceed the new limits. Instead, the
+ * excess is recorded as debt, and no further charges succeed on that slot
+ * until the debt was paid off.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+int user_registry_set_maxima(UserRegistry *registry, uid_t uid, const unsigned int *maxima) {
+        UserProfile *profile = NULL;
+        CRBNode **slot, *parent;
+        User *user;
+        size_t i;
+
+        slot = c_rbtree_find_slot(&registry->profile_tree, user_profile_compare, &uid, &parent);
+        if (slot) {
+                if (maxima) {
+                        profile = malloc(sizeof(*profile) + registry->n_slots * sizeof(*profile->maxima));
+                        if (!profile)
+                                return error_origin(-ENOMEM);
+
+                        profile->uid = uid;
+                        profile->registry_node = (CRBNode)C_RBNODE_INIT(profile->registry_node);
+                        c_rbtree_add(&registry->profile_tree, parent, slot, &profile->registry_node);
+                }
+        } else {
+                profile = c_container_of(parent, UserProfile, registry_node);
+                if (!maxima) {
+                        c_rbtree_remove_init(&registry->profile_tree, &profile->registry_node);
+                        free(profile);
+                        profile = NULL;
+                }
+        }
+
+        if (profile)
+                memcpy(profile->maxima, maxima, registry->n_slots * sizeof(*profile->maxima));
+
+        user = c_rbtree_find_entry(&registry->user_tree, user_compare, &uid, User, registry_node);
+        if (user) {
+                maxima = profile ? profile->maxima : registry->maxima;
+                for (i = 0; i < registry->n_slots; ++i)
+                        user_set_max(user, i, maxima[i]);
+        }
+
+        return 0;
+}
+
+/**
+ * user_registry_get_maxima() - get per-user limits
+ * @registry:           registry to query
+ * @uid:                uid of user to query
+ *
+ * Return: the maxima of the profile registered for @uid, or the maxima of
+ *         @registry if there is none.
+ */
+const unsigned int *user_registry_get_maxima(UserRegistry *registry, uid_t uid) {
+        UserProfile *profile;
+
+        profile = c_rbtree_find_entry(&registry->profile_tree, user_profile_compare, &uid, UserProfile, registry_node);
+
+        return profile ? profile->maxima : registry->maxima;
+}
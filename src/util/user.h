@@ -6,11 +6,12 @@
 
 #include <c-macro.h>
 #include <c-rbtree.h>
-#include <c-ref.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include "util/ref.h"
 
 typedef struct UserCharge UserCharge;
+typedef struct UserProfile UserProfile;
 typedef struct UserUsage UserUsage;
 typedef struct User User;
 typedef struct UserRegistry UserRegistry;
@@ -46,7 +47,7 @@ void user_charge_deinit(UserCharge *charge);
 /* user */
 
 struct User {
-        _Atomic unsigned long n_refs;
+        Ref n_refs;
         UserRegistry *registry;
         uid_t uid;
         CRBNode registry_node;
@@ -57,39 +58,44 @@ struct User {
         struct {
                 unsigned int n;
                 unsigned int max;
+                unsigned int debt;
         } slots[];
 };
 
-void user_free(_Atomic unsigned long *n_refs, void *userdata);
+void user_free(Ref *n_refs, void *userdata);
 int user_charge(User *user, UserCharge *charge, User *actor, size_t slot, unsigned int amount);
 
 /* registry */
 
 struct UserRegistry {
         CRBTree user_tree;
+        CRBTree profile_tree;
         size_t n_slots;
         unsigned int *maxima;
 };
 
 #define USER_REGISTRY_NULL {                                                    \
                 .user_tree = C_RBTREE_INIT,                                     \
+                .profile_tree = C_RBTREE_INIT,                                  \
         }
 
 int user_registry_init(UserRegistry *registry, size_t n_slots, const unsigned int *maxima);
 void user_registry_deinit(UserRegistry *registry);
 int user_registry_ref_user(UserRegistry *registry, User **userp, uid_t uid);
+int user_registry_set_maxima(UserRegistry *registry, uid_t uid, const unsigned int *maxima);
+const unsigned int *user_registry_get_maxima(UserRegistry *registry, uid_t uid);
 
 /* inline helpers */
 
 static inline User *user_ref(User *user) {
         if (user)
-                c_ref_inc(&user->n_refs);
+                ref_inc(&user->n_refs);
         return user;
 }
 
 static inline User *user_unref(User *user) {
         if (user)
-                c_ref_dec(&user->n_refs, user_free, NULL);
+                ref_dec(&user->n_refs, user_free, NULL);
         return NULL;
 }
 
@@ -0,0 +1,818 @@
+/*
+ * Raw Protocol Load Generator
+ *
+ * This drives a large number of simulated peers against a bus, in order to
+ * measure the throughput of the broker rather than the throughput of its
+ * clients. Rather than using sd-bus, peers are implemented on top of the
+ * Connection, Socket and Message objects of the broker itself. All messages
+ * are serialized before any traffic is started, so the steady state consists
+ * of nothing but queueing pre-built messages and counting replies.
+ *
+ * Peers are distributed over a set of threads, each with its own event loop.
+ * Every peer keeps a window of messages in flight, so the broker always has
+ * pipelined work available. The following traffic profiles are supported:
+ *
+ *     * unicast: Peers are paired up. One sends method calls to the other,
+ *                which replies to each of them.
+ *     * fds: Like unicast, but each call carries a file-descriptor.
+ *     * denied: Like unicast, but each call is denied by the policy of the
+ *               spawned broker, and answered with an error by the driver.
+ *     * broadcast: Peers are grouped. The first peer in each group emits
+ *                  signals, all others subscribed to them via AddMatch().
+ *     * driver: Every peer calls GetId() on the driver.
+ *
+ * Unless --address is given, a private broker is spawned for the run.
+ */
+
+#include <c-dvar.h>
+#include <c-dvar-type.h>
+#include <c-macro.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
+#include "dbus/connection.h"
+#include "dbus/message.h"
+#include "dbus/protocol.h"
+#include "util/dispatch.h"
+#include "util/fdlist.h"
+#include "util-broker.h"
+
+typedef struct BenchPeer BenchPeer;
+typedef struct BenchThread BenchThread;
+
+#define BENCH_SERIAL_HELLO (1U)
+#define BENCH_SERIAL_MATCH (2U)
+#define BENCH_SERIAL_BASE (16U)
+
+enum {
+        BENCH_PROFILE_UNICAST,
+        BENCH_PROFILE_FDS,
+        BENCH_PROFILE_DENIED,
+        BENCH_PROFILE_BROADCAST,
+        BENCH_PROFILE_DRIVER,
+        _BENCH_PROFILE_N,
+};
+
+enum {
+        BENCH_BODY_NONE,
+        BENCH_BODY_STRING,
+        BENCH_BODY_BYTES,
+};
+
+struct BenchPeer {
+        BenchThread *thread;
+        BenchPeer *partner;
+        Connection connection;
+        char unique[64];
+
+        bool sender : 1;
+        bool ready : 1;
+        bool acquired : 1;
+
+        Message **messages;
+        size_t n_messages;
+        size_t n_receivers;
+
+        uint64_t n_sent;
+        uint64_t n_acked;
+};
+
+#define BENCH_PEER_NULL(_x) {                                                   \
+                .connection = CONNECTION_NULL((_x).connection),                 \
+        }
+
+struct BenchThread {
+        pthread_t thread;
+        DispatchContext dispatcher;
+        int fd;
+
+        BenchPeer *peers;
+        size_t n_peers;
+        size_t n_group;
+        size_t n_setup;
+        size_t n_busy;
+        bool prepared;
+
+        uint64_t n_transferred;
+        uint64_t start;
+        uint64_t end;
+};
+
+static const char *bench_profiles[] = {
+        [BENCH_PROFILE_UNICAST]         = "unicast",
+        [BENCH_PROFILE_FDS]             = "fds",
+        [BENCH_PROFILE_DENIED]          = "denied",
+        [BENCH_PROFILE_BROADCAST]       = "broadcast",
+        [BENCH_PROFILE_DRIVER]          = "driver",
+};
+
+static struct sockaddr_un bench_address;
+static socklen_t bench_n_address;
+
+static unsigned int bench_arg_profile = BENCH_PROFILE_UNICAST;
+static const char *bench_arg_address = NULL;
+static size_t bench_arg_peers = 1024;
+static size_t bench_arg_threads = 4;
+static size_t bench_arg_messages = 1024;
+static size_t bench_arg_window = 16;
+static size_t bench_arg_group = 16;
+static size_t bench_arg_payload = 0;
+
+static uint64_t bench_now(void) {
+        struct timespec ts;
+        int r;
+
+        r = clock_gettime(CLOCK_MONOTONIC, &ts);
+        assert(r >= 0);
+
+        return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static Message *bench_message_new(uint8_t type,
+                                  uint32_t serial,
+                                  uint32_t reply_serial,
+                                  const char *destination,
+                                  const char *path,
+                                  const char *interface,
+                                  const char *member,
+                                  const char *match,
+                                  size_t n_payload,
+                                  int fd) {
+#define BENCH_T_MESSAGE(_body)                                                  \
+                C_DVAR_T_INIT(                                                  \
+                        C_DVAR_T_TUPLE2(                                        \
+                                C_DVAR_T_TUPLE7(                                \
+                                        C_DVAR_T_y,                             \
+                                        C_DVAR_T_y,                             \
+                                        C_DVAR_T_y,                             \
+                                        C_DVAR_T_y,                             \
+                                        C_DVAR_T_u,                             \
+                                        C_DVAR_T_u,                             \
+                                        C_DVAR_T_ARRAY(                         \
+                                                C_DVAR_T_TUPLE2(                \
+                                                        C_DVAR_T_y,             \
+                                                        C_DVAR_T_v              \
+                                                )                               \
+                                        )                                       \
+                                ),                                              \
+                                _body                                           \
+                        )                                                       \
+                )
+        static const CDVarType type_none[] = {
+                BENCH_T_MESSAGE(C_DVAR_T_TUPLE0)
+        };
+        static const CDVarType type_string[] = {
+                BENCH_T_MESSAGE(C_DVAR_T_TUPLE1(C_DVAR_T_s))
+        };
+        static const CDVarType type_bytes[] = {
+                BENCH_T_MESSAGE(C_DVAR_T_TUPLE1(C_DVAR_T_ARRAY(C_DVAR_T_y)))
+        };
+#undef BENCH_T_MESSAGE
+        _c_cleanup_(c_dvar_deinit) CDVar v = C_DVAR_INIT;
+        Message *m = NULL;
+        unsigned int body;
+        size_t n_data;
+        void *data;
+        int r;
+
+        if (match)
+                body = BENCH_BODY_STRING;
+        else if (n_payload)
+                body = BENCH_BODY_BYTES;
+        else
+                body = BENCH_BODY_NONE;
+
+        c_dvar_begin_write(&v,
+                           (body == BENCH_BODY_STRING) ? type_string :
+                           (body == BENCH_BODY_BYTES) ? type_bytes :
+                           type_none,
+                           1);
+
+        c_dvar_write(&v, "((yyyyuu[",
+                     c_dvar_is_big_endian(&v) ? 'B' : 'l',
+                     type,
+                     DBUS_HEADER_FLAG_NO_AUTO_START,
+                     1, 0, serial);
+
+        if (destination)
+                c_dvar_write(&v, "(y<s>)", DBUS_MESSAGE_FIELD_DESTINATION, c_dvar_type_s, destination);
+        if (path)
+                c_dvar_write(&v, "(y<o>)", DBUS_MESSAGE_FIELD_PATH, c_dvar_type_o, path);
+        if (interface)
+                c_dvar_write(&v, "(y<s>)", DBUS_MESSAGE_FIELD_INTERFACE, c_dvar_type_s, interface);
+        if (member)
+                c_dvar_write(&v, "(y<s>)", DBUS_MESSAGE_FIELD_MEMBER, c_dvar_type_s, member);
+        if (reply_serial)
+                c_dvar_write(&v, "(y<u>)", DBUS_MESSAGE_FIELD_REPLY_SERIAL, c_dvar_type_u, reply_serial);
+        if (fd >= 0)
+                c_dvar_write(&v, "(y<u>)", DBUS_MESSAGE_FIELD_UNIX_FDS, c_dvar_type_u, 1);
+
+        switch (body) {
+        case BENCH_BODY_STRING:
+                c_dvar_write(&v, "(y<g>)])(s))", DBUS_MESSAGE_FIELD_SIGNATURE, c_dvar_type_g, "s", match);
+                break;
+        case BENCH_BODY_BYTES:
+                c_dvar_write(&v, "(y<g>)])([", DBUS_MESSAGE_FIELD_SIGNATURE, c_dvar_type_g, "ay");
+                for (size_t i = 0; i < n_payload; ++i)
+                        c_dvar_write(&v, "y", (uint8_t)i);
+                c_dvar_write(&v, "]))");
+                break;
+        default:
+                c_dvar_write(&v, "])())");
+                break;
+        }
+
+        r = c_dvar_end_write(&v, &data, &n_data);
+        assert(!r);
+
+        r = message_new_outgoing(&m, data, n_data);
+        assert(!r);
+
+        if (fd >= 0) {
+                r = fdlist_new_with_fds(&m->fds, &fd, 1);
+                assert(!r);
+        }
+
+        return m;
+}
+
+static void bench_peer_queue(BenchPeer *peer, Message *message) {
+        int r;
+
+        r = connection_queue(&peer->connection, NULL, message);
+        assert(!r);
+}
+
+static void bench_peer_pump(BenchPeer *peer) {
+        size_t n_receivers = c_max(peer->n_receivers, (size_t)1);
+
+        /*
+         * Keep the window of in-flight messages filled. For broadcasts, each
+         * signal is in flight until all receivers got it.
+         */
+        while (peer->n_sent < bench_arg_messages &&
+               peer->n_sent * n_receivers - peer->n_acked < bench_arg_window * n_receivers) {
+                bench_peer_queue(peer, peer->messages[peer->n_sent % peer->n_messages]);
+                ++peer->n_sent;
+        }
+}
+
+static void bench_peer_ack(BenchPeer *peer) {
+        BenchThread *thread = peer->thread;
+        size_t n_receivers = c_max(peer->n_receivers, (size_t)1);
+
+        ++peer->n_acked;
+        bench_peer_pump(peer);
+
+        if (peer->n_acked == bench_arg_messages * n_receivers) {
+                assert(thread->n_busy > 0);
+                --thread->n_busy;
+        }
+}
+
+static void bench_peer_prepare(BenchPeer *peer) {
+        BenchThread *thread = peer->thread;
+        Message *m;
+
+        switch (bench_arg_profile) {
+        case BENCH_PROFILE_UNICAST:
+        case BENCH_PROFILE_FDS:
+        case BENCH_PROFILE_DENIED:
+                /*
+                 * Calls of the sender use serials in a round-robin fashion.
+                 * Replies arrive in order, so a serial is only re-used once
+                 * its reply was received. The receiver prepares a reply for
+                 * each of those serials.
+                 */
+                peer->n_messages = bench_arg_window;
+                peer->messages = calloc(peer->n_messages, sizeof(*peer->messages));
+                assert(peer->messages);
+
+                for (size_t i = 0; i < peer->n_messages; ++i) {
+                        if (peer->sender)
+                                m = bench_message_new(DBUS_MESSAGE_TYPE_METHOD_CALL,
+                                                      BENCH_SERIAL_BASE + i,
+                                                      0,
+                                                      peer->partner->unique,
+                                                      "/org/bus1/Bench",
+                                                      (bench_arg_profile == BENCH_PROFILE_DENIED) ? "org.bus1.Denied" : "org.bus1.Bench",
+                                                      "Call",
+                                                      NULL,
+                                                      bench_arg_payload,
+                                                      (bench_arg_profile == BENCH_PROFILE_FDS) ? thread->fd : -1);
+                        else
+                                m = bench_message_new(DBUS_MESSAGE_TYPE_METHOD_RETURN,
+                                                      BENCH_SERIAL_BASE + i,
+                                                      BENCH_SERIAL_BASE + i,
+                                                      peer->partner->unique,
+                                                      NULL,
+                                                      NULL,
+                                                      NULL,
+                                                      NULL,
+                                                      0,
+                                                      -1);
+
+                        peer->messages[i] = m;
+                }
+                break;
+
+        case BENCH_PROFILE_BROADCAST:
+                if (peer->sender) {
+                        peer->n_messages = 1;
+                        peer->messages = calloc(peer->n_messages, sizeof(*peer->messages));
+                        assert(peer->messages);
+
+                        peer->messages[0] = bench_message_new(DBUS_MESSAGE_TYPE_SIGNAL,
+                                                              BENCH_SERIAL_BASE,
+                                                              0,
+                                                              NULL,
+                                                              "/org/bus1/Bench",
+                                                              "org.bus1.Bench",
+                                                              "Signal",
+                                                              NULL,
+                                                              bench_arg_payload,
+                                                              -1);
+                } else {
+                        _c_cleanup_(message_unrefp) Message *match = NULL;
+                        _c_cleanup_(c_freep) char *rule = NULL;
+                        int r;
+
+                        r = asprintf(&rule, "type='signal',sender='%s',interface='org.bus1.Bench'", peer->partner->unique);
+                        assert(r >= 0);
+
+                        match = bench_message_new(DBUS_MESSAGE_TYPE_METHOD_CALL,
+                                                  BENCH_SERIAL_MATCH,
+                                                  0,
+                                                  "org.freedesktop.DBus",
+                                                  "/org/freedesktop/DBus",
+                                                  "org.freedesktop.DBus",
+                                                  "AddMatch",
+                                                  rule,
+                                                  0,
+                                                  -1);
+
+                        bench_peer_queue(peer, match);
+                        ++thread->n_setup;
+                }
+                break;
+
+        case BENCH_PROFILE_DRIVER:
+                peer->n_messages = 1;
+                peer->messages = calloc(peer->n_messages, sizeof(*peer->messages));
+                assert(peer->messages);
+
+                peer->messages[0] = bench_message_new(DBUS_MESSAGE_TYPE_METHOD_CALL,
+                                                      BENCH_SERIAL_BASE,
+                                                      0,
+                                                      "org.freedesktop.DBus",
+                                                      "/org/freedesktop/DBus",
+                                                      "org.freedesktop.DBus",
+                                                      "GetId",
+                                                      NULL,
+                                                      0,
+                                                      -1);
+                break;
+
+        default:
+                assert(0);
+                abort();
+        }
+}
+
+static void bench_thread_advance(BenchThread *thread) {
+        size_t i;
+
+        if (thread->n_setup)
+                return;
+
+        if (!thread->prepared) {
+                /* all peers said Hello(), now prepare the traffic */
+                thread->prepared = true;
+                for (i = 0; i < thread->n_peers; ++i)
+                        bench_peer_prepare(&thread->peers[i]);
+
+                /* wait for AddMatch() replies, if any */
+                if (thread->n_setup)
+                        return;
+        }
+
+        thread->start = bench_now();
+
+        for (i = 0; i < thread->n_peers; ++i) {
+                if (thread->peers[i].sender) {
+                        ++thread->n_busy;
+                        bench_peer_pump(&thread->peers[i]);
+                }
+        }
+}
+
+static void bench_peer_handle(BenchPeer *peer, Message *m) {
+        BenchThread *thread = peer->thread;
+        int r;
+
+        if (_c_unlikely_(!peer->ready)) {
+                /* wait for the Hello() reply and the NameAcquired signal */
+                r = message_parse_metadata(m, NULL);
+                assert(!r);
+
+                if (m->metadata.header.type == DBUS_MESSAGE_TYPE_SIGNAL) {
+                        assert(!strcmp(m->metadata.fields.member, "NameAcquired"));
+                        peer->acquired = true;
+                } else {
+                        assert(m->metadata.header.type == DBUS_MESSAGE_TYPE_METHOD_RETURN);
+                        assert(m->metadata.fields.reply_serial == BENCH_SERIAL_HELLO);
+                        assert(strlen(m->metadata.args[0].value) < sizeof(peer->unique));
+
+                        strcpy(peer->unique, m->metadata.args[0].value);
+                }
+
+                if (peer->acquired && *peer->unique) {
+                        peer->ready = true;
+                        --thread->n_setup;
+                        bench_thread_advance(thread);
+                }
+
+                return;
+        }
+
+        ++thread->n_transferred;
+
+        switch (m->header->type) {
+        case DBUS_MESSAGE_TYPE_METHOD_CALL:
+                /* a reply was prepared for each serial of our partner */
+                bench_peer_queue(peer, peer->messages[(message_read_serial(m) - BENCH_SERIAL_BASE) % peer->n_messages]);
+                ++thread->n_transferred;
+                break;
+        case DBUS_MESSAGE_TYPE_METHOD_RETURN:
+                if (bench_arg_profile == BENCH_PROFILE_BROADCAST && !peer->sender) {
+                        /* AddMatch() reply */
+                        --thread->n_transferred;
+                        --thread->n_setup;
+                        bench_thread_advance(thread);
+                } else {
+                        bench_peer_ack(peer);
+                }
+                break;
+        case DBUS_MESSAGE_TYPE_SIGNAL:
+                bench_peer_ack(peer->partner);
+                break;
+        case DBUS_MESSAGE_TYPE_ERROR:
+                if (bench_arg_profile == BENCH_PROFILE_DENIED && peer->sender) {
+                        /* the driver refused the call on behalf of our partner */
+                        bench_peer_ack(peer);
+                        break;
+                }
+
+                r = message_parse_metadata(m, NULL);
+                assert(!r);
+
+                fprintf(stderr, "%s: unexpected error reply: %s\n",
+                        peer->unique, m->metadata.fields.error_name);
+                abort();
+        default:
+                assert(0);
+                abort();
+        }
+}
+
+static int bench_peer_dispatch(DispatchFile *file) {
+        BenchPeer *peer = c_container_of(file, BenchPeer, connection.socket_file);
+        BenchThread *thread = peer->thread;
+        int r;
+
+        r = connection_dispatch(&peer->connection, dispatch_file_events(file));
+        assert(!r);
+
+        for (;;) {
+                _c_cleanup_(message_unrefp) Message *m = NULL;
+
+                r = connection_dequeue(&peer->connection, &m);
+                if (r == CONNECTION_E_EOF) {
+                        fprintf(stderr, "%s: disconnected by the bus\n", peer->unique);
+                        return DISPATCH_E_FAILURE;
+                }
+
+                assert(!r);
+                if (!m)
+                        break;
+
+                bench_peer_handle(peer, m);
+        }
+
+        if (thread->start && !thread->n_setup && !thread->n_busy) {
+                thread->end = bench_now();
+                return DISPATCH_E_EXIT;
+        }
+
+        return 0;
+}
+
+static void bench_peer_deinit(BenchPeer *peer) {
+        for (size_t i = 0; i < peer->n_messages; ++i)
+                message_unref(peer->messages[i]);
+        free(peer->messages);
+        connection_deinit(&peer->connection);
+}
+
+static void *bench_thread_fn(void *userdata) {
+        _c_cleanup_(message_unrefp) Message *hello = NULL;
+        BenchThread *thread = userdata;
+        BenchPeer *peer;
+        size_t i, j;
+        int r, fd;
+
+        r = dispatch_context_init(&thread->dispatcher);
+        assert(!r);
+
+        hello = bench_message_new(DBUS_MESSAGE_TYPE_METHOD_CALL,
+                                  BENCH_SERIAL_HELLO,
+                                  0,
+                                  "org.freedesktop.DBus",
+                                  "/org/freedesktop/DBus",
+                                  "org.freedesktop.DBus",
+                                  "Hello",
+                                  NULL,
+                                  0,
+                                  -1);
+
+        for (i = 0; i < thread->n_peers; ++i) {
+                peer = &thread->peers[i];
+                *peer = (BenchPeer)BENCH_PEER_NULL(*peer);
+                peer->thread = thread;
+
+                /* the first peer of each group sends to the others */
+                j = i - i % thread->n_group;
+                peer->sender = (i == j);
+                peer->partner = (i == j) ? &thread->peers[c_min(j + 1, thread->n_peers - 1)] : &thread->peers[j];
+                if (peer->sender && bench_arg_profile == BENCH_PROFILE_BROADCAST)
+                        peer->n_receivers = c_min(thread->n_group, thread->n_peers - j) - 1;
+
+                fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                assert(fd >= 0);
+
+                r = connect(fd, (struct sockaddr *)&bench_address, bench_n_address);
+                assert(r >= 0);
+
+                r = connection_init_client(&peer->connection, &thread->dispatcher, bench_peer_dispatch, NULL, fd);
+                assert(!r);
+
+                r = connection_open(&peer->connection);
+                assert(!r);
+
+                bench_peer_queue(peer, hello);
+        }
+
+        thread->n_setup = thread->n_peers;
+
+        do {
+                r = dispatch_context_dispatch(&thread->dispatcher);
+        } while (!r);
+
+        for (i = 0; i < thread->n_peers; ++i)
+                bench_peer_deinit(&thread->peers[i]);
+        dispatch_context_deinit(&thread->dispatcher);
+
+        /* release the fdlists pooled by this thread */
+        hello = message_unref(hello);
+        fdlist_flush();
+
+        return (void *)(uintptr_t)(r != DISPATCH_E_EXIT);
+}
+
+static void bench_run(void) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        BenchThread *threads;
+        uint64_t start = UINT64_MAX, end = 0, n_transferred = 0;
+        size_t i, n_group, n_peers;
+        bool failed = false;
+        void *value;
+        int r, fd;
+
+        if (bench_arg_address) {
+                bench_address.sun_family = AF_UNIX;
+                assert(strlen(bench_arg_address) < sizeof(bench_address.sun_path));
+                strcpy(bench_address.sun_path, bench_arg_address);
+                bench_n_address = offsetof(struct sockaddr_un, sun_path) + strlen(bench_arg_address) + 1;
+        } else {
+                util_broker_new(&broker);
+                util_broker_spawn(broker);
+
+                bench_address = broker->address;
+                bench_n_address = broker->n_address;
+        }
+
+        switch (bench_arg_profile) {
+        case BENCH_PROFILE_BROADCAST:
+                n_group = bench_arg_group;
+                break;
+        case BENCH_PROFILE_DRIVER:
+                n_group = 1;
+                break;
+        default:
+                n_group = 2;
+                break;
+        }
+
+        fd = eventfd(0, EFD_CLOEXEC);
+        assert(fd >= 0);
+
+        threads = calloc(bench_arg_threads, sizeof(*threads));
+        assert(threads);
+
+        /* every thread gets an equal share of peers, rounded to full groups */
+        n_peers = c_max(bench_arg_peers / bench_arg_threads / n_group, (size_t)1) * n_group;
+
+        for (i = 0; i < bench_arg_threads; ++i) {
+                threads[i].fd = fd;
+                threads[i].n_group = n_group;
+                threads[i].n_peers = n_peers;
+                threads[i].peers = calloc(n_peers, sizeof(*threads[i].peers));
+                assert(threads[i].peers);
+
+                r = pthread_create(&threads[i].thread, NULL, bench_thread_fn, &threads[i]);
+                assert(!r);
+        }
+
+        for (i = 0; i < bench_arg_threads; ++i) {
+                r = pthread_join(threads[i].thread, &value);
+                assert(!r);
+
+                failed |= !!value;
+                start = c_min(start, threads[i].start);
+                end = c_max(end, threads[i].end);
+                n_transferred += threads[i].n_transferred;
+
+                free(threads[i].peers);
+        }
+
+        free(threads);
+        c_close(fd);
+
+        if (broker)
+                util_broker_terminate(broker);
+
+        if (failed) {
+                fprintf(stderr, "Benchmark failed\n");
+                exit(1);
+        }
+
+        printf("profile:      %s\n", bench_profiles[bench_arg_profile]);
+        printf("peers:        %zu (%zu threads, %zu per thread)\n", n_peers * bench_arg_threads, bench_arg_threads, n_peers);
+        printf("messages:     %" PRIu64 "\n", n_transferred);
+        printf("duration:     %.3f s\n", (end - start) / 1000000000.0);
+        printf("throughput:   %.0f messages/s\n", n_transferred * 1000000000.0 / c_max(end - start, (uint64_t)1));
+}
+
+static void help(void) {
+        printf("%s [OPTIONS...]\n\n"
+               "Raw protocol load generator\n\n"
+               "  -h --help                     Show this help\n"
+               "     --profile PROFILE          Traffic profile: unicast, fds, denied, broadcast or driver\n"
+               "     --address PATH             Connect to the bus at PATH, rather than spawning a broker\n"
+               "     --peers N                  Total number of peers\n"
+               "     --threads N                Number of client threads\n"
+               "     --messages N               Number of messages each sending peer sends\n"
+               "     --window N                 Number of messages each sending peer keeps in flight\n"
+               "     --group N                  Number of peers per broadcast group\n"
+               "     --payload BYTES            Size of the message payload\n"
+               , program_invocation_short_name);
+}
+
+static int parse_size(const char *arg, size_t min, size_t *valuep) {
+        unsigned long long vul;
+        char *end;
+
+        errno = 0;
+        vul = strtoull(arg, &end, 10);
+        if (errno != 0 || *end || arg == end || vul < min || vul > SIZE_MAX) {
+                fprintf(stderr, "%s: invalid number -- '%s'\n", program_invocation_name, arg);
+                return -EINVAL;
+        }
+
+        *valuep = vul;
+        return 0;
+}
+
+static int parse_argv(int argc, char *argv[]) {
+        enum {
+                ARG_PROFILE = 0x100,
+                ARG_ADDRESS,
+                ARG_PEERS,
+                ARG_THREADS,
+                ARG_MESSAGES,
+                ARG_WINDOW,
+                ARG_GROUP,
+                ARG_PAYLOAD,
+        };
+        static const struct option options[] = {
+                { "help",               no_argument,            NULL,   'h'                     },
+                { "profile",            required_argument,      NULL,   ARG_PROFILE             },
+                { "address",            required_argument,      NULL,   ARG_ADDRESS             },
+                { "peers",              required_argument,      NULL,   ARG_PEERS               },
+                { "threads",            required_argument,      NULL,   ARG_THREADS             },
+                { "messages",           required_argument,      NULL,   ARG_MESSAGES            },
+                { "window",             required_argument,      NULL,   ARG_WINDOW              },
+                { "group",              required_argument,      NULL,   ARG_GROUP               },
+                { "payload",            required_argument,      NULL,   ARG_PAYLOAD             },
+                {}
+        };
+        int r, c;
+
+        while ((c = getopt_long(argc, argv, "h", options, NULL)) >= 0) {
+                switch (c) {
+                case 'h':
+                        help();
+                        return 1;
+
+                case ARG_PROFILE:
+                        for (r = 0; r < _BENCH_PROFILE_N; ++r)
+                                if (!strcmp(optarg, bench_profiles[r]))
+                                        break;
+
+                        if (r >= _BENCH_PROFILE_N) {
+                                fprintf(stderr, "%s: invalid profile -- '%s'\n", program_invocation_name, optarg);
+                                return -EINVAL;
+                        }
+
+                        bench_arg_profile = r;
+                        break;
+
+                case ARG_ADDRESS:
+                        if (strlen(optarg) >= sizeof(bench_address.sun_path)) {
+                                fprintf(stderr, "%s: address too long -- '%s'\n", program_invocation_name, optarg);
+                                return -EINVAL;
+                        }
+
+                        bench_arg_address = optarg;
+                        break;
+
+                case ARG_PEERS:
+                        r = parse_size(optarg, 1, &bench_arg_peers);
+                        if (r)
+                                return r;
+                        break;
+
+                case ARG_THREADS:
+                        r = parse_size(optarg, 1, &bench_arg_threads);
+                        if (r)
+                                return r;
+                        break;
+
+                case ARG_MESSAGES:
+                        r = parse_size(optarg, 1, &bench_arg_messages);
+                        if (r)
+                                return r;
+                        break;
+
+                case ARG_WINDOW:
+                        r = parse_size(optarg, 1, &bench_arg_window);
+                        if (r)
+                                return r;
+                        break;
+
+                case ARG_GROUP:
+                        r = parse_size(optarg, 2, &bench_arg_group);
+                        if (r)
+                                return r;
+                        break;
+
+                case ARG_PAYLOAD:
+                        r = parse_size(optarg, 0, &bench_arg_payload);
+                        if (r)
+                                return r;
+                        break;
+
+                case '?':
+                        /* getopt_long() prints warning */
+                        return -EINVAL;
+
+                default:
+                        abort();
+                }
+        }
+
+        if (optind != argc) {
+                fprintf(stderr, "%s: invalid arguments -- '%s'\n", program_invocation_name, argv[optind]);
+                return -EINVAL;
+        }
+
+        return 0;
+}
+
+int main(int argc, char **argv) {
+        int r;
+
+        r = parse_argv(argc, argv);
+        if (r)
+                return (r > 0) ? 0 : 1;
+
+        bench_run();
+
+        return 0;
+}
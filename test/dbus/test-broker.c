@@ -3,7 +3,10 @@
  */
 
 #include <c-macro.h>
+#include <poll.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "util-broker.h"
 
 static void test_dummy(void) {
@@ -153,11 +156,461 @@ static void test_ping_pong(void) {
         util_broker_terminate(broker);
 }
 
+#define TEST_FLOOD_MAX_BYTES (256U * 1024U)
+#define TEST_FLOOD_N_CALLS (64U)
+#define TEST_FLOOD_N_REPLY (4096U)
+#define TEST_FLOOD_N_SIGNALS (512U)
+#define TEST_FLOOD_N_FILL (4096U)
+
+typedef struct TestFlood {
+        sd_bus_message *calls[TEST_FLOOD_N_CALLS];
+        unsigned int n_held;
+        unsigned int n_refused;
+        unsigned int n_answered;
+        unsigned int n_replies;
+        unsigned int n_signals;
+} TestFlood;
+
+static void test_flood_connect_as(Broker *broker, uid_t uid, sd_bus **busp) {
+        int r;
+
+        /* the broker charges a peer on the effective uid it connected with */
+        r = seteuid(uid);
+        assert(!r);
+
+        util_broker_connect(broker, busp);
+
+        r = seteuid(0);
+        assert(!r);
+}
+
+static int test_flood_server_fn(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        TestFlood *flood = userdata;
+
+        /* hold on to the call, it is answered later on */
+        assert(flood->n_held < TEST_FLOOD_N_CALLS);
+        flood->calls[flood->n_held++] = sd_bus_message_ref(m);
+        return 1;
+}
+
+static int test_flood_client_fn(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        TestFlood *flood = userdata;
+        const sd_bus_error *e;
+
+        /* calls are either refused up front, or answered by the server */
+        e = sd_bus_message_get_error(m);
+        if (e) {
+                assert(!strcmp(e->name, "org.freedesktop.DBus.Error.LimitsExceeded"));
+                assert(!flood->n_answered);
+                ++flood->n_refused;
+        } else {
+                ++flood->n_replies;
+        }
+
+        return 0;
+}
+
+static int test_flood_signal_fn(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        TestFlood *flood = userdata;
+
+        if (!sd_bus_message_is_signal(m, "com.example.Flood", "Fill"))
+                return 0;
+
+        ++flood->n_signals;
+        return 1;
+}
+
+static void test_flood_wait(sd_bus *server, sd_bus *client, TestFlood *flood) {
+        struct pollfd fds[2];
+        int r;
+
+        /* run until every call was held or refused, and every answer arrived */
+        while (flood->n_held + flood->n_refused < TEST_FLOOD_N_CALLS ||
+               flood->n_replies < flood->n_answered) {
+                r = sd_bus_process(server, NULL);
+                assert(r >= 0);
+                if (r > 0)
+                        continue;
+
+                r = sd_bus_process(client, NULL);
+                assert(r >= 0);
+                if (r > 0)
+                        continue;
+
+                fds[0] = (struct pollfd){ .fd = sd_bus_get_fd(server), .events = sd_bus_get_events(server) };
+                fds[1] = (struct pollfd){ .fd = sd_bus_get_fd(client), .events = sd_bus_get_events(client) };
+
+                r = poll(fds, C_ARRAY_SIZE(fds), -1);
+                assert(r > 0);
+        }
+}
+
+static void test_reply_flood(void) {
+        static const uint8_t payload[TEST_FLOOD_N_FILL];
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *server = NULL, *flooder = NULL, *client = NULL;
+        TestFlood flood = {};
+        const char *server_name, *client_name;
+        int r;
+
+        /*
+         * This fills the quota of a client with other traffic, while replies
+         * to its calls are pending. The broker reserves quota for each reply
+         * when the call is made, so every reply must still be delivered and
+         * the client must not be disconnected. Calls the broker cannot reserve
+         * quota for are refused up front.
+         *
+         * Server and flooder run as different users than the client, so their
+         * charges on the client are limited to their share of its quota.
+         * Otherwise, the broker would run out of quota to queue its own
+         * errors on the client.
+         */
+
+        /* reply reservations are specific to dbus-broker */
+        if (getenv("DBUS_BROKER_TEST_DAEMON"))
+                return;
+
+        /* connecting as another user requires privileges */
+        if (geteuid() != 0)
+                return;
+
+        util_broker_new(&broker);
+        broker->max_bytes = TEST_FLOOD_MAX_BYTES;
+        util_broker_spawn(broker);
+
+        /* setup server, which holds on to all calls */
+        {
+                test_flood_connect_as(broker, 65534, &server);
+
+                r = sd_bus_add_object(server, NULL, "/com/example/Flood", test_flood_server_fn, &flood);
+                assert(r >= 0);
+
+                r = sd_bus_get_unique_name(server, &server_name);
+                assert(r >= 0);
+        }
+
+        /* setup client */
+        {
+                util_broker_connect(broker, &client);
+
+                r = sd_bus_add_filter(client, NULL, test_flood_signal_fn, &flood);
+                assert(r >= 0);
+
+                r = sd_bus_get_unique_name(client, &client_name);
+                assert(r >= 0);
+        }
+
+        /*
+         * Issue more calls than the server may reserve quota for on the
+         * client. Some of them reach the server, the others are refused.
+         */
+        {
+                for (unsigned int i = 0; i < TEST_FLOOD_N_CALLS; ++i) {
+                        r = sd_bus_call_method_async(client,
+                                                     NULL,
+                                                     server_name,
+                                                     "/com/example/Flood",
+                                                     "com.example.Flood",
+                                                     "Flood",
+                                                     test_flood_client_fn,
+                                                     &flood,
+                                                     NULL);
+                        assert(r >= 0);
+                }
+
+                test_flood_wait(server, client, &flood);
+                assert(flood.n_held > 0);
+                assert(flood.n_refused > 0);
+        }
+
+        /*
+         * Fill the quota of the client from a third user, while it does not
+         * read. This sends more than the socket buffers and the quota can
+         * hold, so some of the signals are dropped. The final call makes sure
+         * the broker saw all of them.
+         */
+        {
+                test_flood_connect_as(broker, 65533, &flooder);
+
+                for (unsigned int i = 0; i < TEST_FLOOD_N_SIGNALS; ++i) {
+                        _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *signal = NULL;
+
+                        r = sd_bus_message_new_signal(flooder, &signal, "/com/example/Flood", "com.example.Flood", "Fill");
+                        assert(r >= 0);
+
+                        r = sd_bus_message_set_destination(signal, client_name);
+                        assert(r >= 0);
+
+                        r = sd_bus_message_append_array(signal, 'y', payload, sizeof(payload));
+                        assert(r >= 0);
+
+                        r = sd_bus_send(flooder, signal, NULL);
+                        assert(r >= 0);
+                }
+
+                r = sd_bus_call_method(flooder, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                       "GetId", NULL, NULL, NULL);
+                assert(r >= 0);
+        }
+
+        /* answer all held calls, and verify every reply makes it */
+        {
+                static char reply[TEST_FLOOD_N_REPLY];
+
+                memset(reply, 'x', sizeof(reply) - 1);
+
+                for (unsigned int i = 0; i < flood.n_held; ++i) {
+                        r = sd_bus_reply_method_return(flood.calls[i], "s", reply);
+                        assert(r >= 0);
+
+                        flood.calls[i] = sd_bus_message_unref(flood.calls[i]);
+                }
+
+                flood.n_answered = flood.n_held;
+
+                test_flood_wait(server, client, &flood);
+                assert(flood.n_replies == flood.n_held);
+                assert(flood.n_signals < TEST_FLOOD_N_SIGNALS);
+
+                r = sd_bus_call_method(client, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                       "GetId", NULL, NULL, NULL);
+                assert(r >= 0);
+        }
+
+        util_broker_terminate(broker);
+}
+
+#define TEST_DRAIN_N_SIGNALS (256U)
+#define TEST_DRAIN_N_PAYLOAD (16U * 1024U)
+
+static int test_drain_server_fn(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        unsigned int *counters = userdata;
+
+        if (sd_bus_message_is_signal(m, "com.example.Drain", "Queued")) {
+                ++counters[0];
+                return 1;
+        } else if (sd_bus_message_is_method_call(m, "com.example.Drain", "Call")) {
+                /* the call was sent last, so all signals must be in by now */
+                assert(counters[0] == TEST_DRAIN_N_SIGNALS);
+                ++counters[1];
+                return sd_bus_reply_method_return(m, NULL);
+        }
+
+        return 0;
+}
+
+static int test_drain_client_fn(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        bool *done = userdata;
+        const sd_bus_error *e;
+
+        /* the pending call must be answered by the server, not by the broker */
+        e = sd_bus_message_get_error(m);
+        assert(!e);
+
+        *done = true;
+        return 0;
+}
+
+static void test_drain(void) {
+        static const uint8_t payload[TEST_DRAIN_N_PAYLOAD];
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *server = NULL, *client = NULL;
+        unsigned int counters[2] = {};
+        const char *unique;
+        bool done = false;
+        int r;
+
+        /*
+         * This queues more signals on a server than its socket can take, and
+         * then calls a method on it, before the broker is asked to drain. New
+         * calls must be refused from then on. Yet, every queued signal, as
+         * well as the reply to the pending call, must be delivered before the
+         * broker exits on its own.
+         */
+
+        /* draining is specific to dbus-broker */
+        if (getenv("DBUS_BROKER_TEST_DAEMON"))
+                return;
+
+        util_broker_new(&broker);
+        util_broker_spawn(broker);
+
+        /* setup server */
+        {
+                util_broker_connect(broker, &server);
+
+                r = sd_bus_add_filter(server, NULL, test_drain_server_fn, counters);
+                assert(r >= 0);
+
+                r = sd_bus_get_unique_name(server, &unique);
+                assert(r >= 0);
+        }
+
+        /* setup client and queue all messages, while the server does not read */
+        {
+                util_broker_connect(broker, &client);
+
+                for (unsigned int i = 0; i < TEST_DRAIN_N_SIGNALS; ++i) {
+                        _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+
+                        r = sd_bus_message_new_signal(client, &m, "/com/example/Drain", "com.example.Drain", "Queued");
+                        assert(r >= 0);
+
+                        r = sd_bus_message_set_destination(m, unique);
+                        assert(r >= 0);
+
+                        r = sd_bus_message_append_array(m, 'y', payload, sizeof(payload));
+                        assert(r >= 0);
+
+                        r = sd_bus_send(client, m, NULL);
+                        assert(r >= 0);
+                }
+
+                r = sd_bus_call_method_async(client, NULL, unique, "/com/example/Drain", "com.example.Drain",
+                                             "Call", test_drain_client_fn, &done, NULL);
+                assert(r >= 0);
+
+                /* the broker handles messages in order, so all of the above were forwarded */
+                r = sd_bus_call_method(client, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                       "GetId", NULL, NULL, NULL);
+                assert(r >= 0);
+        }
+
+        /* start draining, and wait for new calls to be refused */
+        {
+                util_broker_drain(broker);
+
+                for (unsigned int i = 0; ; ++i) {
+                        _c_cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+
+                        r = sd_bus_call_method(client, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                               "GetId", &error, NULL, NULL);
+                        if (r < 0) {
+                                assert(!strcmp(error.name, "org.freedesktop.DBus.Error.NoServer"));
+                                break;
+                        }
+
+                        assert(i < 1000);
+                        usleep(1000);
+                }
+        }
+
+        /* calls to the server are refused as well */
+        {
+                _c_cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+
+                r = sd_bus_call_method(client, unique, "/com/example/Drain", "com.example.Drain",
+                                       "Call", &error, NULL, NULL);
+                assert(r < 0);
+                assert(!strcmp(error.name, "org.freedesktop.DBus.Error.NoServer"));
+        }
+
+        /* now read everything that was queued, and answer the pending call */
+        while (counters[0] < TEST_DRAIN_N_SIGNALS || counters[1] < 1) {
+                r = sd_bus_process(server, NULL);
+                assert(r >= 0);
+                if (!r) {
+                        r = sd_bus_wait(server, (uint64_t)-1);
+                        assert(r >= 0);
+                }
+        }
+
+        r = sd_bus_flush(server);
+        assert(r >= 0);
+
+        /* the reply must be delivered, even though the broker exits right after */
+        while (!done) {
+                r = sd_bus_process(client, NULL);
+                assert(r >= 0);
+                if (!r) {
+                        r = sd_bus_wait(client, (uint64_t)-1);
+                        assert(r >= 0);
+                }
+        }
+
+        /* with nothing left to deliver, the broker exits without being told to */
+        util_broker_wait(broker);
+}
+
+static void test_receive_policy(void) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *denied = NULL, *allowed = NULL, *receiver = NULL;
+        const char *unique_allowed;
+        int r;
+
+        /*
+         * Broadcasts through a match that pins type, path, interface and
+         * member may skip the receive-policy, if it cannot depend on the
+         * sender. Verify a receive_sender= specific deny is still honored on
+         * such a match, while other senders get through.
+         */
+
+        /* the test policy is specific to dbus-broker */
+        if (getenv("DBUS_BROKER_TEST_DAEMON"))
+                return;
+
+        util_broker_new(&broker);
+        util_broker_spawn(broker);
+
+        util_broker_connect(broker, &denied);
+        util_broker_connect(broker, &allowed);
+        util_broker_connect(broker, &receiver);
+
+        r = sd_bus_get_unique_name(allowed, &unique_allowed);
+        assert(r >= 0);
+
+        r = sd_bus_call_method(denied, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                               "RequestName", NULL, NULL,
+                               "su", "org.bus1.DeniedSender", 0);
+        assert(r >= 0);
+
+        r = sd_bus_call_method(receiver, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                               "AddMatch", NULL, NULL,
+                               "s", "type='signal',path='/org/example',interface='org.example',member='Foo'");
+        assert(r >= 0);
+
+        /* the round-trip guarantees the broker dispatched the signal before the next one */
+        r = sd_bus_emit_signal(denied, "/org/example", "org.example", "Foo", NULL);
+        assert(r >= 0);
+        r = sd_bus_call_method(denied, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                               "GetId", NULL, NULL, NULL);
+        assert(r >= 0);
+
+        r = sd_bus_emit_signal(allowed, "/org/example", "org.example", "Foo", NULL);
+        assert(r >= 0);
+        r = sd_bus_flush(allowed);
+        assert(r >= 0);
+
+        /* the first signal to arrive must be the one of the allowed sender */
+        for (;;) {
+                _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+
+                r = sd_bus_process(receiver, &m);
+                assert(r >= 0);
+
+                if (m && sd_bus_message_is_signal(m, "org.example", "Foo")) {
+                        assert(!strcmp(sd_bus_message_get_sender(m), unique_allowed));
+                        break;
+                }
+
+                if (r > 0)
+                        continue;
+
+                r = sd_bus_wait(receiver, (uint64_t)-1);
+                assert(r >= 0);
+        }
+
+        util_broker_terminate(broker);
+}
+
 int main(int argc, char **argv) {
         test_dummy();
         test_connect();
         test_self_ping();
         test_ping_pong();
+        test_reply_flood();
+        test_drain();
+        test_receive_policy();
 
         return 0;
 }
@@ -3,7 +3,9 @@
  */
 
 #include <c-macro.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "../../src/dbus/protocol.h"
 #include "util-broker.h"
 
@@ -758,6 +760,160 @@ static void test_list_activatable_names(void) {
         util_broker_terminate(broker);
 }
 
+static int test_activation_timeout_fn(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        const sd_bus_error *e;
+        bool *done = userdata;
+
+        e = sd_bus_message_get_error(m);
+        assert(e);
+        assert(!strcmp(e->name, "org.freedesktop.DBus.Error.TimedOut"));
+
+        *done = true;
+        return 0;
+}
+
+static void test_activation_timeout(void) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        int r;
+
+        /* activatable names can only be registered on dbus-broker */
+        if (getenv("DBUS_BROKER_TEST_DAEMON"))
+                return;
+
+        util_broker_new(&broker);
+        broker->activatable = "com.example.foo";
+        util_broker_spawn(broker);
+
+        /* the name is never claimed, so StartServiceByName() must time out */
+        {
+                _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+                _c_cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+
+                util_broker_connect(broker, &bus);
+
+                r = sd_bus_call_method(bus, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                       "StartServiceByName", &error, NULL,
+                                       "su", "com.example.foo", 0);
+                assert(r < 0);
+                assert(!strcmp(error.name, "org.freedesktop.DBus.Error.TimedOut"));
+        }
+
+        /* method calls and requests queued on the same activation must all fail */
+        {
+                _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus1 = NULL, *bus2 = NULL;
+                _c_cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+                bool done = false;
+
+                util_broker_connect(broker, &bus1);
+                util_broker_connect(broker, &bus2);
+
+                r = sd_bus_call_method_async(bus1, NULL, "com.example.foo", "/com/example/foo", "com.example.foo",
+                                             "Foo", test_activation_timeout_fn, &done,
+                                             "");
+                assert(r >= 0);
+
+                r = sd_bus_flush(bus1);
+                assert(r >= 0);
+
+                r = sd_bus_call_method(bus2, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                       "StartServiceByName", &error, NULL,
+                                       "su", "com.example.foo", 0);
+                assert(r < 0);
+                assert(!strcmp(error.name, "org.freedesktop.DBus.Error.TimedOut"));
+
+                while (!done) {
+                        r = sd_bus_process(bus1, NULL);
+                        assert(r >= 0);
+                        if (r > 0)
+                                continue;
+
+                        r = sd_bus_wait(bus1, (uint64_t)-1);
+                        assert(r >= 0);
+                }
+        }
+
+        util_broker_terminate(broker);
+}
+
+static int test_activation_limits_fn(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        unsigned int *counters = userdata;
+        const sd_bus_error *e;
+
+        e = sd_bus_message_get_error(m);
+        assert(e);
+
+        if (!strcmp(e->name, "org.freedesktop.DBus.Error.TimedOut"))
+                ++counters[0];
+        else if (!strcmp(e->name, "org.freedesktop.DBus.Error.LimitsExceeded"))
+                ++counters[1];
+        else
+                assert(0);
+
+        return 0;
+}
+
+static void test_activation_limits(void) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        int r;
+
+        /* activatable names can only be registered on dbus-broker */
+        if (getenv("DBUS_BROKER_TEST_DAEMON"))
+                return;
+
+        util_broker_new(&broker);
+        broker->activatable = "com.example.foo";
+        broker->activatable_messages = 4;
+        util_broker_spawn(broker);
+
+        /*
+         * The name is never claimed, so calls queue up on it. Only four of
+         * them fit, everything beyond is refused right away, and the queued
+         * ones time out eventually.
+         */
+        {
+                _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+                unsigned int counters[2] = {};
+
+                util_broker_connect(broker, &bus);
+
+                for (unsigned int i = 0; i < 6; ++i) {
+                        r = sd_bus_call_method_async(bus, NULL, "com.example.foo", "/com/example/foo", "com.example.foo",
+                                                     "Foo", test_activation_limits_fn, counters,
+                                                     "");
+                        assert(r >= 0);
+                }
+
+                while (counters[0] + counters[1] < 6) {
+                        r = sd_bus_process(bus, NULL);
+                        assert(r >= 0);
+                        if (r > 0)
+                                continue;
+
+                        r = sd_bus_wait(bus, (uint64_t)-1);
+                        assert(r >= 0);
+                }
+
+                assert(counters[0] == 4);
+                assert(counters[1] == 2);
+        }
+
+        /* once the queue was flushed, there is room again */
+        {
+                _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+                _c_cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+
+                util_broker_connect(broker, &bus);
+
+                r = sd_bus_call_method(bus, "com.example.foo", "/com/example/foo", "com.example.foo",
+                                       "Foo", &error, NULL,
+                                       "");
+                assert(r < 0);
+                assert(!strcmp(error.name, "org.freedesktop.DBus.Error.TimedOut"));
+        }
+
+        util_broker_terminate(broker);
+}
+
 static void test_list_queued_owners(void) {
         _c_cleanup_(util_broker_freep) Broker *broker = NULL;
         int r;
@@ -1285,6 +1441,290 @@ static void test_become_monitor(void) {
         util_broker_terminate(broker);
 }
 
+static int test_connect_peer_fn(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        int *fdp = userdata;
+        const char *sender;
+        int r, fd;
+
+        if (!sd_bus_message_is_signal(m, "org.bus1.DBus.Direct", "PeerConnected"))
+                return 0;
+
+        r = sd_bus_message_read(m, "sh", &sender, &fd);
+        assert(r >= 0);
+        assert(!strcmp(sender, ":1.0"));
+
+        *fdp = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+        assert(*fdp >= 0);
+
+        return 1;
+}
+
+static void test_connect_peer(void) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        int r;
+
+        /* direct connections are specific to dbus-broker */
+        if (getenv("DBUS_BROKER_TEST_DAEMON"))
+                return;
+
+        util_broker_new(&broker);
+        util_broker_spawn(broker);
+
+        /* connect two peers directly, and verify they can talk to each other */
+        {
+                _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus1 = NULL, *bus2 = NULL;
+                _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+                _c_cleanup_(c_closep) int fd1 = -1, fd2 = -1;
+                char buffer[4];
+                int fd;
+
+                util_broker_connect(broker, &bus1);
+                util_broker_connect(broker, &bus2);
+
+                r = sd_bus_add_filter(bus2, NULL, test_connect_peer_fn, &fd2);
+                assert(r >= 0);
+
+                r = sd_bus_call_method(bus1, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.Direct",
+                                       "ConnectPeer", NULL, &reply,
+                                       "s", ":1.1");
+                assert(r >= 0);
+                r = sd_bus_message_read(reply, "h", &fd);
+                assert(r >= 0);
+
+                fd1 = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+                assert(fd1 >= 0);
+
+                while (fd2 < 0) {
+                        r = sd_bus_process(bus2, NULL);
+                        assert(r >= 0);
+                        if (r > 0)
+                                continue;
+
+                        r = sd_bus_wait(bus2, (uint64_t)-1);
+                        assert(r >= 0);
+                }
+
+                r = write(fd1, "ping", 4);
+                assert(r == 4);
+                r = read(fd2, buffer, sizeof(buffer));
+                assert(r == 4);
+                assert(!memcmp(buffer, "ping", 4));
+
+                r = write(fd2, "pong", 4);
+                assert(r == 4);
+                r = read(fd1, buffer, sizeof(buffer));
+                assert(r == 4);
+                assert(!memcmp(buffer, "pong", 4));
+        }
+
+        /* connecting to unknown peers, or to oneself, is refused */
+        {
+                _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+                _c_cleanup_(sd_bus_error_free) sd_bus_error error1 = SD_BUS_ERROR_NULL, error2 = SD_BUS_ERROR_NULL;
+                const char *unique_name;
+
+                util_broker_connect(broker, &bus);
+
+                r = sd_bus_get_unique_name(bus, &unique_name);
+                assert(r >= 0);
+
+                r = sd_bus_call_method(bus, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.Direct",
+                                       "ConnectPeer", &error1, NULL,
+                                       "s", "com.example.foo");
+                assert(r < 0);
+                assert(!strcmp(error1.name, "org.freedesktop.DBus.Error.NameHasNoOwner"));
+
+                r = sd_bus_call_method(bus, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.Direct",
+                                       "ConnectPeer", &error2, NULL,
+                                       "s", unique_name);
+                assert(r < 0);
+                assert(!strcmp(error2.name, "org.freedesktop.DBus.Error.NameHasNoOwner"));
+        }
+
+        util_broker_terminate(broker);
+}
+
+static void test_connect_peer_quota(void) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        int r;
+
+        /* direct connections are specific to dbus-broker */
+        if (getenv("DBUS_BROKER_TEST_DAEMON"))
+                return;
+
+        util_broker_new(&broker);
+        broker->max_objects = 16;
+        util_broker_spawn(broker);
+
+        /*
+         * The broker keeps no state for handed out connections, so a caller
+         * can create far more of them than it may own objects, as long as
+         * the remote peer keeps up reading them.
+         */
+        {
+                _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus1 = NULL, *bus2 = NULL;
+                int fd1, fd2;
+
+                util_broker_connect(broker, &bus1);
+                util_broker_connect(broker, &bus2);
+
+                r = sd_bus_add_filter(bus2, NULL, test_connect_peer_fn, &fd2);
+                assert(r >= 0);
+
+                for (unsigned int i = 0; i < 64; ++i) {
+                        _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+
+                        r = sd_bus_call_method(bus1, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.Direct",
+                                               "ConnectPeer", NULL, &reply,
+                                               "s", ":1.1");
+                        assert(r >= 0);
+                        r = sd_bus_message_read(reply, "h", &fd1);
+                        assert(r >= 0);
+
+                        fd2 = -1;
+                        while (fd2 < 0) {
+                                r = sd_bus_process(bus2, NULL);
+                                assert(r >= 0);
+                                if (r > 0)
+                                        continue;
+
+                                r = sd_bus_wait(bus2, (uint64_t)-1);
+                                assert(r >= 0);
+                        }
+
+                        c_close(fd2);
+                }
+        }
+
+        util_broker_terminate(broker);
+}
+
+static void test_get_queue_length(void) {
+        _c_cleanup_(util_broker_freep) Broker *broker = NULL;
+        int r;
+
+        /* the name-queue interface is specific to dbus-broker */
+        if (getenv("DBUS_BROKER_TEST_DAEMON"))
+                return;
+
+        util_broker_new(&broker);
+        util_broker_spawn(broker);
+
+        /* queue several peers on a well-known name, and verify the length follows the queue */
+        {
+                _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus1 = NULL, *bus2 = NULL, *bus3 = NULL;
+                _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *reply1 = NULL, *reply2 = NULL, *reply3 = NULL;
+                uint32_t length;
+
+                util_broker_connect(broker, &bus1);
+                util_broker_connect(broker, &bus2);
+                util_broker_connect(broker, &bus3);
+
+                r = sd_bus_call_method(bus1, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                       "RequestName", NULL, NULL,
+                                       "su", "com.example.foo", 0);
+                assert(r >= 0);
+                r = sd_bus_call_method(bus2, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                       "RequestName", NULL, NULL,
+                                       "su", "com.example.foo", 0);
+                assert(r >= 0);
+                r = sd_bus_call_method(bus3, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                       "RequestName", NULL, NULL,
+                                       "su", "com.example.foo", 0);
+                assert(r >= 0);
+
+                r = sd_bus_call_method(bus1, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.NameQueue",
+                                       "GetQueueLength", NULL, &reply1,
+                                       "s", "com.example.foo");
+                assert(r >= 0);
+                r = sd_bus_message_read(reply1, "u", &length);
+                assert(r >= 0);
+                assert(length == 3);
+
+                r = sd_bus_call_method(bus2, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                       "ReleaseName", NULL, NULL,
+                                       "s", "com.example.foo");
+                assert(r >= 0);
+
+                r = sd_bus_call_method(bus1, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.NameQueue",
+                                       "GetQueueLength", NULL, &reply2,
+                                       "s", "com.example.foo");
+                assert(r >= 0);
+                r = sd_bus_message_read(reply2, "u", &length);
+                assert(r >= 0);
+                assert(length == 2);
+
+                r = sd_bus_call_method(bus1, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                       "ReleaseName", NULL, NULL,
+                                       "s", "com.example.foo");
+                assert(r >= 0);
+
+                r = sd_bus_call_method(bus3, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.NameQueue",
+                                       "GetQueueLength", NULL, &reply3,
+                                       "s", "com.example.foo");
+                assert(r >= 0);
+                r = sd_bus_message_read(reply3, "u", &length);
+                assert(r >= 0);
+                assert(length == 1);
+
+                r = sd_bus_call_method(bus3, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                       "ReleaseName", NULL, NULL,
+                                       "s", "com.example.foo");
+                assert(r >= 0);
+        }
+
+        /* unique names and the driver are always the sole owner of their name */
+        {
+                _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+                _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *reply1 = NULL, *reply2 = NULL;
+                const char *unique_name;
+                uint32_t length;
+
+                util_broker_connect(broker, &bus);
+
+                r = sd_bus_get_unique_name(bus, &unique_name);
+                assert(r >= 0);
+
+                r = sd_bus_call_method(bus, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.NameQueue",
+                                       "GetQueueLength", NULL, &reply1,
+                                       "s", unique_name);
+                assert(r >= 0);
+                r = sd_bus_message_read(reply1, "u", &length);
+                assert(r >= 0);
+                assert(length == 1);
+
+                r = sd_bus_call_method(bus, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.NameQueue",
+                                       "GetQueueLength", NULL, &reply2,
+                                       "s", "org.freedesktop.DBus");
+                assert(r >= 0);
+                r = sd_bus_message_read(reply2, "u", &length);
+                assert(r >= 0);
+                assert(length == 1);
+        }
+
+        /* names without owner are refused, and so is the standard interface */
+        {
+                _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+                _c_cleanup_(sd_bus_error_free) sd_bus_error error1 = SD_BUS_ERROR_NULL, error2 = SD_BUS_ERROR_NULL;
+
+                util_broker_connect(broker, &bus);
+
+                r = sd_bus_call_method(bus, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.bus1.DBus.NameQueue",
+                                       "GetQueueLength", &error1, NULL,
+                                       "s", "com.example.foo");
+                assert(r < 0);
+                assert(!strcmp(error1.name, "org.freedesktop.DBus.Error.NameHasNoOwner"));
+
+                r = sd_bus_call_method(bus, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                       "GetQueueLength", &error2, NULL,
+                                       "s", "org.freedesktop.DBus");
+                assert(r < 0);
+                assert(!strcmp(error2.name, "org.freedesktop.DBus.Error.UnknownInterface"));
+        }
+
+        util_broker_terminate(broker);
+}
+
 int main(int argc, char **argv) {
         test_hello();
         test_request_name();
@@ -1293,6 +1733,8 @@ int main(int argc, char **argv) {
         test_name_has_owner();
         test_list_names();
         test_list_activatable_names();
+        test_activation_timeout();
+        test_activation_limits();
         test_list_queued_owners();
         test_get_connection_unix_user();
         test_get_connection_unix_process_id();
@@ -1300,6 +1742,9 @@ int main(int argc, char **argv) {
         test_get_id();
         test_introspect();
         test_become_monitor();
+        test_connect_peer();
+        test_connect_peer_quota();
+        test_get_queue_length();
 
         return 0;
 }
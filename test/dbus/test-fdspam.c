@@ -140,7 +140,7 @@ static int test_dispatch_fn(DispatchFile *file) {
                         if (!m)
                                 break;
 
-                        r = message_parse_metadata(m);
+                        r = message_parse_metadata(m, NULL);
                         assert(!r);
 
                         if (m->metadata.fields.reply_serial == 1) {
@@ -173,6 +173,7 @@ static void test_fd_spam(void) {
         _c_cleanup_(dispatch_context_deinit) DispatchContext d1 = DISPATCH_CONTEXT_NULL(d1);
         _c_cleanup_(connection_deinit) Connection c = CONNECTION_NULL(c);
         _c_cleanup_(c_freep) char *sender = NULL;
+        FDListStats base, stats;
         size_t i, j, n_fds = 0;
         int fds[512];
         int r, fd;
@@ -267,6 +268,8 @@ static void test_fd_spam(void) {
 
         /* create destinations as uid 3 and spam them */
         {
+                fdlist_get_stats(&base);
+
                 for (i = 0; i < C_ARRAY_SIZE(fds); ++i) {
                         _c_cleanup_(dispatch_context_deinit) DispatchContext d2 = DISPATCH_CONTEXT_NULL(d2);
                         _c_cleanup_(connection_deinit) Connection dst = CONNECTION_NULL(dst);
@@ -338,6 +341,14 @@ static void test_fd_spam(void) {
                                 assert(!r);
                         }
                 }
+
+                /*
+                 * Each destination got its own spam message, but their
+                 * fdlists must have been recycled rather than allocated anew.
+                 */
+                fdlist_get_stats(&stats);
+                assert(stats.n_allocs - base.n_allocs <= 2);
+                assert(stats.n_recycled - base.n_recycled >= C_ARRAY_SIZE(fds) - 2);
         }
 
         /* attempt a single non-fd method call on uid 3 */
@@ -425,6 +436,7 @@ int main(int argc, char **argv) {
                 return 77;
 
         test_fd_spam();
+        fdlist_flush();
 
         return 0;
 }
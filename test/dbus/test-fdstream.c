@@ -145,7 +145,7 @@ static int test_fd_stream_fn(DispatchFile *file) {
                         if (!m)
                                 break;
 
-                        r = message_parse_metadata(m);
+                        r = message_parse_metadata(m, NULL);
                         assert(!r);
                         assert(m->metadata.fields.unix_fds == fdlist_count(m->fds));
 
@@ -272,6 +272,8 @@ int main(int argc, char **argv) {
          * dbus-daemon(1), so we disable the test. Both issues are reported and
          * are hopefully fixed soon. See BZ #101754, #101755
          */
+        FDListStats stats;
+
         if (getenv("DBUS_BROKER_TEST_DAEMON"))
                 return 77;
 
@@ -291,5 +293,15 @@ int main(int argc, char **argv) {
                         assert(test_fd_stream_got == 3);
         }
 
+        /*
+         * Each run sends one FD and receives it back, unless it is rejected.
+         * At most two fdlists are alive at a time, everything else must be
+         * recycled from the fdlist pool.
+         */
+        fdlist_get_stats(&stats);
+        assert(stats.n_allocs <= 2);
+        assert(stats.n_allocs + stats.n_recycled == 5);
+
+        fdlist_flush();
         return 0;
 }
@@ -0,0 +1,312 @@
+/*
+ * Launcher Activation Tests
+ *
+ * These tests spawn dbus-broker-launch with a private configuration and
+ * service directory, and connect a mock systemd to the resulting bus. The
+ * mock fails every activation, and we verify the failures reach the launcher,
+ * which in turn makes the broker fail pending activation requests right away.
+ */
+
+#include <c-macro.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <systemd/sd-bus.h>
+#include <systemd/sd-event.h>
+#include <unistd.h>
+#include "util-broker.h"
+
+typedef struct Launcher Launcher;
+
+struct Launcher {
+        char dir[64];
+        char *path_config;
+        char *path_services;
+        char *path_unit;
+        char *path_alias;
+        char *path_transient;
+        char *path_socket;
+        pid_t pid;
+};
+
+static const char *test_config =
+        "<!DOCTYPE busconfig PUBLIC "
+        "\"-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN\" "
+        "\"http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd\">\n"
+        "<busconfig>\n"
+        "  <policy context=\"default\">\n"
+        "    <allow user=\"*\"/>\n"
+        "    <allow send_destination=\"*\"/>\n"
+        "    <allow receive_sender=\"*\"/>\n"
+        "    <allow own=\"*\"/>\n"
+        "  </policy>\n"
+        "</busconfig>\n";
+
+static void test_write_file(const char *path, const char *content) {
+        FILE *f;
+
+        f = fopen(path, "we");
+        assert(f);
+        assert(fputs(content, f) >= 0);
+        assert(!fclose(f));
+}
+
+static void test_launcher_spawn(Launcher *launcher) {
+        int r;
+
+        strcpy(launcher->dir, "/tmp/dbus-broker-test-XXXXXX");
+        assert(mkdtemp(launcher->dir));
+
+        r = asprintf(&launcher->path_config, "%s/bus.conf", launcher->dir);
+        assert(r >= 0);
+        r = asprintf(&launcher->path_services, "%s/services", launcher->dir);
+        assert(r >= 0);
+        r = asprintf(&launcher->path_unit, "%s/com.example.Unit.service", launcher->path_services);
+        assert(r >= 0);
+        r = asprintf(&launcher->path_alias, "%s/com.example.Alias.service", launcher->path_services);
+        assert(r >= 0);
+        r = asprintf(&launcher->path_transient, "%s/com.example.Transient.service", launcher->path_services);
+        assert(r >= 0);
+        r = asprintf(&launcher->path_socket, "%s/bus", launcher->dir);
+        assert(r >= 0);
+
+        r = mkdir(launcher->path_services, 0755);
+        assert(!r);
+
+        test_write_file(launcher->path_config, test_config);
+        test_write_file(launcher->path_unit,
+                        "[D-BUS Service]\n"
+                        "Name=com.example.Unit\n"
+                        "SystemdService=example-unit.service\n");
+        test_write_file(launcher->path_alias,
+                        "[D-BUS Service]\n"
+                        "Name=com.example.Alias\n"
+                        "SystemdService=example-unit.service\n");
+        test_write_file(launcher->path_transient,
+                        "[D-BUS Service]\n"
+                        "Name=com.example.Transient\n"
+                        "Exec=/bin/true\n");
+
+        launcher->pid = fork();
+        assert(launcher->pid >= 0);
+
+        if (launcher->pid == 0) {
+                /* make the launcher, and thus the broker, die if we do */
+                r = prctl(PR_SET_PDEATHSIG, SIGTERM);
+                assert(!r);
+
+                r = execl("./src/dbus-broker-launch",
+                          "./src/dbus-broker-launch",
+                          "--verbose",
+                          "--listen", launcher->path_socket,
+                          "--broker", "./src/dbus-broker",
+                          "--config-file", launcher->path_config,
+                          "--service-dir", launcher->path_services,
+                          (char *)NULL);
+                /* execl(3) only returns on failure */
+                assert(r >= 0);
+                abort();
+        }
+}
+
+static void test_launcher_terminate(Launcher *launcher) {
+        int r, status;
+
+        r = kill(launcher->pid, SIGTERM);
+        assert(!r);
+
+        r = waitpid(launcher->pid, &status, 0);
+        assert(r == launcher->pid);
+
+        /* the launcher removes its socket, unless it was killed early */
+        unlink(launcher->path_socket);
+        unlink(launcher->path_transient);
+        unlink(launcher->path_alias);
+        unlink(launcher->path_unit);
+        rmdir(launcher->path_services);
+        unlink(launcher->path_config);
+        rmdir(launcher->dir);
+
+        free(launcher->path_socket);
+        free(launcher->path_transient);
+        free(launcher->path_alias);
+        free(launcher->path_unit);
+        free(launcher->path_services);
+        free(launcher->path_config);
+}
+
+static void test_launcher_connect(Launcher *launcher, sd_bus **busp) {
+        _c_cleanup_(c_freep) char *address = NULL;
+        int r;
+
+        r = asprintf(&address, "unix:path=%s", launcher->path_socket);
+        assert(r >= 0);
+
+        /* the launcher might not have created its socket, yet */
+        for (unsigned int i = 0; ; ++i) {
+                _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+
+                r = sd_bus_new(&bus);
+                assert(r >= 0);
+
+                r = sd_bus_set_address(bus, address);
+                assert(r >= 0);
+
+                r = sd_bus_set_bus_client(bus, true);
+                assert(r >= 0);
+
+                r = sd_bus_start(bus);
+                if (r >= 0) {
+                        *busp = bus;
+                        bus = NULL;
+                        return;
+                }
+
+                assert(r == -ENOENT || r == -ECONNREFUSED);
+                assert(i < 1000);
+                usleep(10 * 1000);
+        }
+}
+
+static int test_activator_fn(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *signal = NULL;
+        unsigned int *n_requests = userdata;
+        const char *unit;
+        int r;
+
+        r = sd_bus_message_read(m, "s", &unit);
+        assert(r >= 0);
+        assert(!strcmp(unit, "example-unit.service"));
+
+        ++*n_requests;
+
+        /* refuse the activation, just like systemd does for masked units */
+        r = sd_bus_message_new_signal(sd_bus_message_get_bus(m),
+                                      &signal,
+                                      "/org/freedesktop/DBus",
+                                      "org.freedesktop.systemd1.Activator",
+                                      "ActivationFailure");
+        assert(r >= 0);
+
+        r = sd_bus_message_append(signal, "sss", unit, "org.freedesktop.systemd1.UnitMasked", "Unit is masked.");
+        assert(r >= 0);
+
+        r = sd_bus_message_set_destination(signal, "org.freedesktop.DBus");
+        assert(r >= 0);
+
+        r = sd_bus_send(sd_bus_message_get_bus(m), signal, NULL);
+        assert(r >= 0);
+
+        return 1;
+}
+
+static int test_systemd_fn(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        const char *member;
+
+        member = sd_bus_message_get_member(m);
+        if (!member)
+                return 0;
+
+        /* refuse the job altogether */
+        if (!strcmp(member, "StartTransientUnit"))
+                return sd_bus_reply_method_errorf(m, "org.freedesktop.systemd1.UnitExists", "Unit already exists");
+
+        return 0;
+}
+
+static int test_activation_fn(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        unsigned int *n_replies = userdata;
+        const sd_bus_error *e;
+
+        e = sd_bus_message_get_error(m);
+        assert(e);
+        assert(!strcmp(e->name, "org.freedesktop.DBus.Error.ServiceUnknown"));
+
+        if (++*n_replies == 3)
+                return sd_event_exit(sd_bus_get_event(sd_bus_message_get_bus(m)), 0);
+
+        return 0;
+}
+
+static void test_activation_failure(void) {
+        _c_cleanup_(sd_event_unrefp) sd_event *event = NULL;
+        Launcher launcher = { .pid = -1 };
+        unsigned int n_requests = 0, n_replies = 0;
+        int r;
+
+        test_launcher_spawn(&launcher);
+
+        r = sd_event_new(&event);
+        assert(r >= 0);
+
+        {
+                _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *systemd = NULL, *client = NULL;
+
+                /* setup mock systemd */
+                test_launcher_connect(&launcher, &systemd);
+
+                r = sd_bus_request_name(systemd, "org.freedesktop.systemd1", 0);
+                assert(r >= 0);
+
+                r = sd_bus_add_object(systemd, NULL, "/org/freedesktop/systemd1", test_systemd_fn, NULL);
+                assert(r >= 0);
+
+                r = sd_bus_add_match(systemd, NULL,
+                                     "type='signal',"
+                                     "interface='org.freedesktop.systemd1.Activator',"
+                                     "member='ActivationRequest'",
+                                     test_activator_fn, &n_requests);
+                assert(r >= 0);
+
+                r = sd_bus_attach_event(systemd, event, SD_EVENT_PRIORITY_NORMAL);
+                assert(r >= 0);
+
+                /* request activation of all services */
+                test_launcher_connect(&launcher, &client);
+
+                r = sd_bus_attach_event(client, event, SD_EVENT_PRIORITY_NORMAL);
+                assert(r >= 0);
+
+                r = sd_bus_call_method_async(client, NULL,
+                                             "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                             "StartServiceByName", test_activation_fn, &n_replies,
+                                             "su", "com.example.Unit", 0);
+                assert(r >= 0);
+
+                r = sd_bus_call_method_async(client, NULL,
+                                             "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                             "StartServiceByName", test_activation_fn, &n_replies,
+                                             "su", "com.example.Alias", 0);
+                assert(r >= 0);
+
+                r = sd_bus_call_method_async(client, NULL,
+                                             "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                             "StartServiceByName", test_activation_fn, &n_replies,
+                                             "su", "com.example.Transient", 0);
+                assert(r >= 0);
+
+                /*
+                 * All requests must fail long before the activation timeout
+                 * of the broker would kick in, which would be reported as
+                 * TimedOut rather than ServiceUnknown.
+                 */
+                r = sd_event_loop(event);
+                assert(!r);
+                assert(n_requests >= 1);
+                assert(n_replies == 3);
+        }
+
+        test_launcher_terminate(&launcher);
+}
+
+int main(int argc, char **argv) {
+        /* the launcher is specific to dbus-broker */
+        if (getenv("DBUS_BROKER_TEST_DAEMON"))
+                return 77;
+
+        test_activation_failure();
+        return 0;
+}
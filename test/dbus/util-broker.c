@@ -69,15 +69,17 @@ static int util_append_policy(sd_bus_message *m) {
                  * Default test policy:
                  *  - allow all connections
                  *  - allow everyone to own names
-                 *  - allow all sends
-                 *  - allow all recvs
+                 *  - allow all sends, except to the org.bus1.Denied interface
+                 *  - allow all recvs, except from owners of org.bus1.DeniedSender
                  */
                 r = sd_bus_message_append(m,
                                           "bt" "a(btbs)" "a(btssssub)" "a(btssssub)",
                                           true, 1,
                                           1, true, 1, true, "",
-                                          1, true, 1, "", "", "", "", 0, false,
-                                          1, true, 1, "", "", "", "", 0, false);
+                                          2, true, 1, "", "", "", "", 0, false,
+                                             false, 2, "", "", "org.bus1.Denied", "", 0, false,
+                                          2, true, 1, "", "", "", "", 0, false,
+                                             false, 2, "org.bus1.DeniedSender", "", "", "", 0, false);
 
                 r = sd_bus_message_close_container(m);
                 assert(r >= 0);
@@ -119,10 +121,12 @@ static int util_append_policy(sd_bus_message *m) {
         return 0;
 }
 
-void util_fork_broker(sd_bus **busp, sd_event *event, int listener_fd, pid_t *pidp) {
+void util_fork_broker(sd_bus **busp, sd_event *event, int listener_fd, const char *activatable, unsigned int activatable_messages, unsigned int max_bytes, unsigned int max_objects, pid_t *pidp, pid_t *childp) {
         _c_cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
         _c_cleanup_(sd_bus_message_unrefp) sd_bus_message *message = NULL;
-        _c_cleanup_(c_freep) char *fdstr = NULL;
+        _c_cleanup_(c_freep) char *fdstr = NULL, *bytestr = NULL, *objectstr = NULL;
+        const char *argv[11];
+        size_t n_argv = 0;
         int r, pair[2];
         pid_t pid;
 
@@ -147,16 +151,44 @@ void util_fork_broker(sd_bus **busp, sd_event *event, int listener_fd, pid_t *pi
                 r = asprintf(&fdstr, "%d", pair[1]);
                 assert(r >= 0);
 
-                r = execl("./src/dbus-broker",
-                          "./src/dbus-broker",
-                          "--verbose",
-                          "--controller", fdstr,
-                          (char *)NULL);
-                /* execl(2) only returns on error */
+                argv[n_argv++] = "./src/dbus-broker";
+                argv[n_argv++] = "--verbose";
+                argv[n_argv++] = "--controller";
+                argv[n_argv++] = fdstr;
+
+                /* use a short activation timeout, so activation tests do not stall */
+                argv[n_argv++] = "--activation-timeout";
+                argv[n_argv++] = "100000";
+
+                /* lower the quotas, if requested */
+                if (max_bytes) {
+                        r = asprintf(&bytestr, "%u", max_bytes);
+                        assert(r >= 0);
+
+                        argv[n_argv++] = "--max-bytes";
+                        argv[n_argv++] = bytestr;
+                }
+
+                if (max_objects) {
+                        r = asprintf(&objectstr, "%u", max_objects);
+                        assert(r >= 0);
+
+                        argv[n_argv++] = "--max-objects";
+                        argv[n_argv++] = objectstr;
+                }
+
+                argv[n_argv] = NULL;
+                assert(n_argv < C_ARRAY_SIZE(argv));
+
+                r = execv(argv[0], (char **)argv);
+                /* execv(2) only returns on error */
                 assert(r >= 0);
                 abort();
         }
 
+        if (childp)
+                *childp = pid;
+
         r = sd_event_add_child(event, NULL, pid, WEXITED, util_event_sigchld, NULL);
         assert(r >= 0);
 
@@ -194,6 +226,43 @@ void util_fork_broker(sd_bus **busp, sd_event *event, int listener_fd, pid_t *pi
         r = sd_bus_call(bus, message, -1, NULL, NULL);
         assert(r >= 0);
 
+        /*
+         * Register the activatable name, if requested. Activation requests
+         * are sent to us as signals, but we never act on them. Hence, the name
+         * is never claimed and all activation attempts time out. If requested,
+         * the number of messages queued on the name is limited.
+         */
+        if (activatable) {
+                if (activatable_messages)
+                        r = sd_bus_call_method(bus,
+                                               NULL,
+                                               "/org/bus1/DBus/Broker",
+                                               "org.bus1.DBus.Broker",
+                                               "AddName",
+                                               NULL,
+                                               NULL,
+                                               "osua{su}",
+                                               "/org/bus1/DBus/Name/0",
+                                               activatable,
+                                               getuid(),
+                                               1,
+                                               "Messages", activatable_messages);
+                else
+                        r = sd_bus_call_method(bus,
+                                               NULL,
+                                               "/org/bus1/DBus/Broker",
+                                               "org.bus1.DBus.Broker",
+                                               "AddName",
+                                               NULL,
+                                               NULL,
+                                               "osua{su}",
+                                               "/org/bus1/DBus/Name/0",
+                                               activatable,
+                                               getuid(),
+                                               0);
+                assert(r >= 0);
+        }
+
         *busp = bus;
         bus = NULL;
 }
@@ -303,7 +372,7 @@ static void *util_broker_thread(void *userdata) {
         util_event_new(&event);
 
         if (broker->listener_fd >= 0) {
-                util_fork_broker(&bus, event, broker->listener_fd, &broker->pid);
+                util_fork_broker(&bus, event, broker->listener_fd, broker->activatable, broker->activatable_messages, broker->max_bytes, broker->max_objects, &broker->pid, &broker->child_pid);
         } else {
                 assert(broker->listener_fd < 0);
                 util_fork_daemon(event, broker->pipe_fds[1], &broker->pid);
@@ -435,6 +504,29 @@ void util_broker_terminate(Broker *broker) {
         assert(broker->pipe_fds[0] < 0);
 }
 
+void util_broker_drain(Broker *broker) {
+        int r;
+
+        /* only dbus-broker is forked directly, so only it can be signaled */
+        assert(broker->child_pid > 0);
+
+        r = kill(broker->child_pid, SIGTERM);
+        assert(!r);
+}
+
+void util_broker_wait(Broker *broker) {
+        void *value;
+        int r;
+
+        /* the broker must exit on its own, and do so successfully */
+        r = pthread_join(broker->thread, &value);
+        assert(!r);
+        assert(!value);
+
+        assert(broker->listener_fd < 0);
+        assert(broker->pipe_fds[0] < 0);
+}
+
 void util_broker_connect_fd(Broker *broker, int *fdp) {
         _c_cleanup_(c_closep) int fd = -1;
         int r;
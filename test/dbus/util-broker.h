@@ -22,6 +22,11 @@ struct Broker {
         int listener_fd;
         int pipe_fds[2];
         pid_t pid;
+        pid_t child_pid;
+        const char *activatable;
+        unsigned int activatable_messages;
+        unsigned int max_bytes;
+        unsigned int max_objects;
 };
 
 #define BROKER_NULL {                                                           \
@@ -35,7 +40,7 @@ struct Broker {
 /* misc */
 
 void util_event_new(sd_event **eventp);
-void util_fork_broker(sd_bus **busp, sd_event *event, int listener_fd, pid_t *pidp);
+void util_fork_broker(sd_bus **busp, sd_event *event, int listener_fd, const char *activatable, unsigned int activatable_messages, unsigned int max_bytes, unsigned int max_objects, pid_t *pidp, pid_t *childp);
 void util_fork_daemon(sd_event *event, int pipe_fd, pid_t *pidp);
 
 /* broker */
@@ -44,6 +49,8 @@ void util_broker_new(Broker **brokerp);
 Broker *util_broker_free(Broker *broker);
 void util_broker_spawn(Broker *broker);
 void util_broker_terminate(Broker *broker);
+void util_broker_drain(Broker *broker);
+void util_broker_wait(Broker *broker);
 
 void util_broker_connect_fd(Broker *broker, int *fdp);
 void util_broker_connect_raw(Broker *broker, sd_bus **busp);